@@ -0,0 +1,547 @@
+/* =====================================================================
+ * batch.c
+ * runs add-ins headless, many at a time, and records where each one ends up
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ /* usage: batch [-j threads] [-b boot-cycles [-c cache-dir]] [-t trace-dir] rom.bin flash.bin manifest results
+  *
+  * every manifest line is one job:  add-in.g3a  input-script  cycle-budget
+  * ('-' for no input, '#' starts a comment).  An input script is lines of
+  * "cycle keycode down|up" in cycle order, keycodes as in keyboard.h.
+  *
+  * Jobs are dealt out to per-thread deques up front; a thread works from
+  * the bottom of its own deque and, once that is empty, steals from the
+  * top of somebody else's, so a few long jobs don't leave the other
+  * threads idle.  Each thread runs one Cpu at a time and they share
+  * nothing but the decode table and the page cache behind the mmap'd ROM.
+  * Key events and the budget are scheduler events like any peripheral's,
+  * checked between blocks, so a job can go over its budget by up to one
+  * block; the cycle count written out is what was actually run.  A key
+  * reaches KEYSC at the first matrix scan after its cycle.  The results file gets one line per job in
+  * manifest order.
+  *
+  * With -b every job first runs the OS from reset for that many cycles
+  * before the add-in is mapped and started; script cycles, the budget and
+  * the cycles written out all count from the end of the boot.  With -c as
+  * well the first job to boot leaves the machine in cache-dir, keyed on
+  * the boot length and the contents of the ROM and flash files (hashed
+  * once here, before any job starts), and the rest map it instead of
+  * booting.  Jobs that start together may all boot; the last one to finish
+  * writing wins.
+  *
+  * Built with -DPROFILE every job is sampled from the start of the add-in
+  * (profile.h); its hottest PCs and routines go to stderr and its call
+  * chains to results.N.folded, N counting manifest lines from 0.
+  *
+  * -t, which needs a build with -DTRACE, writes every instruction each job
+  * runs from the start of the add-in to trace-dir/N.trace (trace.h), coded
+  * and written by a companion thread per job; tracedump reads them. */
+ 
+ #include <stdio.h>
+ #include <stdlib.h>
+ #include <string.h>
+ #include <unistd.h>
+ #include <pthread.h>
+ #include <stdatomic.h>
+ #include "registers.h"
+ #include "memory.h"
+ #include "decode.h"
+ #include "block.h"
+ #include "keyboard.h"
+ #include "lcd.h"
+ #include "sched.h"
+ #include "snapshot.h"
+ #include "profile.h"
+ #include "companion.h"
+ #include "trace.h"
+ #include "cpu.h"
+ 
+ #define ADDIN_EXIT 0xfffffff0     //PR on entry; the add-in returning from main() lands here
+ 
+ typedef struct
+ {
+	uint64_t cycle;
+	int key, down;
+ } Key_Event;
+ 
+ /* a running job's input and budget, handed to the Cpu as scheduler
+  * events so the run loop only looks at them when one is due */
+ typedef struct
+ {
+	Key_Event *ev;
+	int count, next;
+	int stopped;                   //budget used up
+	uint64_t start;                //cycles at the end of the boot, which everything counts from
+	Event keys, budget;
+ } Feed;
+ 
+ typedef struct
+ {
+	char *g3a, *script;
+	uint64_t budget;
+	//filled in by the worker
+	const char *status;
+	uint64_t cycles, vram_hash;
+	uint32_t r[16], pc, pr, sr;
+ } Job;
+ 
+ /* Chase-Lev deque without growth: every job is pushed before the threads
+  * start, so only pop (owner, bottom end) and steal (anyone, top end) are
+  * needed.  top and bottom sit on their own cache lines */
+ typedef struct
+ {
+	_Alignas(64) atomic_long top;
+	_Alignas(64) atomic_long bottom;
+	int *jobs;
+ } Deque;
+ 
+ typedef struct
+ {
+	Deque *deques;
+	int count;
+	Job *jobs;
+	const char *rom, *flash;
+	uint64_t boot;                 //cycles to run the OS from reset first, 0 to go straight to the add-in
+	const char *cache;             //where booted machines are kept, 0 for nowhere
+	uint64_t key;                  //boot length, ROM and flash
+	const char *results;
+	const char *trace;             //where jobs' traces go, 0 for nowhere
+ #if defined(PROFILE_PAIRS) || defined(PROFILE)
+	pthread_mutex_t print_lock;          //keeps each job's dump in one piece
+ #endif
+ } Pool;
+ 
+ typedef struct
+ {
+	Pool *pool;
+	int self;
+ } Worker;
+ 
+ 
+ static int Pop(Deque *d)
+ {
+	long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+	long t;
+	int job = -1;
+	
+	atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	t = atomic_load_explicit(&d->top, memory_order_relaxed);
+	if (t <= b) {
+		job = d->jobs[b];
+		if (t == b) {  //last one; race any thief for it
+			if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+				job = -1;
+			atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+		}
+	} else
+		atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+	return job;
+ }
+ 
+ static int Steal(Deque *d)
+ {
+	long t = atomic_load_explicit(&d->top, memory_order_acquire);
+	long b;
+	
+	atomic_thread_fence(memory_order_seq_cst);
+	b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+	while (t < b) {
+		int job = d->jobs[t];
+		if (atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+			return job;
+		b = atomic_load_explicit(&d->bottom, memory_order_acquire);  //t was reloaded by the failed CAS
+	}
+	return -1;
+ }
+ 
+ static Key_Event *Load_Script(const char *path, int *count)
+ {
+	FILE *f;
+	char line[256], dir[16];
+	Key_Event *ev = 0, *grown;
+	int n = 0, size = 0;
+	unsigned long long cycle;
+	
+	*count = 0;
+	if (!strcmp(path, "-"))
+		return 0;
+	if (!(f = fopen(path, "r"))) {
+		perror(path);
+		return (Key_Event *)-1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		int key;
+		if (line[0] == '#' || sscanf(line, "%llu %d %15s", &cycle, &key, dir) != 3)
+			continue;
+		if (n && cycle < ev[n - 1].cycle) {
+			fprintf(stderr, "%s: events out of order at cycle %llu\n", path, cycle);
+			fclose(f);
+			free(ev);
+			return (Key_Event *)-1;  //not run on part of its script, where it could still look like it passed
+		}
+		if (n == size) {
+			size = size ? size * 2 : 64;
+			if (!(grown = realloc(ev, size * sizeof(Key_Event)))) {
+				fprintf(stderr, "%s: out of memory\n", path);
+				fclose(f);
+				free(ev);
+				return (Key_Event *)-1;
+			}
+			ev = grown;
+		}
+		ev[n].cycle = cycle;
+		ev[n].key = key;
+		ev[n].down = strcmp(dir, "up") != 0;
+		++n;
+	}
+	fclose(f);
+	*count = n;
+	return ev;
+ }
+ 
+ static void Feed_Keys(Cpu *cpu, void *opaque)  //press and release what is due, then wait for the next one
+ {
+	Feed *f = opaque;
+	while (f->next < f->count && f->start + f->ev[f->next].cycle <= cpu->cycles) {
+		Keyboard_Set(cpu, f->ev[f->next].key, f->ev[f->next].down);
+		++f->next;
+	}
+	if (f->next < f->count)
+		Sched_Add(cpu, &f->keys, f->start + f->ev[f->next].cycle);
+ }
+ 
+ static void Feed_Budget(Cpu *cpu, void *opaque)
+ {
+	((Feed *)opaque)->stopped = 1;
+ }
+ 
+ /* power on and run the OS until the boot is done, or map the machine a
+  * previous job left at that point.  Cpu_New() left it at power on */
+ static int Boot(Pool *pool, Cpu *cpu)
+ {
+	char path[1024];
+	
+	if (!pool->boot)
+		return 1;
+	if (pool->cache) {
+		snprintf(path, sizeof(path), "%s/%016llx.snap", pool->cache, (unsigned long long)pool->key);
+		if (Snapshot_Load(cpu, path, pool->key))
+			return 1;
+	}
+	setjmp(cpu->fault);
+	cpu->fault_ready = 1;
+	while (cpu->cycles < pool->boot) {
+		if (cpu->cycles >= cpu->next_event)
+			Sched_Run(cpu);
+		Block_Run(cpu);
+	}
+	cpu->fault_ready = 0;  //the jmp_buf goes with this frame
+	if (pool->cache && !Snapshot_Write(cpu, path, pool->key))
+		fprintf(stderr, "batch: can't write %s\n", path);
+	return 1;
+ }
+ 
+ #ifdef PROFILE
+ static void Write_Profile(Pool *pool, Job *job, Cpu *cpu)
+ {
+	char path[1024];
+	FILE *f;
+	
+	snprintf(path, sizeof(path), "%s.%d.folded", pool->results, (int)(job - pool->jobs));
+	if ((f = fopen(path, "w"))) {
+		Profile_Write_Folded(cpu, f);
+		fclose(f);
+	} else
+		perror(path);
+	pthread_mutex_lock(&pool->print_lock);
+	fprintf(stderr, "#profile of %s\n", job->g3a);
+	Profile_Print_Hot(cpu, stderr, 32);
+	pthread_mutex_unlock(&pool->print_lock);
+ }
+ #endif
+ 
+ static void Run_Job(Pool *pool, Job *job)
+ {
+	Cpu *cpu = Cpu_New();
+	Key_Event *ev;
+	int count;
+	Feed feed;  //only changed through the events' pointers, so it is in memory, not a register, over a longjmp
+ #ifdef TRACE
+	char path[1024];
+ #endif
+	
+	job->status = "error";
+	if (!cpu)
+		return;
+	ev = Load_Script(job->script, &count);
+	if (ev == (Key_Event *)-1 || !Keyboard_Init(cpu) || !Memory_Load_ROM(cpu, pool->rom)
+		|| (strcmp(pool->flash, "-") && !Memory_Load_Flash(cpu, pool->flash)) || !Boot(pool, cpu)
+		|| !Memory_Load_Addin(cpu, job->g3a)) {
+		if (ev != (Key_Event *)-1)
+			free(ev);
+		Cpu_Free(cpu);
+		return;
+	}
+	
+	//start the add-in the way the OS would hand over to it
+	cpu->pc = ADDIN_BASE;
+	cpu->pr = ADDIN_EXIT;
+	cpu->r[15] = ADDIN_RAM + ADDIN_RAM_SIZE;
+	
+	feed.ev = ev;
+	feed.count = count;
+	feed.next = 0;
+	feed.stopped = 0;
+	feed.start = cpu->cycles;
+	feed.keys.fn = Feed_Keys;
+	feed.keys.opaque = &feed;
+	feed.keys.prev = 0;
+	feed.budget.fn = Feed_Budget;
+	feed.budget.opaque = &feed;
+	feed.budget.prev = 0;
+	if (count)
+		Sched_Add(cpu, &feed.keys, feed.start + ev[0].cycle);
+	Sched_Add(cpu, &feed.budget, feed.start + job->budget);
+	
+ #ifdef PROFILE
+	Profile_Clear(cpu);  //only the add-in, not the boot
+	Profile_Start(cpu, 0);  //after Boot(), loading a snapshot drops it
+ #endif
+ #ifdef TRACE
+	if (pool->trace) {
+		snprintf(path, sizeof(path), "%s/%d.trace", pool->trace, (int)(job - pool->jobs));
+		Companion_Start(cpu);  //without one the trace is written between blocks instead
+		if (!Trace_Start(cpu, path)) {
+			perror(path);
+			free(ev);
+			Cpu_Free(cpu);
+			return;
+		}
+	}
+ #endif
+	setjmp(cpu->fault);  //an MMU fault comes back here with PC on its handler and the loop carries on
+	cpu->fault_ready = 1;
+	while (cpu->pc != ADDIN_EXIT) {
+		if (cpu->cycles >= cpu->next_event) {  //only between blocks, see cpu.h
+			Sched_Run(cpu);
+			if (feed.stopped)
+				break;
+		}
+		Block_Run(cpu);
+	}
+	
+	job->status = cpu->pc == ADDIN_EXIT ? "exit" : "budget";
+	job->cycles = cpu->cycles - feed.start;
+	job->vram_hash = Lcd_Hash(cpu);
+	memcpy(job->r, cpu->r, sizeof(job->r));
+	job->pc = cpu->pc;
+	job->pr = cpu->pr;
+	updateSR(cpu);
+	job->sr = cpu->sr;
+ #ifdef TRACE
+	if (pool->trace && !Trace_Stop(cpu)) {
+		fprintf(stderr, "batch: can't write %s\n", path);
+		job->status = "error";
+	}
+ #endif
+ #ifdef PROFILE_PAIRS
+	pthread_mutex_lock(&pool->print_lock);
+	fprintf(stderr, "#instruction pairs in %s\n", job->g3a);
+	Block_Print_Pairs(cpu, stderr, 64);
+	pthread_mutex_unlock(&pool->print_lock);
+ #endif
+ #ifdef PROFILE
+	Write_Profile(pool, job, cpu);
+ #endif
+	free(ev);
+	Cpu_Free(cpu);
+ }
+ 
+ static void *Work(void *arg)
+ {
+	Worker *w = arg;
+	Pool *pool = w->pool;
+	unsigned int seed = w->self * 2654435761u + 1;
+	int job, i, victim;
+	
+	for (;;) {
+		if ((job = Pop(&pool->deques[w->self])) < 0) {
+			/* own deque is dry; sweep the others starting somewhere random
+			 * so thieves don't all pile onto the same victim */
+			seed = seed * 1103515245 + 12345;
+			victim = (seed >> 16) % pool->count;
+			for (i = 0; i < pool->count && job < 0; ++i)
+				if ((victim + i) % pool->count != w->self)
+					job = Steal(&pool->deques[(victim + i) % pool->count]);
+			if (job < 0)
+				break;  //nothing is ever added, so everything empty means done
+		}
+		Run_Job(pool, &pool->jobs[job]);
+	}
+	return 0;
+ }
+ 
+ static Job *Load_Manifest(const char *path, int *count)
+ {
+	FILE *f = fopen(path, "r");
+	char line[1024], g3a[512], script[512];
+	unsigned long long budget;
+	Job *jobs = 0, *grown;
+	int n = 0, size = 0;
+	
+	*count = 0;
+	if (!f) {
+		perror(path);
+		return (Job *)-1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || sscanf(line, "%511s %511s %llu", g3a, script, &budget) != 3)
+			continue;
+		if (n == size) {
+			size = size ? size * 2 : 64;
+			if (!(grown = realloc(jobs, size * sizeof(Job)))) {
+				fprintf(stderr, "%s: out of memory\n", path);
+				fclose(f);
+				return (Job *)-1;
+			}
+			jobs = grown;
+		}
+		memset(&jobs[n], 0, sizeof(Job));
+		jobs[n].g3a = strdup(g3a);
+		jobs[n].script = strdup(script);
+		jobs[n].budget = budget;
+		++n;
+	}
+	fclose(f);
+	*count = n;
+	return jobs;
+ }
+ 
+ static int Write_Results(const char *path, Job *jobs, int count)
+ {
+	FILE *f = fopen(path, "w");
+	int i, r;
+	
+	if (!f) {
+		perror(path);
+		return 0;
+	}
+	fprintf(f, "#add-in\tstatus\tcycles\tvram\tpc\tpr\tsr\tr0..r15\n");
+	for (i = 0; i < count; ++i) {
+		Job *j = &jobs[i];
+		fprintf(f, "%s\t%s\t%llu\t%016llx\t%08x\t%08x\t%08x", j->g3a, j->status, (unsigned long long)j->cycles,
+			(unsigned long long)j->vram_hash, j->pc, j->pr, j->sr);
+		for (r = 0; r < 16; ++r)
+			fprintf(f, "\t%08x", j->r[r]);
+		fputc('\n', f);
+	}
+	return fclose(f) == 0;
+ }
+ 
+ int main(int argc, char **argv)
+ {
+	Pool pool;
+	Worker *workers;
+	pthread_t *threads;
+	int threads_wanted = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int count, i, ok;
+	
+	pool.boot = 0;
+	pool.cache = 0;
+	pool.trace = 0;
+	while (argc > 2 && argv[1][0] == '-' && argv[1][1] && !argv[1][2]) {
+		if (argv[1][1] == 'j')
+			threads_wanted = atoi(argv[2]);
+		else if (argv[1][1] == 'b')
+			pool.boot = strtoull(argv[2], 0, 0);
+		else if (argv[1][1] == 'c')
+			pool.cache = argv[2];
+		else if (argv[1][1] == 't')
+			pool.trace = argv[2];
+		else
+			break;
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc != 5 || threads_wanted < 1 || (pool.cache && !pool.boot)) {
+		fprintf(stderr, "usage: batch [-j threads] [-b boot-cycles [-c cache-dir]] [-t trace-dir] rom.bin flash.bin|- manifest results\n");
+		return 1;
+	}
+ #ifndef TRACE
+	if (pool.trace) {
+		fprintf(stderr, "batch: -t needs a build with -DTRACE\n");
+		return 1;
+	}
+ #endif
+	if ((pool.jobs = Load_Manifest(argv[3], &count)) == (Job *)-1)
+		return 1;
+	if (!count)  //still writes the results header
+		fprintf(stderr, "%s: no jobs\n", argv[3]);
+	if (threads_wanted > count)
+		threads_wanted = count ? count : 1;
+	
+	Decode_Init();
+	pool.rom = argv[1];
+	pool.flash = argv[2];
+	pool.key = pool.cache ? Snapshot_Key(Snapshot_Key(pool.boot, pool.rom), pool.flash) : 0;
+	pool.count = threads_wanted;
+	pool.results = argv[4];
+ #if defined(PROFILE_PAIRS) || defined(PROFILE)
+	pthread_mutex_init(&pool.print_lock, 0);
+ #endif
+	pool.deques = aligned_alloc(64, threads_wanted * sizeof(Deque));
+	workers = calloc(threads_wanted, sizeof(Worker));
+	threads = calloc(threads_wanted, sizeof(pthread_t));
+	if (!pool.deques || !workers || !threads) {
+		fprintf(stderr, "batch: out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < threads_wanted; ++i) {
+		pool.deques[i].jobs = malloc((count / threads_wanted + 1) * sizeof(int));
+		atomic_init(&pool.deques[i].top, 0);
+		atomic_init(&pool.deques[i].bottom, 0);
+	}
+	for (i = 0; i < count; ++i) {  //dealt round robin
+		Deque *d = &pool.deques[i % threads_wanted];
+		long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+		d->jobs[b] = i;
+		atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+	}
+	
+	for (i = 0; i < threads_wanted; ++i) {  //thread creation publishes the deques
+		workers[i].pool = &pool;
+		workers[i].self = i;
+		if (pthread_create(&threads[i], 0, Work, &workers[i])) {
+			fprintf(stderr, "batch: can't start thread %d\n", i);
+			return 1;
+		}
+	}
+	for (i = 0; i < threads_wanted; ++i)
+		pthread_join(threads[i], 0);
+	
+	ok = Write_Results(argv[4], pool.jobs, count);
+	for (i = 0; i < count; ++i)
+		if (strcmp(pool.jobs[i].status, "error") == 0)
+			ok = 0;
+	return ok ? 0 : 1;
+ }
@@ -0,0 +1,566 @@
+/* =====================================================================
+ * bench.c
+ * measures how fast the instruction core runs, per routine and on whole guest loops
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ /* usage: bench [-s scale] [-l label] [-o results.json]
+  *
+  * build from everything but batch.c and tracedump.c, with the same flags
+  * as whatever is being measured (-march=native, -DNO_JIT ...)
+  *
+  * Three parts, all written out as JSON (stdout by default) so runs from
+  * different commits can be put side by side; label, e.g. the commit, goes
+  * in with them.
+  *
+  * micro: one routine from Decode_Table called in a tight loop on a Cpu
+  * whose PC and pointer registers are put back before each call, less the
+  * same loop around a NOP.  Times are per call, in ns and in host ticks
+  * (the TSC on x86).
+  *
+  * workloads: small guest programs, each ending on a BRA to itself, run
+  * by Step() and by Block_Run() (blocks, fused loops and the JIT if it is
+  * built in) on a fresh Cpu.  Instructions are counted by a Step() pass
+  * first, delay slots included, since the faster tiers only count cycles;
+  * MIPS is guest instructions a host second.  Both tiers have to end with
+  * the same registers or the workload is marked as not matching.  scale
+  * multiplies how long each runs.  Every figure is the best of RUNS.
+  *
+  * snapshot: the last workload run again from a snapshot (see
+  * Time_Snapshot()); how long taking one and going back to it take, and
+  * whether each way back ends where the first run did */
+ 
+ #include <stdio.h>
+ #include <stdlib.h>
+ #include <string.h>
+ #include <time.h>
+ #include <unistd.h>
+ #if defined(__x86_64__) || defined(__i386__)
+ #include <x86intrin.h>
+ #endif
+ #include "registers.h"
+ #include "memory.h"
+ #include "decode.h"
+ #include "block.h"
+ #include "jit.h"
+ #include "sched.h"
+ #include "cpu.h"
+ #include "snapshot.h"
+ 
+ #define CODE 0x88040000           //programs go above VRAM, which is the start of RAM
+ #define DATA 0x88100000           //and read their data from here
+ #define DATA_SIZE 0x40000
+ #define RUNS 3
+ #define MICRO_CALLS (1 << 22)
+ 
+ typedef struct
+ {
+	const char *name;
+	uint16_t op;
+ } Micro;
+ 
+ /* r4 and r5 point into DATA and r0 is 0 for every call, so loads, stores
+  * and @(R0, Rn) stay in RAM; branches only have their slot run (a NOP),
+  * their targets never are */
+ static const Micro micro[] = {
+	{"NOP", 0x0009},
+	{"ADD", 0x321c},               //ADD R1, R2
+	{"ADDC", 0x321e},
+	{"ADDV", 0x321f},
+	{"CMPSTR", 0x221c},            //CMP/STR R1, R2
+	{"DIV1", 0x3214},              //DIV1 R1, R2
+	{"DT", 0x4210},
+	{"MACW", 0x454f},              //MAC.W @R4+, @R5+
+	{"MACL", 0x054f},
+	{"MOV", 0x6213},
+	{"MOVI", 0xe205},
+	{"MOVLI", 0xd201},             //MOV.L @(4, PC), R2
+	{"MOVBL", 0x6240},             //MOV.B @R4, R2
+	{"MOVWL", 0x6241},
+	{"MOVLL", 0x6242},
+	{"MOVLS", 0x2422},             //MOV.L R2, @R4
+	{"MOVLP", 0x6246},             //MOV.L @R4+, R2
+	{"MOVLM", 0x2426},             //MOV.L R2, @-R4
+	{"MOVLL0", 0x024e},            //MOV.L @(R0, R4), R2
+	{"BRA", 0xa002},
+	{"BTS", 0x8d02},
+	{"BFS", 0x8f02},
+	{"JMP", 0x442b},               //JMP @R4
+	{"JSR", 0x440b},
+	{"RTS", 0x000b},
+ };
+ 
+ typedef struct
+ {
+	const char *name;
+	const uint16_t *code;
+	unsigned int words;
+	uint32_t halt;                 //offset of the BRA to itself
+ } Workload;
+ 
+ /* unsigned 32 / 32 bit divides the way GCC inlines them: DIV0U, then 32
+  * x (ROTCL; DIV1), then ROTCL, summing the quotients */
+ static const uint16_t div_code[] = {
+	0xdd25,                        //00 mov.l @(0x98), r13   passes
+	0xe400,                        //02 mov #0, r4           sum
+	0xe200,                        //04 mov #0, r2           loop: remainder
+	0x61d3,                        //06 mov r13, r1          dividend
+	0xe307,                        //08 mov #7, r3           divisor
+	0x0019,                        //0a div0u
+ #define STEP 0x4124, 0x3234       //rotcl r1; div1 r3, r2
+ #define STEP4 STEP, STEP, STEP, STEP
+	STEP4, STEP4, STEP4, STEP4, STEP4, STEP4, STEP4, STEP4,
+ #undef STEP4
+ #undef STEP
+	0x4124,                        //8c rotcl r1             quotient
+	0x341c,                        //8e add r1, r4
+	0x4d10,                        //90 dt r13
+	0x8bb7,                        //92 bf loop
+	0xaffe,                        //94 bra .
+	0x0009,                        //96 nop
+	0x0003, 0x0d40,                //98 .long 200000
+ };
+ 
+ //1K longs at a time with the MOV.L @Rm+ / MOV.L / ADD #4 / DT / BF loop
+ static const uint16_t memcpy_code[] = {
+	0xdd06,                        //00 mov.l @(0x1c), r13   passes
+	0x0009,                        //02 nop
+	0xd206,                        //04 mov.l @(0x20), r2    pass: from
+	0xd307,                        //06 mov.l @(0x24), r3    to
+	0xd107,                        //08 mov.l @(0x28), r1    longs
+	0x6026,                        //0a mov.l @r2+, r0       copy:
+	0x2302,                        //0c mov.l r0, @r3
+	0x7304,                        //0e add #4, r3
+	0x4110,                        //10 dt r1
+	0x8bfa,                        //12 bf copy
+	0x4d10,                        //14 dt r13
+	0x8bf5,                        //16 bf pass
+	0xaffe,                        //18 bra .
+	0x0009,                        //1a nop
+	0x0000, 0x07d0,                //1c .long 2000
+	0x8810, 0x0000,                //20 .long DATA
+	0x8812, 0x0000,                //24 .long DATA + 0x20000
+	0x0000, 0x0400,                //28 .long 1024
+ };
+ 
+ //MAC.W over 2K halfword pairs
+ static const uint16_t dot_code[] = {
+	0xdd06,                        //00 mov.l @(0x1c), r13   passes
+	0x0009,                        //02 nop
+	0xd406,                        //04 mov.l @(0x20), r4    pass: a
+	0xd507,                        //06 mov.l @(0x24), r5    b
+	0xd107,                        //08 mov.l @(0x28), r1    length
+	0x0028,                        //0a clrmac
+	0x454f,                        //0c mac.w @r4+, @r5+     dot:
+	0x4110,                        //0e dt r1
+	0x8bfc,                        //10 bf dot
+	0x4d10,                        //12 dt r13
+	0x8bf6,                        //14 bf pass
+	0xaffe,                        //16 bra .
+	0x0009,                        //18 nop
+	0x0009,                        //1a nop
+	0x0000, 0x07d0,                //1c .long 2000
+	0x8810, 0x0000,                //20 .long DATA
+	0x8812, 0x0000,                //24 .long DATA + 0x20000
+	0x0000, 0x0800,                //28 .long 2048
+ };
+ 
+ /* an LCG, x = 5x + 1, with two conditional branches on its top bits
+  * that go either way about as often */
+ static const uint16_t branchy_code[] = {
+	0xdd0a,                        //00 mov.l @(0x2c), r13   passes
+	0xe101,                        //02 mov #1, r1           x
+	0xe500,                        //04 mov #0, r5
+	0x6213,                        //06 mov r1, r2           loop:
+	0x311c,                        //08 add r1, r1
+	0x311c,                        //0a add r1, r1
+	0x312c,                        //0c add r2, r1
+	0x7101,                        //0e add #1, r1
+	0x4111,                        //10 cmp/pz r1
+	0x8901,                        //12 bt 18
+	0x7503,                        //14 add #3, r5
+	0x75ff,                        //16 add #-1, r5
+	0x6013,                        //18 mov r1, r0
+	0x300c,                        //1a add r0, r0
+	0x4011,                        //1c cmp/pz r0
+	0x8b01,                        //1e bf 24
+	0x7505,                        //20 add #5, r5
+	0x7502,                        //22 add #2, r5
+	0x4d10,                        //24 dt r13
+	0x8bee,                        //26 bf loop
+	0xaffe,                        //28 bra .
+	0x0009,                        //2a nop
+	0x000f, 0x4240,                //2c .long 1000000
+ };
+ 
+ //a 64 x 64 sprite copied into VRAM a row at a time
+ static const uint16_t blit_code[] = {
+	0xdd09,                        //00 mov.l @(0x28), r13   frames
+	0x0009,                        //02 nop
+	0xd209,                        //04 mov.l @(0x2c), r2    frame: sprite
+	0xd30a,                        //06 mov.l @(0x30), r3    where it goes
+	0xd70a,                        //08 mov.l @(0x34), r7    VRAM row
+	0xe640,                        //0a mov #64, r6
+	0xe120,                        //0c mov #32, r1          row: 32 longs, 64 pixels
+	0x6433,                        //0e mov r3, r4
+	0x6026,                        //10 mov.l @r2+, r0       pixels:
+	0x2402,                        //12 mov.l r0, @r4
+	0x7404,                        //14 add #4, r4
+	0x4110,                        //16 dt r1
+	0x8bfa,                        //18 bf pixels
+	0x337c,                        //1a add r7, r3
+	0x4610,                        //1c dt r6
+	0x8bf5,                        //1e bf row
+	0x4d10,                        //20 dt r13
+	0x8bef,                        //22 bf frame
+	0xaffe,                        //24 bra .
+	0x0009,                        //26 nop
+	0x0000, 0x0fa0,                //28 .long 4000
+	0x8810, 0x0000,                //2c .long DATA
+	0xa800, 0x7850,                //30 .long VRAM_BASE + 40 rows + 40 pixels
+	0x0000, 0x0300,                //34 .long 768
+ };
+ 
+ #define WORKLOAD(name, code, halt) {name, code, sizeof(code) / sizeof(code[0]), halt}
+ static const Workload workloads[] = {
+	WORKLOAD("div", div_code, 0x94),
+	WORKLOAD("memcpy", memcpy_code, 0x18),
+	WORKLOAD("dot", dot_code, 0x16),
+	WORKLOAD("branchy", branchy_code, 0x28),
+	WORKLOAD("blit", blit_code, 0x24),
+ };
+ #undef WORKLOAD
+ 
+ static double Seconds(void)
+ {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+ }
+ 
+ static uint64_t Ticks(void)
+ {
+ #if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+ #else
+	return (uint64_t)(Seconds() * 1e9);
+ #endif
+ }
+ 
+ /* a fresh machine with w in RAM, its pass count multiplied by scale, and
+  * DATA filled with something that isn't zeros */
+ static Cpu *Load(const Workload *w, uint32_t scale)
+ {
+	Cpu *cpu = Cpu_New();
+	uint32_t i, passes;
+	
+	if (!cpu)
+		return 0;
+	for (i = 0; i < w->words; ++i)
+		Write_Word(cpu, CODE + i * 2, w->code[i]);
+	for (i = 0; i < DATA_SIZE; i += 4)
+		Write_Long(cpu, DATA + i, (i * 2654435761u) >> 7);
+	i = ((w->code[0] & 0xff) * 4 + 4) & ~3;  //every one starts with mov.l @(disp, PC), r13
+	passes = Read_Long(cpu, CODE + i);
+	Write_Long(cpu, CODE + i, passes * scale);
+	cpu->pc = CODE;
+	return cpu;
+ }
+ 
+ static uint64_t Check(Cpu *cpu)  //FNV of where it ended up
+ {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	unsigned int i;
+	for (i = 0; i < 16; ++i) {
+		h ^= cpu->r[i];
+		h *= 0x100000001b3ULL;
+	}
+	h ^= cpu->mac;
+	h *= 0x100000001b3ULL;
+	return h ^ GET_T(cpu);
+ }
+ 
+ static uint64_t Count(const Workload *w, uint32_t scale, uint64_t *cycles)
+ {
+	Cpu *cpu = Load(w, scale);
+	uint64_t n = 0;
+	
+	if (!cpu)
+		return 0;
+	while (cpu->pc != CODE + w->halt) {
+		if (cpu->cycles >= cpu->next_event)
+			Sched_Run(cpu);
+		n += Decode_Table[(uint16_t)Read_Word(cpu, cpu->pc)].flags & DECODE_DELAY ? 2 : 1;
+		Step(cpu);
+	}
+	*cycles = cpu->cycles;
+	Cpu_Free(cpu);
+	return n;
+ }
+ 
+ static void Run(Cpu *cpu, const Workload *w, int step)  //to the BRA to itself
+ {
+	if (step)
+		while (cpu->pc != CODE + w->halt) {
+			if (cpu->cycles >= cpu->next_event)
+				Sched_Run(cpu);
+			Step(cpu);
+		}
+	else
+		while (cpu->pc != CODE + w->halt) {
+			if (cpu->cycles >= cpu->next_event)
+				Sched_Run(cpu);
+			Block_Run(cpu);
+		}
+ }
+ 
+ typedef struct
+ {
+	double seconds;
+	uint64_t ticks;
+	uint64_t check;
+ } Timing;
+ 
+ static int Time(const Workload *w, uint32_t scale, int step, Timing *best)
+ {
+	Timing t;
+	Cpu *cpu;
+	double start;
+	uint64_t ticks;
+	int run;
+	
+	for (run = 0; run < RUNS; ++run) {
+		if (!(cpu = Load(w, scale)))
+			return 0;
+		start = Seconds();
+		ticks = Ticks();
+		Run(cpu, w, step);
+		t.ticks = Ticks() - ticks;
+		t.seconds = Seconds() - start;
+		t.check = Check(cpu);
+		Cpu_Free(cpu);
+		if (!run || t.seconds < best->seconds)
+			*best = t;
+	}
+	return 1;
+ }
+ 
+ static int Time_Micro(const Micro *m, double *ns, double *ticks)
+ {
+	const Decoded *e = &Decode_Table[m->op];
+	Cpu *cpu = Cpu_New();
+	double start, s, best_ns = 0, best_ticks = 0;
+	uint64_t k;
+	uint32_t i;
+	int run;
+	
+	if (!cpu)
+		return 0;
+	Write_Word(cpu, CODE, m->op);
+	Write_Word(cpu, CODE + 2, 0x0009);  //slot
+	for (run = 0; run < RUNS; ++run) {
+		start = Seconds();
+		k = Ticks();
+		for (i = 0; i < MICRO_CALLS; ++i) {
+			cpu->pc = CODE;
+			cpu->r[0] = 0;
+			cpu->r[4] = DATA + 0x100;
+			cpu->r[5] = DATA + 0x20100;
+			e->fn(cpu, e->a, e->b);
+		}
+		k = Ticks() - k;
+		s = Seconds() - start;
+		if (!run || s * 1e9 / MICRO_CALLS < best_ns) {
+			best_ns = s * 1e9 / MICRO_CALLS;
+			best_ticks = (double)k / MICRO_CALLS;
+		}
+	}
+	Cpu_Free(cpu);
+	*ns = best_ns;
+	*ticks = best_ticks;
+	return 1;
+ }
+ 
+ static uint64_t Check_All(Cpu *cpu)  //Check() with the cycle count and RAM up to the end of DATA
+ {
+	uint64_t h = Check(cpu) ^ cpu->cycles;
+	uint32_t addr;
+	for (addr = 0x88000000; addr < DATA + DATA_SIZE; addr += 4) {
+		h ^= Read_Long(cpu, addr);
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+ }
+ 
+ /* w run by blocks from a snapshot taken before it starts, then from the
+  * same snapshot again three ways: gone back to past a later snapshot,
+  * after the machine was written out and loaded back (which leaves no
+  * snapshot current), and by going forward to the later one without
+  * running.  All four have to end in the same place.  take is the later
+  * snapshot, with everything the run dirtied; restore is going back */
+ static int Time_Snapshot(const Workload *w, uint32_t scale, double *take, double *restore, int *match)
+ {
+	Cpu *cpu = Load(w, scale);
+	Snapshot *start = 0, *end = 0;
+	const char *dir = getenv("TMPDIR");
+	char path[4096];
+	uint64_t a, b, c, d;
+	double t;
+	int ok;
+	
+	if (!cpu || !(start = Snapshot_Take(cpu))) {
+		Cpu_Free(cpu);
+		return 0;
+	}
+	snprintf(path, sizeof(path), "%s/bench.%ld.snap", dir ? dir : "/tmp", (long)getpid());
+	Run(cpu, w, 0);
+	a = Check_All(cpu);
+	t = Seconds();
+	end = Snapshot_Take(cpu);
+	*take = Seconds() - t;
+	t = Seconds();
+	ok = end && Snapshot_Restore(cpu, start);
+	*restore = Seconds() - t;
+	Run(cpu, w, 0);
+	b = Check_All(cpu);
+	ok = ok && Snapshot_Write(cpu, path, 0) && Snapshot_Load(cpu, path, 0);
+	remove(path);
+	ok = ok && Snapshot_Restore(cpu, start);
+	Run(cpu, w, 0);
+	c = Check_All(cpu);
+	ok = ok && Snapshot_Restore(cpu, end);
+	d = Check_All(cpu);
+	*match = ok && a == b && a == c && a == d;
+	Snapshot_Free(start);
+	Snapshot_Free(end);
+	Cpu_Free(cpu);
+	return 1;
+ }
+ 
+ static void Write_String(FILE *f, const char *s)  //as a JSON string
+ {
+	fputc('"', f);
+	for (; *s; ++s)
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(f, "\\u%04x", *s);
+		else
+			fputc(*s, f);
+	fputc('"', f);
+ }
+ 
+ static void Write_Tier(FILE *f, const char *name, const Timing *t, uint64_t n)
+ {
+	fprintf(f, "\"%s\": {\"seconds\": %.6f, \"mips\": %.2f, \"ticks_per_insn\": %.3f}", name, t->seconds,
+		n / t->seconds / 1e6, (double)t->ticks / n);
+ }
+ 
+ int main(int argc, char **argv)
+ {
+	const char *label = "", *out = 0;
+	uint32_t scale = 1;
+	unsigned int i, count;
+	double ns, ticks, base_ns = 0, base_ticks = 0, take, restore;
+	uint64_t n, cycles;
+	Timing step, block;
+	FILE *f = stdout;
+	int match;
+	
+	while (argc > 2 && argv[1][0] == '-' && argv[1][1] && !argv[1][2]) {
+		if (argv[1][1] == 's')
+			scale = (uint32_t)strtoul(argv[2], 0, 0);
+		else if (argv[1][1] == 'l')
+			label = argv[2];
+		else if (argv[1][1] == 'o')
+			out = argv[2];
+		else
+			break;
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc != 1 || !scale) {
+		fprintf(stderr, "usage: bench [-s scale] [-l label] [-o results.json]\n");
+		return 1;
+	}
+	if (out && !(f = fopen(out, "w"))) {
+		perror(out);
+		return 1;
+	}
+	
+	Decode_Init();
+	fprintf(f, "{\n\"label\": ");
+	Write_String(f, label);
+	fprintf(f, ",\n");
+ #ifdef JIT
+	fprintf(f, "\"jit\": true,\n");
+ #else
+	fprintf(f, "\"jit\": false,\n");
+ #endif
+	fprintf(f, "\"ticks\": \"%s\",\n\"scale\": %u,\n", Ticks() != (uint64_t)(Seconds() * 1e9) ? "tsc" : "ns", scale);
+	
+	fprintf(f, "\"micro\": [\n");
+	count = sizeof(micro) / sizeof(micro[0]);
+	for (i = 0; i < count; ++i) {
+		if (!Time_Micro(&micro[i], &ns, &ticks))
+			return 1;
+		if (!i) {  //the NOP is the loop itself; the rest are shown without it
+			base_ns = ns;
+			base_ticks = ticks;
+		} else {
+			ns = ns > base_ns ? ns - base_ns : 0;
+			ticks = ticks > base_ticks ? ticks - base_ticks : 0;
+		}
+		fprintf(f, "  {\"name\": \"%s\", \"ns\": %.3f, \"ticks\": %.2f}%s\n", micro[i].name, ns, ticks, i + 1 < count ? "," : "");
+		fprintf(stderr, "%-10s %8.3f ns %8.2f ticks%s\n", micro[i].name, ns, ticks, i ? "" : "  (loop, taken off the rest)");
+	}
+	fprintf(f, "],\n\"workloads\": [\n");
+	count = sizeof(workloads) / sizeof(workloads[0]);
+	for (i = 0; i < count; ++i) {
+		const Workload *w = &workloads[i];
+		if (!(n = Count(w, scale, &cycles)) || !Time(w, scale, 1, &step) || !Time(w, scale, 0, &block)) {
+			fprintf(stderr, "bench: out of memory\n");
+			return 1;
+		}
+		fprintf(f, "  {\"name\": \"%s\", \"instructions\": %llu, \"cycles\": %llu, \"match\": %s,\n   ", w->name,
+			(unsigned long long)n, (unsigned long long)cycles, step.check == block.check ? "true" : "false");
+		Write_Tier(f, "step", &step, n);
+		fprintf(f, ",\n   ");
+		Write_Tier(f, "block", &block, n);
+		fprintf(f, "}%s\n", i + 1 < count ? "," : "");
+		fprintf(stderr, "%-10s %12llu insns  step %8.2f MIPS  block %8.2f MIPS %6.2f ticks/insn%s\n", w->name,
+			(unsigned long long)n, n / step.seconds / 1e6, n / block.seconds / 1e6, (double)block.ticks / n,
+			step.check == block.check ? "" : "  MISMATCH");
+	}
+	if (!Time_Snapshot(&workloads[count - 1], scale, &take, &restore, &match)) {
+		fprintf(stderr, "bench: out of memory\n");
+		return 1;
+	}
+	fprintf(f, "],\n\"snapshot\": {\"name\": \"%s\", \"take_us\": %.3f, \"restore_us\": %.3f, \"match\": %s}\n}\n",
+		workloads[count - 1].name, take * 1e6, restore * 1e6, match ? "true" : "false");
+	fprintf(stderr, "%-10s take %8.3f us  restore %8.3f us%s\n", "snapshot", take * 1e6, restore * 1e6,
+		match ? "" : "  MISMATCH");
+	if (out && fclose(f)) {
+		perror(out);
+		return 1;
+	}
+	return 0;
+ }
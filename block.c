@@ -0,0 +1,361 @@
+/* =====================================================================
+ * block.c
+ * predecodes guest basic blocks and runs them without per instruction fetch or decode
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #include <stdio.h>
+ #include <stdlib.h>
+ #include "registers.h"
+ #include "memory.h"
+ #include "decode.h"
+ #include "block.h"
+ #include "jit.h"
+ #include "mmu.h"
+ #include "profile.h"
+ #include "trace.h"
+ 
+ 
+ int Block_Init(Cpu *cpu)
+ {
+	cpu->blocks = malloc(BLOCK_CACHE_SIZE * sizeof(Block));
+	if (!cpu->blocks)
+		return 0;
+ #ifdef PROFILE_PAIRS
+	if (!(cpu->pair_counts = calloc(256 * 256, sizeof(uint64_t)))) {
+		Block_Free(cpu);
+		return 0;
+	}
+ #endif
+	Block_Flush(cpu);
+	return 1;
+ }
+ 
+ void Block_Free(Cpu *cpu)
+ {
+	free(cpu->blocks);
+	cpu->blocks = 0;
+ #ifdef PROFILE_PAIRS
+	free(cpu->pair_counts);
+	cpu->pair_counts = 0;
+ #endif
+ }
+ 
+ void Block_Flush(Cpu *cpu)
+ {
+	unsigned int i;
+	for (i = 0; i < BLOCK_CACHE_SIZE; ++i) {
+		cpu->blocks[i].pc = BLOCK_EMPTY;
+		cpu->blocks[i].native = 0;
+	}
+	Memory_Uncode(cpu);
+ #ifdef JIT
+	Jit_Flush(cpu);
+ #endif
+ }
+ 
+ void Block_Invalidate(Cpu *cpu, uint32_t base, uint32_t size)
+ {
+	unsigned int i;
+	for (i = 0; i < BLOCK_CACHE_SIZE; ++i) {
+		Block *b = &cpu->blocks[i];
+		if (b->pc != BLOCK_EMPTY && b->pc < (uint64_t)base + size && b->end + 2ULL > base) {  //end + 2 for a delay slot
+			b->pc = BLOCK_EMPTY;
+			b->native = 0;
+		}
+	}
+ #ifdef JIT
+	Jit_Invalidate(cpu, base, size);  //translations of blocks since evicted from here can still be chained to
+ #endif
+ }
+ 
+ void Block_Invalidate_Host(Cpu *cpu, const unsigned char *host, uint32_t bytes)
+ {
+	unsigned int i;
+	for (i = 0; i < BLOCK_CACHE_SIZE; ++i) {
+		Block *b = &cpu->blocks[i];
+		if (b->pc != BLOCK_EMPTY && Memory_Overlaps(cpu, b->pc, b->end + (b->target != 0) * 2, host, bytes)) {
+			b->pc = BLOCK_EMPTY;
+			b->native = 0;
+		}
+	}
+ #ifdef JIT
+	Jit_Invalidate_Host(cpu, host, bytes);
+ #endif
+ }
+ 
+ /* lookahead must not take a TLB miss the guest would never have taken, so
+  * the builder only crosses into a translated page that is already in the
+  * page table or that the TLB can fill without a fault; the first read with
+  * cpu->fault_ready clear does that or returns 0 */
+ static int Fetchable(Cpu *cpu, uint32_t pc)
+ {
+	if ((pc & PAGE_MASK) || !MMU_AREA(pc))  //same page as the instruction before, or nothing to miss
+		return 1;
+	(void)Read_Word(cpu, pc);
+	return cpu->page_read[PAGE_INDEX(pc)] != 0;
+ }
+ 
+ static void Track(Cpu *cpu, uint32_t start, uint32_t end)  //write protect a new block's code, see memory.h
+ {
+	if (!Memory_Code(cpu, start, end)) {  //too many code pages to track; start over
+		Block_Flush(cpu);
+		Memory_Code(cpu, start, end);
+	}
+ }
+ 
+ #define USE_T   (1 << 16)
+ #define USE_GBR (1 << 17)
+ 
+ /* registers e reads and writes, bits 0-15 for R0-R15 then T and GBR;
+  * returns 0 unless it's one of the loads, moves and compares a polling
+  * loop is made of.  Stores and everything else are left out */
+ static int Uses(const Decoded *e, uint32_t *read, uint32_t *write)
+ {
+	Handler fn = e->fn;
+	uint32_t m = 1 << (e->a & 0xf), n = 1 << (e->b & 0xf);
+	
+	if (fn == MOVBL || fn == MOVWL || fn == MOVLL || fn == MOV || fn == EXTUB || fn == EXTUW || fn == EXTSB || fn == EXTSW) {
+		*read = m;
+		*write = n;
+	} else if (fn == MOVBL0 || fn == MOVWL0 || fn == MOVLL0) {
+		*read = m | 1;
+		*write = n;
+	} else if (fn == MOVBLG || fn == MOVWLG || fn == MOVLLG) {
+		*read = USE_GBR;
+		*write = 1;
+	} else if (fn == MOVI || fn == MOVWI || fn == MOVLI) {  //PC relative loads are constants
+		*read = 0;
+		*write = n;
+	} else if (fn == AND) {
+		*read = m | n;
+		*write = n;
+	} else if (fn == CMPEQ || fn == CMPGE || fn == CMPGT || fn == CMPHI || fn == CMPHS || fn == CMPSTR) {
+		*read = m | n;
+		*write = USE_T;
+	} else if (fn == CMPIM || fn == CMPPL || fn == CMPPZ) {  //CMP/EQ #imm, R0 or Rn in a
+		*read = fn == CMPIM ? 1 : m;
+		*write = USE_T;
+	} else if (fn == CMPEQBT) {
+		*read = 1 << (e->a & 0xf) | 1 << (e->a >> 4);
+		*write = USE_T;
+	} else if (fn == BT || fn == BF) {
+		*read = USE_T;
+		*write = 0;
+	} else
+		return 0;
+	return 1;
+ }
+ 
+ /* a block that branches back to its own start and whose every input
+  * comes from memory or a register it never writes does the same thing
+  * each time round until something outside it (an event, an interrupt)
+  * changes memory.  Memory here is RAM or a peripheral register, both of
+  * which only change at events */
+ static int Idle(const Block *b)
+ {
+	const Decoded *e = &b->ops[b->count - 1];
+	uint32_t d = e->fn == CMPEQBT ? e->b : e->a;
+	uint32_t read, write, in = 0, out = 0;
+	unsigned int i;
+	
+	if ((e->fn != BT && e->fn != BF && e->fn != CMPEQBT) || b->end + 2 + (uint32_t)(int32_t)(int8_t)d * 2 != b->pc)
+		return 0;
+	for (i = 0; i < b->count; ++i) {
+		if (!Uses(&b->ops[i], &read, &write))
+			return 0;
+		in |= read & ~out;  //read before this block wrote it
+		out |= write;
+	}
+	return !(in & out);
+ }
+ 
+ #ifdef PROFILE_PAIRS
+ #define FUSE 0  //count the guest's own instructions, not fused entries
+ #else
+ #define FUSE 1
+ #endif
+ 
+ /* copy table entries until the first branch or BLOCK_MAX, fusing loops,
+  * pairs and idioms on the way.  Only the first instruction's fetch (and
+  * the slot's, if that is a branch) may fault; everything after is read
+  * with faults off and the block ends early at a page that isn't there */
+ static void Block_Build(Cpu *cpu, Block *b, uint32_t pc)
+ {
+	const Decoded *e;
+	unsigned int fused, i;
+	uint32_t start = pc, last = pc;
+	int ready = cpu->fault_ready;
+	
+	b->pc = BLOCK_EMPTY;  //until it's complete, in case a fault longjmps out of the middle
+	b->count = 0;
+	b->hits = 0;
+	b->native = 0;
+	b->target = 0;
+	b->idle = 0;
+	(void)Read_Word(cpu, pc);
+	cpu->fault_ready = 0;
+	if (FUSE && (fused = Decode_Loop(cpu, pc, &b->ops[0]))) {  //the entry sets PC itself: back to pc, or past the loop when done
+		b->count = 1;
+		b->end = pc + fused * 2;
+		b->cycles = b->ops[0].cycles;  //one pass; the routine adds the rest
+		cpu->fault_ready = ready;
+		Track(cpu, start, b->end);
+		b->pc = start;
+		return;
+	}
+	do {
+		last = pc;
+		if (FUSE && (fused = Decode_Pair(cpu, pc, &b->ops[b->count]))) {
+			e = &b->ops[b->count++];
+			pc += fused * 2;
+		} else {
+			e = &Decode_Table[(uint16_t)Read_Word(cpu, pc)];
+			b->ops[b->count++] = *e;
+			pc += 2;
+		}
+		if (FUSE && b->count < BLOCK_MAX && (fused = Decode_Idiom(cpu, pc, e->fn, &b->ops[b->count]))) {
+			e = &b->ops[b->count++];
+			pc += fused * 2;
+		}
+	} while (!(e->flags & DECODE_BRANCH) && b->count < BLOCK_MAX && Fetchable(cpu, pc));
+	b->end = pc;
+	b->target = Delay_Target(e->fn);
+	if (b->target && !Fetchable(cpu, pc)) {
+		if (last != start) {  //leave the branch for a block of its own
+			--b->count;
+			b->end = last;
+			b->target = 0;
+		} else
+			cpu->fault_ready = ready;  //branch first: a miss on the slot is the branch's, which PC is already on
+	}
+	if (b->target)
+		b->slot = Decode_Table[(uint16_t)Read_Word(cpu, pc)];
+	for (b->cycles = b->target ? b->slot.cycles : 0, i = 0; i < b->count; ++i)
+		b->cycles += b->ops[i].cycles;
+	cpu->fault_ready = ready;
+	Track(cpu, start, b->end + (b->target != 0) * 2);
+	b->pc = start;
+	b->idle = Idle(b);
+ }
+ 
+ Block *Block_Lookup(Cpu *cpu, uint32_t pc)
+ {
+	Block *b = &cpu->blocks[(pc >> 1) & (BLOCK_CACHE_SIZE - 1)];
+	if (b->pc != pc)
+		Block_Build(cpu, b, pc);
+	return b;
+ }
+ 
+ #ifdef PROFILE_PAIRS
+ static void Count_Pairs(Cpu *cpu, const Block *b)  //neighbouring instructions in this run of the block, delay slot included
+ {
+	unsigned int i;
+	for (i = 1; i < b->count; ++i)
+		++cpu->pair_counts[b->ops[i - 1].kind << 8 | b->ops[i].kind];
+	if (b->target)
+		++cpu->pair_counts[b->ops[b->count - 1].kind << 8 | b->slot.kind];
+ }
+ 
+ static int By_Count(const void *x, const void *y)
+ {
+	uint64_t a = *(const uint64_t *)x, b = *(const uint64_t *)y;
+	return (a < b) - (a > b);
+ }
+ 
+ void Block_Print_Pairs(Cpu *cpu, FILE *f, unsigned int top)  //the top most frequent pairs, one "count first second" per line
+ {
+	uint64_t *sorted = malloc(256 * 256 * sizeof(uint64_t));  //count << 16 | pair, pair counts are far below 2^48
+	unsigned int i, n = 0;
+	
+	if (!sorted)
+		return;
+	for (i = 0; i < 256 * 256; ++i)
+		if (cpu->pair_counts[i])
+			sorted[n++] = cpu->pair_counts[i] << 16 | i;
+	qsort(sorted, n, sizeof(uint64_t), By_Count);
+	for (i = 0; i < n && i < top; ++i)
+		fprintf(f, "%12llu  %s %s\n", (unsigned long long)(sorted[i] >> 16),
+			Decode_Kind_Name[(sorted[i] >> 8) & 0xff], Decode_Kind_Name[sorted[i] & 0xff]);
+	free(sorted);
+ }
+ #endif
+ 
+ #ifdef PROFILE
+ static void Count_Kinds(Cpu *cpu, const Block *b)  //native runs are counted in jit.c
+ {
+	unsigned int i;
+	for (i = 0; i < b->count; ++i)
+		Profile_Count(cpu, b->ops[i].kind);
+	if (b->target)
+		Profile_Count(cpu, b->slot.kind);
+ }
+ #endif
+ 
+ void Block_Run(Cpu *cpu)
+ {
+	Block *b;
+	const Decoded *e, *end;
+	uint32_t to;
+	
+ #ifdef TRACE
+	if (cpu->trace) {
+		Trace_Run(cpu);
+		return;
+	}
+ #endif
+	b = Block_Lookup(cpu, cpu->pc);
+	e = b->ops;
+	end = e + b->count - (b->target != 0);
+ #ifdef JIT
+	if (b->native || (!b->idle && ++b->hits >= JIT_THRESHOLD && Jit_Compile(cpu, b))) {  //idle blocks stay here
+		Jit_Run(cpu, b->native);
+		return;
+	}
+ #endif
+	/* call threaded: the handler pointers are walked in order with no
+	 * fetch, table lookup or flag test between them; every handler still
+	 * does its own PC += 2 since PC relative loads and branches need it */
+	cpu->cycles += b->cycles;  //native blocks count their own
+ #ifdef PROFILE_PAIRS
+	Count_Pairs(cpu, b);
+ #endif
+ #ifdef PROFILE
+	Count_Kinds(cpu, b);
+ #endif
+	cpu->clock_read = 0;
+	for (; e != end; ++e)
+		e->fn(cpu, e->a, e->b);
+	if (b->idle && cpu->pc == b->pc && cpu->cycles < cpu->next_event) {
+		if (cpu->clock_read)
+			b->idle = 0;  //it polls a timer count, which moves every time round; let the JIT have it
+		else
+			cpu->cycles = cpu->next_event;  //it would only go round again until then, see Idle()
+	}
+	if (b->target) {  //branch pair: target from the registers before the slot, slot at its own PC, then jump
+		to = b->target(cpu, e->a, e->b);
+		cpu->pc = b->end;
+		cpu->in_slot = 1;
+		b->slot.fn(cpu, b->slot.a, b->slot.b);
+		cpu->in_slot = 0;
+		cpu->pc = to;
+	}
+ }
@@ -0,0 +1,66 @@
+/* =====================================================================
+ * block.h
+ * provides the predecoded basic block cache used by the interpreter
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #ifndef BLOCK_H
+ #define BLOCK_H
+ 
+ #include "decode.h"
+ 
+ #define BLOCK_MAX 32             //longest straight run of instructions kept in one block
+ #define BLOCK_CACHE_SIZE 4096    //number of blocks; direct mapped on guest PC, must be a power of 2
+ 
+ /* a guest basic block: every instruction from pc up to and including the
+  * next branch, already looked up in Decode_Table so running it needs no
+  * fetch or decode.  A block ending in a delayed branch keeps the slot
+  * instruction beside it, so the branch, its slot and the jump run as one
+  * pair instead of the branch fetching and decoding its own slot */
+ typedef struct Block
+ {
+	uint32_t pc;               //guest address of the first instruction; BLOCK_EMPTY if unused
+	uint32_t end;              //guest address just past ops[count - 1]; fused idioms cover more than 2 bytes
+	unsigned int count;        //number of entries in ops
+	unsigned int hits;         //times interpreted; hot blocks are handed to the JIT
+	unsigned int cycles;       //issue cycles of ops and slot, added to cpu->cycles once per run
+	unsigned int idle;         //a polling loop that can't change anything it reads, see Block_Run()
+	void *native;              //translated code from jit.c or 0
+	Target target;             //ops[count - 1] is a delayed branch: where it goes, else 0
+	Decoded slot;              //and the instruction in its delay slot
+	Decoded ops[BLOCK_MAX];
+ } Block;
+ 
+ #define BLOCK_EMPTY 1            //no instruction lives at an odd address
+ 
+ int Block_Init(Cpu *cpu);                  //allocate cpu->blocks (BLOCK_CACHE_SIZE of them); returns 0 if out of memory
+ void Block_Free(Cpu *cpu);
+ void Block_Flush(Cpu *cpu);                 //forget every cached block
+ void Block_Invalidate(Cpu *cpu, uint32_t base, uint32_t size);  //forget the blocks with code in [base, base + size)
+ void Block_Invalidate_Host(Cpu *cpu, const unsigned char *host, uint32_t bytes);  //same, for code in that host memory through any mapping
+ Block *Block_Lookup(Cpu *cpu, uint32_t pc);  //cached block starting at pc, decoding it on a miss
+ void Block_Run(Cpu *cpu);                   //execute the block at PC
+ #ifdef PROFILE_PAIRS
+ #include <stdio.h>
+ void Block_Print_Pairs(Cpu *cpu, FILE *f, unsigned int top);  //dump the most frequent instruction pairs this Cpu has run
+ #endif
+ 
+ #endif
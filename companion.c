@@ -0,0 +1,122 @@
+/* =====================================================================
+ * companion.c
+ * runs host side work off the emulation thread
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #include <stdlib.h>
+ #include <unistd.h>
+ #include "registers.h"
+ #include "keyboard.h"
+ #include "companion.h"
+ 
+ 
+ static void *Run(void *arg)
+ {
+	Cpu *cpu = arg;
+	Companion *c = cpu->companion;
+	Spsc_Msg m;
+	
+	for (;;) {
+		while (sem_wait(&c->ready))  //only EINTR
+			;
+		if (!Spsc_Pop(c->out, &m))  //can't happen, every count has its message
+			continue;
+		if (m.kind == COMPANION_STOP)
+			break;
+		if (m.kind < COMPANION_KINDS && c->handler[m.kind])
+			c->handler[m.kind](cpu, &m, c->opaque[m.kind]);
+	}
+	return 0;
+ }
+ 
+ int Companion_Start(Cpu *cpu)
+ {
+	Companion *c = calloc(1, sizeof(Companion));
+	
+	if (!c)
+		return 0;
+	if (!(c->out = Spsc_New(COMPANION_QUEUE)) || !(c->keys = Spsc_New(COMPANION_QUEUE)) || sem_init(&c->ready, 0, 0)) {
+		Spsc_Free(c->out);
+		Spsc_Free(c->keys);
+		free(c);
+		return 0;
+	}
+	cpu->companion = c;
+	if (pthread_create(&c->thread, 0, Run, cpu)) {
+		cpu->companion = 0;
+		sem_destroy(&c->ready);
+		Spsc_Free(c->out);
+		Spsc_Free(c->keys);
+		free(c);
+		return 0;
+	}
+	return 1;
+ }
+ 
+ void Companion_Stop(Cpu *cpu)
+ {
+	Companion *c = cpu->companion;
+	if (!c)
+		return;
+	while (!Companion_Post(cpu, COMPANION_STOP, 0, 0))  //behind everything already posted
+		usleep(1000);
+	pthread_join(c->thread, 0);
+	cpu->companion = 0;
+	sem_destroy(&c->ready);
+	Spsc_Free(c->out);
+	Spsc_Free(c->keys);
+	free(c);
+ }
+ 
+ void Companion_Handle(Cpu *cpu, unsigned int kind, Companion_Handler handler, void *opaque)
+ {
+	cpu->companion->handler[kind] = handler;
+	cpu->companion->opaque[kind] = opaque;
+ }
+ 
+ unsigned int Companion_Room(Cpu *cpu)
+ {
+	return Spsc_Room(cpu->companion->out);
+ }
+ 
+ int Companion_Post(Cpu *cpu, unsigned int kind, unsigned int arg, void *data)
+ {
+	Companion *c = cpu->companion;
+	if (!Spsc_Push(c->out, kind, arg, data)) {
+		++c->lost;
+		return 0;
+	}
+	sem_post(&c->ready);  //no system call unless the thread is asleep
+	return 1;
+ }
+ 
+ int Companion_Key(Cpu *cpu, int keycode, int down)
+ {
+	return Spsc_Push(cpu->companion->keys, (unsigned int)keycode, down != 0, 0);
+ }
+ 
+ void Companion_Keys(Cpu *cpu)
+ {
+	Spsc_Msg m;
+	while (Spsc_Pop(cpu->companion->keys, &m))
+		Keyboard_Set(cpu, (int)m.kind, (int)m.arg);
+ }
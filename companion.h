@@ -0,0 +1,72 @@
+/* =====================================================================
+ * companion.h
+ * provides a host thread per cpu for work the guest never waits on
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #ifndef COMPANION_H
+ #define COMPANION_H
+ 
+ #include <pthread.h>
+ #include <semaphore.h>
+ #include "registers.h"
+ #include "spsc.h"
+ 
+ #define COMPANION_QUEUE 256       //messages in flight each way; power of 2
+ 
+ enum
+ {
+	COMPANION_STOP,
+	COMPANION_FRAME,               //lcd.c: a frame's changed rows to convert and pass on
+	COMPANION_TRACE,               //trace.c: a full chunk of records to code and write
+	COMPANION_KINDS
+ };
+ 
+ typedef void (*Companion_Handler)(Cpu *cpu, const Spsc_Msg *msg, void *opaque);
+ 
+ /* what a front end does with the machine's output, converting frames,
+  * encoding them, writing traces, shouldn't cost the guest time, so the
+  * thread running the Cpu only posts it here and carries on.  A post
+  * never waits: if the queue is full the poster gets 0 and has to cope,
+  * e.g. the LCD skips a frame.  Handlers run on the companion thread in
+  * post order and mustn't touch the machine.  The other way, keys posted
+  * from one host thread are picked up by the CPU thread at the next
+  * KEYSC scan, like Keyboard_Set() */
+ typedef struct Companion
+ {
+	Spsc *out;                     //CPU thread to companion
+	Spsc *keys;                    //one host thread to the CPU thread; kind is the keycode, arg down
+	sem_t ready;                   //one count per message in out
+	pthread_t thread;
+	Companion_Handler handler[COMPANION_KINDS];
+	void *opaque[COMPANION_KINDS];
+	uint64_t lost;                 //posts that found out full
+ } Companion;
+ 
+ int Companion_Start(Cpu *cpu);    //0 if out of memory or the thread won't start
+ void Companion_Stop(Cpu *cpu);    //handles everything posted so far, then joins the thread; waits
+ void Companion_Handle(Cpu *cpu, unsigned int kind, Companion_Handler handler, void *opaque);  //set before posting kind
+ unsigned int Companion_Room(Cpu *cpu);  //CPU thread; posts that are sure to go through
+ int Companion_Post(Cpu *cpu, unsigned int kind, unsigned int arg, void *data);  //CPU thread; 0 if full
+ int Companion_Key(Cpu *cpu, int keycode, int down);  //any one host thread; 0 if full
+ void Companion_Keys(Cpu *cpu);    //CPU thread; hand posted keys to Keyboard_Set()
+ 
+ #endif
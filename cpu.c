@@ -0,0 +1,120 @@
+/* =====================================================================
+ * cpu.c
+ * provides the SH4A cpu context
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #include <stdlib.h>
+ #include <string.h>
+ #include "registers.h"
+ #include "memory.h"
+ #include "block.h"
+ #include "jit.h"
+ #include "keyboard.h"
+ #include "mmu.h"
+ #include "sched.h"
+ #include "intc.h"
+ #include "tmu.h"
+ #include "rtc.h"
+ #include "lcd.h"
+ #include "companion.h"
+ #include "snapshot.h"
+ #include "profile.h"
+ #include "trace.h"
+ #include "cpu.h"
+ 
+ 
+ Cpu *Cpu_New(void)
+ {
+	Cpu *cpu = aligned_alloc(64, sizeof(Cpu));  //sizeof(Cpu) is a whole number of cache lines
+	
+	if (!cpu)
+		return 0;
+	memset(cpu, 0, sizeof(Cpu));
+	if (!Memory_Init(cpu) || !Mmu_Init(cpu) || !Block_Init(cpu) || !Sched_Init(cpu) || !Intc_Init(cpu)
+		|| !Tmu_Init(cpu) || !Rtc_Init(cpu) || !Lcd_Init(cpu)) {
+		Cpu_Free(cpu);
+		return 0;
+	}
+ #ifdef PROFILE
+	if (!Profile_Init(cpu)) {
+		Cpu_Free(cpu);
+		return 0;
+	}
+ #endif
+ #ifdef JIT
+	Jit_Init(cpu);  //failing here just leaves this instance interpreted
+ #endif
+	Cpu_Reset(cpu);
+	return cpu;
+ }
+ 
+ void Cpu_Free(Cpu *cpu)
+ {
+	if (!cpu)
+		return;
+	Companion_Stop(cpu);  //first, its handlers may still be looking at the LCD
+ #ifdef TRACE
+	Trace_Stop(cpu);  //what is left is written here
+ #endif
+ #ifdef JIT
+	Jit_Free(cpu);
+ #endif
+	Snapshot_Free(cpu->snapshot);
+ #ifdef PROFILE
+	Profile_Free(cpu);
+ #endif
+	Keyboard_Free(cpu);
+	Lcd_Free(cpu);
+	Rtc_Free(cpu);
+	Tmu_Free(cpu);
+	Intc_Free(cpu);
+	Sched_Free(cpu);
+	Mmu_Free(cpu);
+	if (cpu->blocks)
+		Block_Free(cpu);
+	Memory_Free(cpu);
+	free(cpu);
+ }
+ 
+ void Cpu_Reset(Cpu *cpu)
+ {
+	memset(cpu->r, 0, sizeof(cpu->r));
+	memset(cpu->r_bank, 0, sizeof(cpu->r_bank));
+	cpu->sr = SR_MD | SR_RB | SR_BL | SR_IMASK;  //RB already set so splitSR() won't swap banks
+	splitSR(cpu, cpu->sr);
+	cpu->vbr = 0;
+	cpu->pc = 0xa0000000;
+	cpu->cycles = 0;
+	cpu->in_slot = 0;
+	cpu->sleeping = 0;
+ #ifdef PROFILE
+	cpu->profile->depth = 0;  //sampling itself stops with Sched_Reset()
+ #endif
+	Block_Flush(cpu);
+	Mmu_Reset(cpu);
+	Sched_Reset(cpu);  //first, the peripherals schedule their events again from cycle 0
+	Intc_Reset(cpu);
+	Tmu_Reset(cpu);
+	Rtc_Reset(cpu);
+	Lcd_Reset(cpu);
+	Keyboard_Reset(cpu);
+ }
@@ -0,0 +1,66 @@
+/* =====================================================================
+ * cpu.h
+ * provides the SH4A cpu context
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #ifndef CPU_H
+ #define CPU_H
+ 
+ #include "registers.h"
+ 
+ /* Decode_Init() must have been called once before the first Cpu_New(); after
+  * that every instance is independent and may be run on its own thread */
+ Cpu *Cpu_New(void);               //allocate a Cpu with its own memory, block cache and code cache; 0 if out of memory
+ void Cpu_Free(Cpu *cpu);
+ void Cpu_Reset(Cpu *cpu);         //power on state: PC at the reset vector, privileged, interrupts blocked, MMU off
+ 
+ /* whoever runs blocks must also be ready for MMU faults, which longjmp out
+  * of the middle of an instruction:
+  *
+  *	setjmp(cpu->fault);  //a fault lands here with PC on the handler
+  *	cpu->fault_ready = 1;
+  *	while (...)
+  *		Block_Run(cpu);
+  *
+  * A Cpu that never turns translation on doesn't need this.
+  *
+  * Time only moves a block at a time: a block adds the summed cost of its
+  * instructions to cpu->cycles as it starts, and peripherals are looked at
+  * between blocks, not between instructions.  cpu->next_event is the
+  * earliest deadline in the scheduler (sched.h), and the loop only calls
+  * into it once cycles has passed that:
+  *
+  *	if (cpu->cycles >= cpu->next_event)
+  *		Sched_Run(cpu);  //due events, then a pending interrupt, then the next deadline
+  *	Block_Run(cpu);
+  *
+  * Chained native blocks compare against it at each block boundary and
+  * return when it has passed.  Anything that wants the loop's attention
+  * early (Jit_Flush(), a raised interrupt, a change to SR.IMASK) sets it
+  * to 0 and Sched_Run() works the real deadline out again.
+  *
+  * Nothing happens between events to a guest that is asleep (SLEEP) or
+  * polling memory in a loop that changes nothing it reads, so both jump
+  * cycles straight to next_event rather than spinning; see SLEEP() and
+  * Block_Run().  Headless that makes waiting free, and a front end that
+  * turns on Sched_Realtime() sleeps the host for the same time instead */ 
+ #endif
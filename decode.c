@@ -0,0 +1,435 @@
+/* =====================================================================
+ * decode.c
+ * builds the SH4A opcode look-up table and dispatches instructions
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #include "registers.h"
+ #include "instructions.h"
+ #include "memory.h"
+ #include "decode.h"
+ #include "profile.h"
+ #include "trace.h"
+ 
+ 
+ Decoded Decode_Table[65536];
+ #ifdef DECODE_KINDS
+ const char *Decode_Kind_Name[256];
+ static unsigned int kinds;
+ #endif
+ 
+ static void Illegal(Cpu *cpu, uint32_t x, uint32_t y)  //undefined or not yet ported opcode; no exception support yet so treat as NOP
+ {
+	cpu->pc += 2;
+ }
+ 
+ #define Set(e, fn, a, b) Set_Entry(e, fn, #fn, a, b)
+ #define COST(op) Decode_Table[(uint16_t)(op)].cycles
+ 
+ static void Set_Entry(Decoded *e, Handler fn, const char *name, uint32_t a, uint32_t b)
+ {
+	e->fn = fn;
+	e->a = (unsigned short)a;
+	e->b = (unsigned short)b;
+	e->flags = 0;
+ #ifdef DECODE_KINDS
+	for (e->kind = 0; e->kind < kinds && Decode_Kind_Name[e->kind] != name; ++e->kind)
+		;
+	if (e->kind == kinds && kinds < 255)
+		Decode_Kind_Name[kinds++] = name;
+ #else
+	(void)name;
+ #endif
+ }
+ 
+ /* issue cycles on the SH4A for the routines that take more than one;
+  * everything else is 1.  Latency stalls and the extra cycle of a taken
+  * BT/BF aren't modelled, the point is only that guest time moves at about
+  * the right rate against the peripherals.  In tight loops that use a load
+  * straight away and branch back each pass (memcpy, blit in bench.c) the
+  * two come to about 40% of the cycles that are counted, so there the TMU,
+  * RTC and LCD frame run that much late against the code and a delay loop
+  * timed off them does more passes than on hardware.  The unconditional
+  * delayed branches are charged for their refetch up front */
+ static unsigned int Cost(Handler fn)
+ {
+	if (fn == DMULS || fn == DMULU || fn == MACL || fn == MACW)
+		return 2;
+	if (fn == BRA || fn == BRAF || fn == JMP || fn == JSR || fn == RTS)
+		return 2;
+	if (fn == ANDM)  //read, modify, write
+		return 3;
+	if (fn == LDCSR || fn == LDCMSR || fn == RTE)  //serialises the pipeline
+		return 4;
+	if (fn == ICBI)
+		return 8;
+	return 1;
+ }
+ 
+ /* the slow nested switch only ever runs once per opcode while the table
+  * is being built; field names follow the SH4A manual: n = bits 8-11,
+  * m = bits 4-7, i/d = low 8 bits (12 bits for BRA) */
+ static void Decode_Opcode(unsigned int op, Decoded *e)
+ {
+	unsigned int n = (op >> 8) & 0xf;
+	unsigned int m = (op >> 4) & 0xf;
+	unsigned int i = op & 0xff;
+	
+	Set(e, Illegal, 0, 0);
+	switch (op >> 12) {
+	case 0x0:
+		switch (op & 0xf) {
+		case 0x2:
+			if (m == 0x0) Set(e, STCSR, n, 0);
+			break;
+		case 0x3:
+			if (m == 0x2) Set(e, BRAF, n, 0);
+			else if (m == 0xe) Set(e, ICBI, n, 0);
+			break;
+		case 0x4: Set(e, MOVBS0, m, n); break;
+		case 0x5: Set(e, MOVWS0, m, n); break;
+		case 0x6: Set(e, MOVLS0, m, n); break;
+		case 0x8:
+			if (op == 0x0008) Set(e, CLRT, 0, 0);
+			else if (op == 0x0028) Set(e, CLRMAC, 0, 0);
+			else if (op == 0x0038) Set(e, LDTLB, 0, 0);
+			else if (op == 0x0048) Set(e, CLRS, 0, 0);
+			break;
+		case 0x9:
+			if (op == 0x0019) Set(e, DIV0U, 0, 0);
+			break;
+		case 0xb:
+			if (op == 0x000b) Set(e, RTS, 0, 0);
+			else if (op == 0x001b) Set(e, SLEEP, 0, 0);
+			else if (op == 0x002b) Set(e, RTE, 0, 0);
+			break;
+		case 0xc: Set(e, MOVBL0, m, n); break;
+		case 0xd: Set(e, MOVWL0, m, n); break;
+		case 0xe: Set(e, MOVLL0, m, n); break;
+		case 0xf: Set(e, MACL, m, n); break;
+		}
+		break;
+	case 0x2:
+		switch (op & 0xf) {
+		case 0x0: Set(e, MOVBS, m, n); break;
+		case 0x1: Set(e, MOVWS, m, n); break;
+		case 0x2: Set(e, MOVLS, m, n); break;
+		case 0x4: Set(e, MOVBM, m, n); break;
+		case 0x5: Set(e, MOVWM, m, n); break;
+		case 0x6: Set(e, MOVLM, m, n); break;
+		case 0x7: Set(e, DIV0S, m, n); break;
+		case 0x9: Set(e, AND, m, n); break;
+		case 0xc: Set(e, CMPSTR, m, n); break;
+		}
+		break;
+	case 0x3:
+		switch (op & 0xf) {
+		case 0x0: Set(e, CMPEQ, m, n); break;
+		case 0x2: Set(e, CMPHS, m, n); break;
+		case 0x3: Set(e, CMPGE, m, n); break;
+		case 0x4: Set(e, DIV1, m, n); break;
+		case 0x5: Set(e, DMULU, m, n); break;
+		case 0x6: Set(e, CMPHI, m, n); break;
+		case 0x7: Set(e, CMPGT, m, n); break;
+		case 0xc: Set(e, ADD, m, n); break;
+		case 0xd: Set(e, DMULS, m, n); break;
+		case 0xe: Set(e, ADDC, m, n); break;
+		case 0xf: Set(e, ADDV, m, n); break;
+		}
+		break;
+	case 0x4:
+		if ((op & 0xf) == 0xf) {  //MAC.W is the only 0100nnnnmmmm form
+			Set(e, MACW, m, n);
+			break;
+		}
+		if ((op & 0x8f) == 0x8e) {  //0100mmmm1nnn1110
+			Set(e, LDC_BANK, n, m & 0x7);
+			break;
+		}
+		if ((op & 0x8f) == 0x87) {  //0100mmmm1nnn0111
+			Set(e, LDCM_BANK, n, m & 0x7);
+			break;
+		}
+		switch (op & 0xff) {  //the rest only use the single register field, named m or n by the manual
+		case 0x03: Set(e, STCMSR, n, 0); break;
+		case 0x06: Set(e, LDSMMACH, n, 0); break;
+		case 0x07: Set(e, LDCMSR, n, 0); break;
+		case 0x0a: Set(e, LDSMACH, n, 0); break;
+		case 0x0b: Set(e, JSR, n, 0); break;
+		case 0x0e: Set(e, LDCSR, n, 0); break;
+		case 0x10: Set(e, DT, n, 0); break;
+		case 0x11: Set(e, CMPPZ, n, 0); break;
+		case 0x15: Set(e, CMPPL, n, 0); break;
+		case 0x16: Set(e, LDSMMACL, n, 0); break;
+		case 0x17: Set(e, LDCMGBR, n, 0); break;
+		case 0x1a: Set(e, LDSMACL, n, 0); break;
+		case 0x1e: Set(e, LDCGBR, n, 0); break;
+		case 0x24: Set(e, ROTCL, n, 0); break;
+		case 0x26: Set(e, LDSMPR, n, 0); break;
+		case 0x27: Set(e, LDCMVBR, n, 0); break;
+		case 0x2a: Set(e, LDSPR, n, 0); break;
+		case 0x2b: Set(e, JMP, n, 0); break;
+		case 0x2e: Set(e, LDCVBR, n, 0); break;
+		case 0x36: Set(e, LDCMSGR, n, 0); break;
+		case 0x37: Set(e, LDCMSSR, n, 0); break;
+		case 0x3a: Set(e, LDCSGR, n, 0); break;
+		case 0x3e: Set(e, LDCSSR, n, 0); break;
+		case 0x47: Set(e, LDCMSPC, n, 0); break;
+		case 0x4e: Set(e, LDCSPC, n, 0); break;
+		case 0xf6: Set(e, LDCMDBR, n, 0); break;
+		case 0xfa: Set(e, LDCDBR, n, 0); break;
+		}
+		break;
+	case 0x6:
+		switch (op & 0xf) {
+		case 0x0: Set(e, MOVBL, m, n); break;
+		case 0x1: Set(e, MOVWL, m, n); break;
+		case 0x2: Set(e, MOVLL, m, n); break;
+		case 0x3: Set(e, MOV, m, n); break;
+		case 0x4: Set(e, MOVBP, m, n); break;
+		case 0x5: Set(e, MOVWP, m, n); break;
+		case 0x6: Set(e, MOVLP, m, n); break;
+		case 0xc: Set(e, EXTUB, m, n); break;
+		case 0xd: Set(e, EXTUW, m, n); break;
+		case 0xe: Set(e, EXTSB, m, n); break;
+		case 0xf: Set(e, EXTSW, m, n); break;
+		}
+		break;
+	case 0x7: Set(e, ADDI, i, n); break;
+	case 0x8:
+		switch (n) {
+		case 0x8: Set(e, CMPIM, i, 0); break;
+		case 0x9: Set(e, BT, i, 0); break;
+		case 0xb: Set(e, BF, i, 0); break;
+		case 0xd: Set(e, BTS, i, 0); break;
+		case 0xf: Set(e, BFS, i, 0); break;
+		}
+		break;
+	case 0x9: Set(e, MOVWI, i, n); break;
+	case 0xa: Set(e, BRA, op & 0xfff, 0); break;
+	case 0xc:
+		switch (n) {
+		case 0x4: Set(e, MOVBLG, i, 0); break;
+		case 0x5: Set(e, MOVWLG, i, 0); break;
+		case 0x6: Set(e, MOVLLG, i, 0); break;
+		case 0x9: Set(e, ANDI, i, 0); break;
+		case 0xd: Set(e, ANDM, i, 0); break;
+		}
+		break;
+	case 0xd: Set(e, MOVLI, i, n); break;
+	case 0xe: Set(e, MOVI, i, n); break;
+	}
+	
+	e->cycles = Cost(e->fn);
+	if (e->fn == BF || e->fn == BT || e->fn == SLEEP)  //SLEEP doesn't move PC, the run loop has to see it
+		e->flags = DECODE_BRANCH;
+	else if (Delay_Target(e->fn))
+		e->flags = DECODE_BRANCH | DECODE_DELAY;
+ }
+ 
+ void Decode_Init(void)  //build the whole table once; every later decode is just Decode_Table[opcode]
+ {
+	unsigned int op;
+	for (op = 0; op < 65536; ++op)
+		Decode_Opcode(op, &Decode_Table[op]);
+ }
+ 
+ void Step(Cpu *cpu)  //fetch, decode and execute one instruction
+ {
+	const Decoded *e = &Decode_Table[(uint16_t)Read_Word(cpu, cpu->pc)];
+	cpu->cycles += e->cycles;
+ #ifdef PROFILE
+	Profile_Count(cpu, e->kind);
+ #endif
+	e->fn(cpu, e->a, e->b);
+ }
+ 
+ void Delay_Slot(Cpu *cpu, uint32_t target)  //PC is still on the branch; blocks don't come here, they run the pair themselves
+ {
+	const Decoded *e;
+	uint16_t op;
+	cpu->pc += 2;  //slot instruction must see its own address for PC relative loads
+	cpu->in_slot = 1;  //from the fetch on, a fault goes back to the branch
+	op = (uint16_t)Read_Word(cpu, cpu->pc);
+	e = &Decode_Table[op];
+ #ifdef TRACE
+	if (cpu->trace)
+		Trace_Slot(cpu, op);
+ #endif
+	cpu->cycles += e->cycles;
+ #ifdef PROFILE
+	Profile_Count(cpu, e->kind);
+ #endif
+	e->fn(cpu, e->a, e->b);
+	cpu->in_slot = 0;
+	cpu->pc = target;  //throw away the slot's PC += 2 and commit the branch
+ }
+ 
+ /* sequences worth running as one routine, tried by the block builder
+  * after the instruction at pc - 2 has been decoded; fills e and returns
+  * how many instructions it covers, or 0 */
+ unsigned int Decode_Idiom(Cpu *cpu, uint32_t pc, Handler prev, Decoded *e)
+ {
+	uint16_t rotcl = (uint16_t)Read_Word(cpu, pc);
+	uint16_t div1 = (uint16_t)Read_Word(cpu, pc + 2);
+	unsigned int i, q = (rotcl >> 8) & 0xf, d = (div1 >> 4) & 0xf, r = (div1 >> 8) & 0xf;
+	
+	if (prev != DIV0U && prev != DIV0S)
+		return 0;
+	if ((rotcl & 0xf0ff) != 0x4024 || (div1 & 0xf00f) != 0x3004 || q == d || q == r || d == r)
+		return 0;
+	for (i = 1; i < 32; ++i)
+		if ((uint16_t)Read_Word(cpu, pc + i * 4) != rotcl || (uint16_t)Read_Word(cpu, pc + i * 4 + 2) != div1)
+			return 0;
+	Set(e, DIV1X32, q | d << 4, r);
+	e->cycles = 32 * (COST(rotcl) + COST(div1));
+	return 64;
+ }
+ 
+ /* superinstructions: neighbouring pairs near the top of PROFILE_PAIRS
+  * dumps, tried by the block builder before the plain table entry at pc.
+  * Fills e and returns 2 if the two instructions at pc fuse, else 0 */
+ unsigned int Decode_Pair(Cpu *cpu, uint32_t pc, Decoded *e)
+ {
+	uint16_t first = (uint16_t)Read_Word(cpu, pc);
+	uint16_t second = (uint16_t)Read_Word(cpu, pc + 2);
+	unsigned int n = (first >> 8) & 0xf;
+	unsigned int m = (first >> 4) & 0xf;
+	
+	if ((first & 0xf0ff) == 0x4010 && (second & 0xff00) == 0x8f00) {  //DT Rn; BF/S label
+		Set(e, DTBFS, (second & 0xff) | n << 8, 0);
+		e->flags = DECODE_BRANCH | DECODE_DELAY;
+	} else if ((first & 0xf00f) == 0x3000 && (second & 0xff00) == 0x8900) {  //CMP/EQ Rm, Rn; BT label
+		Set(e, CMPEQBT, m | n << 4, second & 0xff);
+		e->flags = DECODE_BRANCH;
+	} else if ((first & 0xf000) == 0xd000 && second == (0x400b | n << 8)) {  //MOV.L @(disp, PC), Rn; JSR @Rn
+		Set(e, MOVLIJSR, (first & 0xff) | n << 8, 0);
+		e->flags = DECODE_BRANCH | DECODE_DELAY;
+	} else if ((first & 0xf00f) == 0x6003 && (second & 0xff00) == (0x7000 | n << 8)) {  //MOV Rm, Rn; ADD #imm, Rn
+		Set(e, MOVADDI, m | n << 4, second & 0xff);
+	} else
+		return 0;
+	e->cycles = COST(first) + COST(second);
+	return 2;
+ }
+ 
+ static unsigned int Pass_Cost(const uint16_t *op, unsigned int count)  //cycles for one pass of a loop body
+ {
+	unsigned int i, sum = 0;
+	for (i = 0; i < count; ++i)
+		sum += COST(op[i]);
+	return sum;
+ }
+ 
+ /* a long copy loop, in either of the orders GCC produces:
+  *
+  *   loop: MOV.L @Rm+, Rx        loop: MOV.L @Rm+, Rx
+  *         DT Rc                       MOV.L Rx, @Rn
+  *         MOV.L Rx, @Rn               ADD #4, Rn
+  *         BF/S loop                   DT Rc
+  *         ADD #4, Rn                  BF loop
+  *
+  * with four different registers; both do the same thing each pass */
+ static unsigned int Copy_Loop(uint32_t pc, const uint16_t *op, Decoded *e)
+ {
+	unsigned int m, x, n, c;
+	int dt, st, add;
+	
+	if ((op[0] & 0xf00f) != 0x6006)  //MOV.L @Rm+, Rx
+		return 0;
+	if ((op[3] & 0xff00) == 0x8f00 && pc + 3 * 2 + 4 + (int8_t)op[3] * 2 == pc) {  //BF/S loop
+		dt = 1; st = 2; add = 4;
+	} else if ((op[4] & 0xff00) == 0x8b00 && pc + 4 * 2 + 4 + (int8_t)op[4] * 2 == pc) {  //BF loop
+		st = 1; add = 2; dt = 3;
+	} else
+		return 0;
+	m = (op[0] >> 4) & 0xf;
+	x = (op[0] >> 8) & 0xf;
+	n = (op[st] >> 8) & 0xf;
+	c = (op[dt] >> 8) & 0xf;
+	if ((op[st] & 0xf00f) != 0x2002 || ((op[st] >> 4) & 0xf) != x  //MOV.L Rx, @Rn
+		|| (op[dt] & 0xf0ff) != 0x4010                           //DT Rc
+		|| op[add] != (0x7004 | n << 8))                          //ADD #4, Rn
+		return 0;
+	if (m == x || m == n || m == c || x == n || x == c || n == c)
+		return 0;
+	Set(e, COPYL, m | x << 4 | n << 8 | c << 12, 5 * 2 | Pass_Cost(op, 5) << 8);
+	e->cycles = Pass_Cost(op, 5);
+	return 5;
+ }
+ 
+ /* a dot product:
+  *
+  *   loop: MAC.x @Rm+, @Rn+      loop: DT Rc
+  *         DT Rc                       BF/S loop
+  *         BF loop                     MAC.x @Rm+, @Rn+
+  *
+  * MAC.W or MAC.L, three different registers */
+ static unsigned int Mac_Loop(uint32_t pc, const uint16_t *op, Decoded *e)
+ {
+	unsigned int mac, dt, m, n, c;
+	
+	if ((op[2] & 0xff00) == 0x8b00 && pc + 2 * 2 + 4 + (int8_t)op[2] * 2 == pc) {  //BF loop
+		mac = op[0]; dt = op[1];
+	} else if ((op[1] & 0xff00) == 0x8f00 && pc + 1 * 2 + 4 + (int8_t)op[1] * 2 == pc) {  //BF/S loop
+		mac = op[2]; dt = op[0];
+	} else
+		return 0;
+	if ((mac & 0xb00f) != 0x000f || (dt & 0xf0ff) != 0x4010)  //MAC.L 0000nnnnmmmm1111 or MAC.W 0100nnnnmmmm1111; DT Rc
+		return 0;
+	m = (mac >> 4) & 0xf;
+	n = (mac >> 8) & 0xf;
+	c = (dt >> 8) & 0xf;
+	if (m == n || m == c || n == c)
+		return 0;
+	Set(e, MACLOOP, m | n << 4 | c << 8 | ((mac & 0xf000) ? 0 : 0x1000), 3 * 2 | Pass_Cost(op, 3) << 8);
+	e->cycles = Pass_Cost(op, 3);
+	return 3;
+ }
+ 
+ /* a whole block that is one of the loops above becomes a single entry
+  * covering every instruction in it; returns how many, or 0 */
+ unsigned int Decode_Loop(Cpu *cpu, uint32_t pc, Decoded *e)
+ {
+	uint16_t op[5];
+	unsigned int i, n;
+	
+	for (i = 0; i < 5; ++i)
+		op[i] = (uint16_t)Read_Word(cpu, pc + i * 2);
+	if ((n = Copy_Loop(pc, op, e)) || (n = Mac_Loop(pc, op, e)))
+		return n;
+	return 0;
+ }
+ 
+ Target Delay_Target(Handler fn)
+ {
+	if (fn == BFS) return BFS_Target;
+	if (fn == BTS) return BTS_Target;
+	if (fn == BRA) return BRA_Target;
+	if (fn == BRAF) return BRAF_Target;
+	if (fn == JMP) return JMP_Target;
+	if (fn == JSR) return JSR_Target;
+	if (fn == RTS) return RTS_Target;
+	if (fn == RTE) return RTE_Target;
+	if (fn == DTBFS) return DTBFS_Target;
+	if (fn == MOVLIJSR) return MOVLIJSR_Target;
+	return 0;
+ }
@@ -0,0 +1,64 @@
+/* =====================================================================
+ * decode.h
+ * provides the SH4A opcode look-up table used by the dispatcher
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #ifndef DECODE_H
+ #define DECODE_H
+ 
+ #include "instructions.h"
+ 
+ #if defined(PROFILE_PAIRS) || defined(PROFILE)  //build with -DPROFILE_PAIRS to count which instructions run next to each other, see block.c
+ #define DECODE_KINDS
+ #endif
+ 
+ /* one entry per 16 bit opcode; the operand fields are pulled out of the
+  * opcode when the table is built so dispatch is a single indexed load */
+ typedef struct
+ {
+	Handler fn;            //routine from instructions.c
+	unsigned short a;      //first operand (m, i, d or n depending on the routine)
+	unsigned short b;      //second operand (n, or 0 if unused)
+	unsigned char flags;   //DECODE_* bits below
+	unsigned char cycles;  //SH4A issue cycles; a fused entry has the sum of what it replaces
+ #ifdef DECODE_KINDS
+	unsigned char kind;    //one per routine, index into Decode_Kind_Name
+ #endif
+ } Decoded;
+ 
+ #define DECODE_BRANCH 0x01  //instruction may write PC other than PC += 2; ends a basic block
+ #define DECODE_DELAY  0x02  //instruction executes a delay slot
+ 
+ extern Decoded Decode_Table[65536];
+ #ifdef DECODE_KINDS
+ extern const char *Decode_Kind_Name[256];
+ #endif
+ 
+ void Decode_Init(void);                     //fill Decode_Table; call once at startup, it is shared by every Cpu
+ void Step(Cpu *cpu);                        //fetch, decode and execute the instruction at PC
+ void Delay_Slot(Cpu *cpu, uint32_t target); //execute the slot after the branch at PC, then jump to target
+ unsigned int Decode_Idiom(Cpu *cpu, uint32_t pc, Handler prev, Decoded *e);  //fused sequence at pc; instructions covered or 0
+ unsigned int Decode_Pair(Cpu *cpu, uint32_t pc, Decoded *e);  //superinstruction for the two instructions at pc; 2 or 0
+ unsigned int Decode_Loop(Cpu *cpu, uint32_t pc, Decoded *e);  //whole block at pc as one fused loop; instructions covered or 0
+ Target Delay_Target(Handler fn);            //target routine of a DECODE_DELAY handler, 0 for anything else
+ 
+ #endif
@@ -23,346 +23,265 @@
  * ===================================================================*/
  
  #include "registers.h"
- #include "instructions.h"  //todo : will contain below referenced global variables and prototypes
- #include "memory.h"        //todo : will contain prototypes for memory functions
+ #include "instructions.h"  //prototypes for all instruction routines
+ #include "memory.h"        //Read_*/Write_* guest memory access
+ #include "decode.h"        //Delay_Slot()
+ #include "mmu.h"           //LDTLB, ICBI
+ #include "block.h"         //ICBI
+ #include "profile.h"       //JSR, RTS keep the call chain
+ #if defined(__AVX2__)
+ #include <immintrin.h>     //dot product kernels
+ #endif
 
-  
- unsigned long tmp0, tmp1, tmp2;
- unsigned long long tmp64;
- long dest, src, ans, imm;
- unsigned int temp;
- unsigned long HH,HL,LH,LL;
- unsigned char old_q;
- 
- //SH4A instruction prototypes
- void ADD(unsigned long m, unsigned long n);        //ADD Rm, Rn
- void ADDI(unsigned long i, unsigned long n);       //ADD #imm, Rn
- void ADDC(unsigned long m, unsigned long n);       //ADDC Rm, Rn
- void ADDV(unsigned long m, unsigned long n);       //ADDV Rm, Rn
- void AND(unsigned long m, unsigned long n);        //AND Rm, Rn
- void ANDI(unsigned long i);                        //AND #imm, R0
- void ANDM(unsigned long i);                        //AND.B #imm, @(R0, GBR)
- void BF(unsigned long d);                          //BF Label
- void BFS(unsigned long d);                         //BF/S Label
- void BRA(unsigned long d);                         //BRA Label
- void BRAF(unsigned long n);                        //BRAF Rn
- void BT(unsigned long d);                          //BT Label
- void BTS(unsigned long d);                         //BTS Label
- void CLRMAC();                                     //CLRMAC
- void CLRS();                                       //CLRS
- void CLRT();                                       //CLRT
- void CMPEQ(unsigned long m, unsigned long n);      //CMP_EQ Rm, Rn
- void CMPGE(unsigned long m, unsigned long n);      //CMP_GE Rm, Rn
- void CMPGT(unsigned long m, unsigned long n);      //CMP_GT Rm, Rn
- void CMPHI(unsigned long m, unsigned long n);      //CMP_HI Rm, Rn
- void CMPHS(unsigned long m, unsigned long n);      //CMP_HS Rm, Rn
- void CMPIM(unsigned long i);                       //CMP_EQ #imm,R0
- void CMPPL(unsigned long n);                       //CMP_PL Rn
- void CMPPZ(unsigned long n);                       //CMP_PZ Rn
- void CMPSTR(unsigned long m, unsigned long n);     //CMP_STR Rm, Rn
- void DIV0S(unsigned long m, unsigned long n);      //DIV0S Rm, Rn
- void DIV0U();                                      //DIV0U
- void DIV1(unsigned long m, unsigned long n);       //DIV1 Rm, Rn
- void DMULS(unsigned long m, unsigned long n);      //DMULS.L Rm, Rn
- void DMULU(unsigned long m, unsigned long n);      //DMULU.L Rm, Rn
- void DT(unsigned long n);                          //DT Rn
- void EXTSB(unsigned long m, unsigned long n);      //EXTS.B Rm, Rn
- void EXTSW(unsigned long m, unsigned long n);      //EXTS.W Rm, Rn
- void EXTUB(unsigned long m, unsigned long n);      //EXTU.B Rm, Rn
- void EXTUW(unsigned long m, unsigned long n);      //EXTU.W Rm, Rn
- void ICBI(unsigned long n);                        //ICBI @Rn
- void JMP(unsigned long n);                         //JMP @Rn
- void LDCGBR(unsigned long m);                      //LDC Rm, GBR
- void LDCVBR(unsigned long m);                      //LDC Rm, VBR
- void LDCSGR(unsigned long m);                      //LDC Rm, SGR
- void LDCSSR(unsigned long m);                      //LDC Rm, SSR
- void LDCSPC(unsigned long m);                      //LDC Rm, SPC
- void LDCDBR(unsigned long m);                      //LDC Rm, DBR
- void LDC_BANK(unsigned long m, unsigned long n);   //LDC Rm, Rn_BANK
- void LDCMGBR(unsigned long m);                     //LDC.L @Rm+, GBR
- void LDCMVBR(unsigned long m);                     //LDC.L @Rm+, VBR
- void LDCMSGR(unsigned long m);                     //LDC.L @Rm+, SGR
- void LDCMSSR(unsigned long m);                     //LDC.L @Rm+, SSR
- void LDCMSPC(unsigned long m);                     //LDC.L @Rm+, SPC
- void LDCMDBR(unsigned long m);                     //LDC.L @Rm+, DBR
- void LDCM_BANK(unsigned long m, unsigned long n);  //LDC.L @Rm+, Rn_BANK
- void LDSMACH(unsigned long m);                     //LDS Rm, MACH
- void LDSMACL(unsigned long m);                     //LDS Rm, MACL
- void LDSPR(unsigned long m);                       //LDS Rm, PR
- void LDSMMACH(unsigned long m);                    //LDS.L @Rm+, MACH
- void LDSMMACL(unsigned long m);                    //LDS.L @Rm+, MACL
- void LDSMPR(unsigned long m);                      //LDS.L @Rm+, PR
- void LDTLB();                                      //LDTLB
- void MACL(unsigned long m, unsigned long n);       //MAC.L @Rm+, @Rn+
- void MACW(unsigned long m, unsigned long n);       //MAC.W @Rm+, @Rn+
- void MOV(unsigned long m, unsigned long n);        //MOV Rm, Rn
- void MOVBL(unsigned long m, unsigned long n);      //MOV.B @Rm, Rn
- void MOVWL(unsigned long m, unsigned long n);      //MOV.W @Rm, Rn
- void MOVLL(unsigned long m, unsigned long n);      //MOV.L @Rm, Rn
- void MOVBS(unsigned long m, unsigned long n);      //MOV.B Rm, @Rn
- void MOVWS(unsigned long m, unsigned long n);      //MOV.W Rm, @Rn
- void MOVLS(unsigned long m, unsigned long n);      //MOV.L Rm, @Rn
- void MOVBM(unsigned long m, unsigned long n);      //MOV.B Rm, @-Rn
- void MOVWM(unsigned long m, unsigned long n);      //MOV.W Rm, @-Rn
- void MOVLM(unsigned long m, unsigned long n);      //MOV.L Rm, @-Rn
- void MOVBP(unsigned long m, unsigned long n);      //MOV.B @Rm+, Rn
- void MOVWP(unsigned long m, unsigned long n);      //MOV.W @Rm+, Rn
- void MOVLP(unsigned long m, unsigned long n);      //MOV.L @Rm+, Rn
- void MOVBS0(unsigned long m, unsigned long n);     //MOV.B Rm, @(R0, Rn)
- void MOVWS0(unsigned long m, unsigned long n);     //MOV.W Rm, @(R0, Rn)
- void MOVLS0(unsigned long m, unsigned long n);     //MOV.L Rm, @(R0, Rn)
- void MOVBL0(unsigned long m, unsigned long n);     //MOV.B @(R0, Rn), Rm
- void MOVWL0(unsigned long m, unsigned long n);     //MOV.W @(R0, Rn), Rm
- void MOVLL0(unsigned long m, unsigned long n);     //MOV.L @(R0, Rn), Rm
- void MOVI(unsigned long m, unsigned long n);       //MOV #imm, Rn
- void MOVWI(unsigned long d, unsigned long n);      //MOV.W @(disp, PC), Rn
- void MOVLI(unsigned long d, unsigned long n);      //MOV.L @(disp, PC), Rn
- void MOVBLG(unsigned long d);                      //MOV.B @(disp, GBR), R0
- void MOVWLG(unsigned long d);                      //MOV.W @(disp, GBR), R0
- void MOVLLG(unsigned long d);                      //MOV.L @(disp, GBR), R0
+ /* the routines are written with the register names from the SH4A manual;
+  * these point them at the Cpu being run so every routine works on
+  * whichever instance it was handed (T and MACH/MACL are spelled out since
+  * T is lazy and MACL is also the name of a routine) */
+ #define R      (cpu->r)
+ #define PC     (cpu->pc)
+ #define PR     (cpu->pr)
+ #define SR     (cpu->sr)
+ #define GBR    (cpu->gbr)
+ #define VBR    (cpu->vbr)
+ #define SGR    (cpu->sgr)
+ #define SSR    (cpu->ssr)
+ #define SPC    (cpu->spc)
+ #define DBR    (cpu->dbr)
+ #define R_Bank (cpu->r_bank)
+ #define M      (cpu->m)
+ #define Q      (cpu->q)
+ #define S      (cpu->s)
+ #define MAC64  (cpu->mac)
  
  //instruction code 
- void ADD(unsigned long m, unsigned long n) //ADD Rm, Rn  //add Rm and Rn into Rn; unsigned and signed data
+ void ADD(Cpu *cpu, uint32_t m, uint32_t n) //ADD Rm, Rn  //add Rm and Rn into Rn; unsigned and signed data
  {
-	 R[n] += R[n];
+	 R[n] += R[m];
 	 PC += 2;
  }   
 
- void ADDI(unsigned long i, unsigned long n) //ADD #imm, Rn  //add signed immediate to Rn
+ void ADDI(Cpu *cpu, uint32_t i, uint32_t n) //ADD #imm, Rn  //add signed immediate to Rn
  {
-	 if (i >= 0)
-		R[n] += i;
-	 else R[n] += 0xffffff00 | i;
+	 R[n] += (int32_t)(int8_t)i;  //i is unsigned so the old i >= 0 test never sign extended
 	 PC += 2;
  }
  
- void ADDC(unsigned long m, unsigned long n) //ADDC Rm, Rn  : unsigned addition of Rn, Rm, and T bit into Rn; check for carry
+ void ADDC(Cpu *cpu, uint32_t m, uint32_t n) //ADDC Rm, Rn  : unsigned addition of Rn, Rm, and T bit into Rn; check for carry
  {
-	tmp1 = R[n] + R[m];
-	tmp0 = R[n];
-	R[n] = tmp1 + T;
-	if (tmp0>tmp1) T = 1;
-	else T = 0;
-	if (tmp1>R[n]) T = 1;
+	uint32_t tmp0 = GET_T(cpu);  //carry in has to be real, carry out can wait
+	cpu->t_op = T_CARRY;
+	cpu->t_a = R[n];
+	cpu->t_b = R[m];
+	cpu->t_c = tmp0;
+	R[n] += R[m] + tmp0;
 	PC += 2;
  }
  
- void ADDV(unsigned long m, unsigned long n) //ADDV Rm, Rn  : signed addition of Rn and Rm into Rn; check for overflow
+ void ADDV(Cpu *cpu, uint32_t m, uint32_t n) //ADDV Rm, Rn  : signed addition of Rn and Rm into Rn; check for overflow
  {
-	if ((long)R[n]>=0) dest = 0;
-	else dest = 1;
-	if ((long)R[m]>=0) src = 0;
-	else src = 1;
-	src += dest;
+	LAZY_T(cpu, T_OVERFLOW, R[n], R[m]);  //overflow test done by Eval_T() only if someone asks
 	R[n] += R[m];
-	if ((long)R[n]>=0) ans = 0;
-	else ans = 1;
-	ans += dest;
-	if (src==0 || src==2) 
-	{
-		if (ans==1) T = 1;
-		else T = 0;
-	}
-	else T = 0;
 	PC += 2;
  }
  
- void AND(unsigned long m, unsigned long n) //AND Rm, Rn  //bitwise 'and Rn with Rm into Rn
+ void AND(Cpu *cpu, uint32_t m, uint32_t n) //AND Rm, Rn  //bitwise 'and Rn with Rm into Rn
  {
 	 R[n] &= R[m];
 	 PC += 2;
  }
  
- void ANDI(unsigned long i) //AND #imm, R0  : bitwise 'and' immediate with R0
+ void ANDI(Cpu *cpu, uint32_t i, uint32_t y) //AND #imm, R0  : bitwise 'and' immediate with R0
  {
 	 R[0] &= i;
 	 PC += 2;
  }
 
- void ANDM(unsigned long i) //AND.B #imm, @(R0, GBR)  : bitwise 'and' immediate with byte at GBR + R0
+ void ANDM(Cpu *cpu, uint32_t i, uint32_t y) //AND.B #imm, @(R0, GBR)  : bitwise 'and' immediate with byte at GBR + R0
  {
-	 Write_Byte(GBR + R[0], (unsigned char)i & ReadByte(GBR + R[0]))
+	 Write_Byte(cpu, GBR + R[0], (uint8_t)i & Read_Byte(cpu, GBR + R[0]));
 	 PC += 2;
  }
  
- void BF(unsigned long d) //BF Label  : if false 8 bit disp jump
+ void BF(Cpu *cpu, uint32_t d, uint32_t y) //BF Label  : if false 8 bit disp jump
  {
+	uint32_t disp;
 	if ((d&0x80)==0)
 	disp = (0x000000FF & d);
 	else
 	disp = (0xFFFFFF00 | d);
-	if (T==0)
+	if (GET_T(cpu)==0)
 	PC = PC+4+(disp<<1);
 	else
 	PC += 2;
  }
  
- void BFS(unsigned long d) //BF/S Label  : if false 8 bit disp jump with delay slot
+ uint32_t BFS_Target(Cpu *cpu, uint32_t d, uint32_t y)  //T is tested before the slot runs
  {
-	temp = PC;
+	uint32_t disp;
 	if ((d&0x80)==0)
 	disp = (0x000000FF & d);
 	else
 	disp = (0xFFFFFF00 | d);
-	if (T==0)
-	PC = PC + 4 + (disp<<1);
-	else PC += 4;
-	Delay_Slot(temp+2);
+	if (GET_T(cpu)==0)
+	return PC + 4 + (disp<<1);
+	return PC + 4;
+ }
+ 
+ void BFS(Cpu *cpu, uint32_t d, uint32_t y) //BF/S Label  : if false 8 bit disp jump with delay slot
+ {
+	Delay_Slot(cpu, BFS_Target(cpu, d, y));
  }
  
- void BRA(unsigned long d) //BRA Label  : 12 bit disp jump with delay slot
+ uint32_t BRA_Target(Cpu *cpu, uint32_t d, uint32_t y)
  {
-	temp = PC;
+	uint32_t disp;
 	if ((d&0x800)==0)
 	disp = (0x00000FFF & d);
 	else
 	disp = (0xFFFFF000 | d);
-	PC = PC + 4 + (disp<<1);
-	Delay_Slot(temp+2);
+	return PC + 4 + (disp<<1);
  }
  
- void BRAF(unsigned long n) //BRAF Rn  : jump to Rn with delay slot
+ void BRA(Cpu *cpu, uint32_t d, uint32_t y) //BRA Label  : 12 bit disp jump with delay slot
  {
-	temp = PC;
-	PC = PC + 4 + R[n];
-	Delay_Slot(temp+2);
+	Delay_Slot(cpu, BRA_Target(cpu, d, y));
  }
  
- void BT(unsigned long d) //BT Label  : if true 8 bit disp jump
+ uint32_t BRAF_Target(Cpu *cpu, uint32_t n, uint32_t y)  //Rn is read before the slot can change it
  {
+	return PC + 4 + R[n];
+ }
+ 
+ void BRAF(Cpu *cpu, uint32_t n, uint32_t y) //BRAF Rn  : jump to Rn with delay slot
+ {
+	Delay_Slot(cpu, BRAF_Target(cpu, n, y));
+ }
+ 
+ void BT(Cpu *cpu, uint32_t d, uint32_t y) //BT Label  : if true 8 bit disp jump
+ {
+	uint32_t disp;
 	if ((d&0x80)==0)
 	disp = (0x000000FF & d);
 	else disp = (0xFFFFFF00 | d);
-	if (T==1)
+	if (GET_T(cpu)==1)
 	PC = PC + 4 + (disp<<1);
 	else PC += 2;
  }
  
- void BTS(unsigned long d) //BTS Label  : if true 8 bit disp jump with delay slot
+ uint32_t BTS_Target(Cpu *cpu, uint32_t d, uint32_t y)
  {
-	temp = PC;
+	uint32_t disp;
 	if ((d&0x80)==0)
 	disp = (0x000000FF & d);
 	else disp = (0xFFFFFF00 | d);
-	if (T==1)
-	PC = PC + 4 + (disp<<1);
-	else PC += 4;
-	Delay_Slot(temp+2);
+	if (GET_T(cpu)==1)
+	return PC + 4 + (disp<<1);
+	return PC + 4;
  }
  
- void CLRMAC() //CLRMAC  //clear the MAC register
+ void BTS(Cpu *cpu, uint32_t d, uint32_t y) //BTS Label  : if true 8 bit disp jump with delay slot
  {
-	MACL = MACH = 0;
+	Delay_Slot(cpu, BTS_Target(cpu, d, y));
+ }
+ 
+ void CLRMAC(Cpu *cpu, uint32_t x, uint32_t y) //CLRMAC  //clear the MAC register
+ {
+	cpu->macl = cpu->mach = 0;
 	PC += 2;
  }
  
- void CLRS() //CLRS  : clear the S bit of the SR register
+ void CLRS(Cpu *cpu, uint32_t x, uint32_t y) //CLRS  : clear the S bit of the SR register
  {
 	S = 0;
 	PC += 2;
  }
  
-  void CLRT() //CLRT  : clear the T bit or the SR register
+  void CLRT(Cpu *cpu, uint32_t x, uint32_t y) //CLRT  : clear the T bit or the SR register
  {
-	 T = 0;
+	 SET_T(cpu, 0);
 	 PC += 2;
  }
  
- void CMPEQ(unsigned long m, unsigned long n) //CMP_EQ Rm,Rn  : if Rn is == Rm; unsigned and signed
+ void CMPEQ(Cpu *cpu, uint32_t m, uint32_t n) //CMP_EQ Rm,Rn  : if Rn is == Rm; unsigned and signed
  {
-	if (R[n]==R[m]) T = 1;
-	else T = 0;
+	LAZY_T(cpu, T_EQ, R[n], R[m]);
 	PC += 2;
  }
  
- void CMPGE(unsigned long m, unsigned long n) //CMP_GE Rm,Rn  : if Rn is >= Rm; signed data
+ void CMPGE(Cpu *cpu, uint32_t m, uint32_t n) //CMP_GE Rm,Rn  : if Rn is >= Rm; signed data
  {
-	if ((long)R[n] >= (long)R[m]) T = 1;  //sign type cast
-	else T = 0;
+	LAZY_T(cpu, T_GE, R[n], R[m]);  //sign type cast done in Eval_T()
 	PC += 2;
  }
  
- void CMPGT(unsigned long m, unsigned long n) //CMP_GT Rm,Rn  : if Rn is > Rm; signed data
+ void CMPGT(Cpu *cpu, uint32_t m, uint32_t n) //CMP_GT Rm,Rn  : if Rn is > Rm; signed data
  {
-	if ((long)R[n] > (long)R[m]) T = 1; //sign type cast
-	else T = 0;
+	LAZY_T(cpu, T_GT, R[n], R[m]);  //sign type cast done in Eval_T()
 	PC += 2;
  }
 
- void CMPHI(unsigned long m, unsigned long n) //CMP_HI Rm,Rn  : if Rn is > Rm; unsigned data
+ void CMPHI(Cpu *cpu, uint32_t m, uint32_t n) //CMP_HI Rm,Rn  : if Rn is > Rm; unsigned data
  {
-	if (R[n] > R[m]) T = 1;  //no type cast due to unsigned default
-	else T = 0;
+	LAZY_T(cpu, T_HI, R[n], R[m]);  //no type cast due to unsigned default
 	PC += 2;
  }
 
- void CMPHS(unsigned long m, unsigned long n) //CMP_HS Rm,Rn  : if Rn is >= Rm; unsigned data
+ void CMPHS(Cpu *cpu, uint32_t m, uint32_t n) //CMP_HS Rm,Rn  : if Rn is >= Rm; unsigned data
  {
-	if (R[n] >= R[m]) T = 1;  //no type cast due to unsigned default
-	else T = 0;
+	LAZY_T(cpu, T_HS, R[n], R[m]);  //no type cast due to unsigned default
 	PC += 2;
  }
  
- void CMPIM(unsigned long i) //CMP_EQ #imm,R0  : if immediate is equal to R0; signed data
+ void CMPIM(Cpu *cpu, uint32_t i, uint32_t y) //CMP_EQ #imm,R0  : if immediate is equal to R0; signed data
  {
-	if ((i&0x80)==0) imm=(0x000000FF & (long i));
-	else imm=(0xFFFFFF00 | (long i));
-	if (R[0]==imm) T = 1;
-	else T = 0;
+	LAZY_T(cpu, T_EQ, R[0], (uint32_t)(int32_t)(int8_t)i);  //immediate sign extended
 	PC += 2;
  }
 
- void CMPPL(unsigned long n) //CMP_PL Rn  : if Rn > 0; signed data
+ void CMPPL(Cpu *cpu, uint32_t n, uint32_t y) //CMP_PL Rn  : if Rn > 0; signed data
  {
-	if ((long)R[n]>0) T = 1;  //sign type cast
-	else T = 0;
+	LAZY_T(cpu, T_PL, R[n], 0);
 	PC += 2;
  }
 
- void CMPPZ(unsigned long n) //CMP_PZ Rn  : if Rn >= 0; signed data
+ void CMPPZ(Cpu *cpu, uint32_t n, uint32_t y) //CMP_PZ Rn  : if Rn >= 0; signed data
  {
-	if ((long)R[n]>=0) T = 1;  //sign type cast
-	else T = 0;
+	LAZY_T(cpu, T_PZ, R[n], 0);
 	PC += 2;
  }
  
- void CMPSTR(unsigned long m, unsigned long n) //CMP_STR Rm,Rn  : if a byte of Rn is == a byte of Rm; unsigned and signed data
+ void CMPSTR(Cpu *cpu, uint32_t m, uint32_t n) //CMP_STR Rm,Rn  : if a byte of Rn is == a byte of Rm; unsigned and signed data
  {
-	temp=R[n]^R[m];
-	HH = (temp & 0xFF000000) >> 24;
-	HL = (temp & 0x00FF0000) >> 16;
-	LH = (temp & 0x0000FF00) >> 8;
-	LL = temp & 0x000000FF;
-	HH = HH && HL && LH && LL;
-	if (HH==0) T = 1;
-	else T = 0;
+	LAZY_T(cpu, T_STR, R[n], R[m]);  //byte by byte compare left to Eval_T()
 	PC += 2;
  }
 
- void DIV0S(unsigned long m, unsigned long n)  //DIV0S Rm, Rn  : initialization of signed division
+ void DIV0S(Cpu *cpu, uint32_t m, uint32_t n)  //DIV0S Rm, Rn  : initialization of signed division
  {
 	if ((R[n] & 0x80000000)==0) Q = 0;
 	else Q = 1;
 	if ((R[m] & 0x80000000)==0) M = 0;
 	else M = 1;
-	T = !(M==Q);
+	SET_T(cpu, !(M==Q));
 	PC += 2;
  }
  
- void DIV0U ()  //DIV0U  : initialization of unsigned division
+ void DIV0U (Cpu *cpu, uint32_t x, uint32_t y)  //DIV0U  : initialization of unsigned division
  {
-	M = Q = T = 0;
+	M = Q = 0;
+	SET_T(cpu, 0);
 	PC += 2;
  }
  
- void DIV1(unsigned long m, unsigned long n) //DIV1 Rm, Rn  : single step division; sign set by either DIV0U or DIV0S
+ void DIV1(Cpu *cpu, uint32_t m, uint32_t n) //DIV1 Rm, Rn  : single step division; sign set by either DIV0U or DIV0S
  {
-	static unsigned char tmp1;
+	uint32_t tmp0, tmp1, tmp2;
+	unsigned char old_q;
 	old_q = Q;
 	Q = (unsigned char)((0x80000000 & R[n])!=0);
 	tmp2 = R[m];
 	R[n] <<= 1;
-	R[n] |= (unsigned long)T;
+	R[n] |= GET_T(cpu);
 	switch(old_q){
 	case 0:switch(M){
 		case 0:tmp0 = R[n];
@@ -411,387 +330,755 @@
 		}
 		break;
 	}
-	T = (Q==M);
+	SET_T(cpu, Q==M);
+	PC += 2;
+ }
+ 
+ /* GCC expands every 32 bit divide into DIV0U or DIV0S followed by 32 pairs
+  * of ROTCL Rq; DIV1 Rd, Rr, which Decode_Idiom() turns into this one
+  * routine (a = q | d << 4, b = r).  When the partial remainder starts out
+  * below a nonzero divisor and M = Q = 0, the 32 non-restoring steps just
+  * compute (Rr:Rq) / Rd, so the host divides instead; the quotient ends up
+  * shifted through Rq and T, and on a last quotient bit of 0 the remainder
+  * is left one divisor short with Q set.  Anything else (signed operands,
+  * overflow, divide by zero) runs the steps exactly in a local loop */
+ void DIV1X32(Cpu *cpu, uint32_t a, uint32_t r)
+ {
+	uint32_t q = a & 0xf, d = a >> 4;
+	uint32_t rq = R[q], rd = R[d], rr = R[r];
+	uint32_t t = GET_T(cpu), old_q, carry;
+	unsigned int i;
+	
+	if (M == 0 && Q == 0 && rr < rd) {
+		uint64_t dividend = (uint64_t)rr << 32 | rq;
+		uint32_t quot = (uint32_t)(dividend / rd);
+		uint32_t rem = (uint32_t)(dividend % rd);
+		R[q] = t << 31 | quot >> 1;
+		t = quot & 1;
+		R[r] = t ? rem : rem - rd;
+		Q = !t;
+	} else {
+		for (i = 0; i < 32; ++i) {
+			carry = rq >> 31;               //ROTCL Rq
+			rq = rq << 1 | t;
+			old_q = Q;                      //DIV1 Rd, Rr, same as the nested switch in DIV1()
+			Q = rr >> 31;
+			rr = rr << 1 | carry;
+			if (old_q == M) {
+				uint32_t before = rr;
+				rr -= rd;
+				Q ^= M ^ (rr > before);
+			} else {
+				uint32_t before = rr;
+				rr += rd;
+				Q ^= M ^ (rr < before);
+			}
+			t = Q == M;
+		}
+		R[q] = rq;
+		R[r] = rr;
+	}
+	SET_T(cpu, t);
+	PC += 32 * 4;
+ }
+ 
+ /* MOV.L @Rm+, Rx; MOV.L Rx, @Rn; ADD #4, Rn; DT Rc; BF loop, in either of
+  * the orders Decode_Loop() knows, run until Rc reaches 0 (a = m | x << 4 |
+  * n << 8 | c << 12, b = bytes of loop code | cycles per pass << 8).  Whatever is plain memory goes
+  * through Memory_Copy(); at the first MMIO page one pass of the loop is
+  * done the slow way and PC is left on the loop so the block comes back
+  * here.  The block has already counted one pass */
+ void COPYL(Cpu *cpu, uint32_t a, uint32_t b)
+ {
+	uint32_t m = a & 0xf, x = (a >> 4) & 0xf, n = (a >> 8) & 0xf, c = a >> 12;
+	uint32_t count = R[c], done = 0;
+	
+	if (count != 0 && ((R[m] | R[n]) & 3) == 0 && !(R[n] > R[m] && R[n] - R[m] < count * 4ULL)
+		&& count < 0x40000000) {
+		done = Memory_Copy(cpu, R[n], R[m], count * 4) / 4;
+		if (done) {
+			R[x] = Read_Long(cpu, R[n] + (done - 1) * 4);  //what the last pass wrote, whichever way the copy overlapped
+			R[m] += done * 4;
+			R[n] += done * 4;
+			R[c] -= done;
+			cpu->cycles += (uint64_t)(done - 1) * (b >> 8);
+		}
+	}
+	if (done == 0) {  //one pass as the instructions do it, registers only once both accesses are through
+		uint32_t v = Read_Long(cpu, R[m]);
+		Write_Long(cpu, R[n], v);
+		R[x] = v;
+		R[m] += 4;
+		R[n] += 4;
+		--R[c];
+	}
+	LAZY_T(cpu, T_ZERO, R[c], 0);
+	if (R[c] == 0)
+		PC += b & 0xff;
+ }
+ 
+ void DMULS (Cpu *cpu, uint32_t m, uint32_t n)  //DMULS.L Rm, Rn  : 32 bit * 32 bit = 64 bit signed multiplication
+ {
+	MAC64 = (uint64_t)((int64_t)(int32_t)R[m] * (int64_t)(int32_t)R[n]);  //64 bit signed casting
 	PC += 2;
  }
  
- void DMULS (unsigned long m, unsigned long n)  //DMULS.L Rm, Rn  : 32 bit * 32 bit = 64 bit signed multiplication
+ void DMULU (Cpu *cpu, uint32_t m, uint32_t n)  //DMULU.L Rm, Rn  : 32 bit * 32 bit = 64 bit unsigned multiplication
  {
-	MAC64 = (unsigned long long)((long long)R[m] * (long long)R[n]);  //64 bit signed casting
+	MAC64 = (uint64_t)R[m] * (uint64_t)R[n];  //64 bit unsigned casting
 	PC += 2;
  }
  
- void DMULU (unsigned long m, unsigned long m)  //DMULU.L Rm, Rn  : 32 bit * 32 bit = 64 bit unsigned multiplication
+ void DT (Cpu *cpu, uint32_t n, uint32_t y)  //DT Rn  : decrement and test if 0
  {
-	MAC64 = (unsigned long long)R[m] * (unsigned long long)R[n];  //64 bit unsigned casting
+	LAZY_T(cpu, T_ZERO, --R[n], 0);  //prefix decrement optimization ftw!!
 	PC += 2;
  }
  
- void DT (unsigned long n)  //DT Rn  : decrement and test if 0
+ void EXTSB (Cpu *cpu, uint32_t m, uint32_t n)  //EXTS.B Rm, Rn  : type cast Rm to signed byte and write to Rn
  {
-	--R[n];  //prefix decrement optimization ftw!!
-	if (R[n] == 0) T = 1;
-	else T = 0;
+	R[n] = (uint32_t)(int8_t)R[m];  //to signed char then sign extended back to a register
 	PC += 2;
  }
  
- void EXTSB (unsigned long m, unsigned long n)  //EXTS.B Rm, Rn  : type cast Rm to signed byte and write to Rn
+ void EXTSW (Cpu *cpu, uint32_t m, uint32_t n)  //EXTS.W Rm, Rn  : type cast Rm to signed word and write to Rn
  {
-	R[n] = (unsigned long)(char)(((long)R)[m]);  //pointer to signed long; result to signed char to unsigned long
+	R[n] = (uint32_t)(int16_t)R[m];  //to signed short then sign extended back to a register
 	PC += 2;
  }
  
- void EXTSW (unsigned long m, unsigned long n)  //EXTS.W Rm, Rn  : type cast Rm to signed word and write to Rn
+ void EXTUB (Cpu *cpu, uint32_t m, uint32_t n)  //EXTU.B Rm, Rn  : type cast Rm to unsigned byte and write to Rn
  {
-	R[n] = (unsigned long)(short)(((long)R)[m]);  //pointer to signed long; result to signed short to unsigned long
+	R[n] = (uint32_t)(uint8_t)R[m];  //to unsigned char then type cast back to register
 	PC += 2;
  }
  
- void EXTUB (unsigned long m, unsigned long n)  //EXTU.B Rm, Rn  : type cast Rm to unsigned byte and write to Rn
+ void EXTUW (Cpu *cpu, uint32_t m, uint32_t n)  //EXTU.W Rm, Rn  : type cast Rm to unsigned word and write to Rn
  {
-	R[n] = (unsigned long)(unsigned char)R[m];  //to unsigned char then type cast back to register
+	R[n] = (uint32_t)(uint16_t)R[m];  //to unsigned short then type cast back to register
 	PC += 2;
  }
  
- void EXTUW (unsigned long m, unsigned long n)  //EXTU.W Rm, Rn  : type cast Rm to unsigned word and write to Rn
+ void ICBI (Cpu *cpu, uint32_t n, uint32_t y)  //ICBI @Rn  : invalidiate instruction cache @Rn; here that's the blocks decoded from the line and a translation cached for the page
  {
-	R[n] = (unsigned long)(unsigned short)R[m];  //to unsigned short then type cast back to register
+	uint32_t line = R[n] & ~(CODE_LINE - 1);
+	if (Memory_Code_Line(cpu, line))  //cheap test first, OS cache flushes run this over whole ranges
+		Block_Invalidate_Host(cpu, cpu->page_read[PAGE_INDEX(line)] + (line & PAGE_MASK), CODE_LINE);
+	Mmu_Invalidate(cpu, R[n]);
 	PC += 2;
  }
  
- void ICBI (unsigned long n)  //ICBI @Rn  : invalidiate instruction cache @Rn; does nothing in this context as cache is disabled in standard mode
+ uint32_t JMP_Target(Cpu *cpu, uint32_t n, uint32_t y)
+ {
+	return R[n];
+ }
+ 
+ void JMP (Cpu *cpu, uint32_t n, uint32_t y)  //JMP @Rn  : jump with delay branch to Rn
  {
-	PC += 2;  //aka NOP
+	Delay_Slot(cpu, JMP_Target(cpu, n, y));
  }
  
- void JMP (unsigned long n)  //JMP @Rn  : jump with delay branch to Rn
+ uint32_t JSR_Target(Cpu *cpu, uint32_t n, uint32_t y)  //PR is set here, the slot already sees the new value
  {
-	temp = PC;
-	PC = R[n];
-	Delay_Slot(temp + 2);
+	PR = PC + 4;
+ #ifdef PROFILE
+	Profile_Call(cpu, R[n], PR);
+ #endif
+	return R[n];
  }
  
- void LDCGBR (unsigned long m)  //LDC Rm, GBR  : load Rm into GBR  : Global Base Register
+ void JSR (Cpu *cpu, uint32_t n, uint32_t y)  //JSR @Rn  : subroutine call to Rn with delay slot; return address into PR
+ {
+	Delay_Slot(cpu, JSR_Target(cpu, n, y));
+ }
+ 
+ void LDCSR (Cpu *cpu, uint32_t m, uint32_t y)  //LDC Rm, SR  : load Rm into SR and split out T, S, Q, M; ignore privileged status
+ {
+	splitSR(cpu, R[m]);
+	PC += 2;
+ }
+ 
+ void LDCGBR (Cpu *cpu, uint32_t m, uint32_t y)  //LDC Rm, GBR  : load Rm into GBR  : Global Base Register
  {
 	GBR = R[m];
 	PC += 2;
  }
  
- void LDCVBR (unsigned long m)  //LDC Rm, VBR  : load Rm into VBR  : Vector Base Register; ignore privileged status
+ void LDCVBR (Cpu *cpu, uint32_t m, uint32_t y)  //LDC Rm, VBR  : load Rm into VBR  : Vector Base Register; ignore privileged status
  {
 	VBR = R[m];
 	PC += 2;
  }
  
- void LDCSGR (unsigned long m)  //LDC Rm, SGR  : load Rm into SGR  : saved stack pointer; ignore privileged status
+ void LDCSGR (Cpu *cpu, uint32_t m, uint32_t y)  //LDC Rm, SGR  : load Rm into SGR  : saved stack pointer; ignore privileged status
  {
 	SGR = R[m];
 	PC += 2;
  }
  
- void LDCSSR (unsigned long m)  //LDC Rm, SSR  : load Rm into SSR  : Saved Status Register; ignore privileged status
+ void LDCSSR (Cpu *cpu, uint32_t m, uint32_t y)  //LDC Rm, SSR  : load Rm into SSR  : Saved Status Register; ignore privileged status
  {
 	SSR = R[m];
 	PC += 2;
  }
  
- void LDCSPC (unsigned long m)  //LDC Rm, SPC  : load Rm into SPC  : Saved Program Counter; ignore privileged status
+ void LDCSPC (Cpu *cpu, uint32_t m, uint32_t y)  //LDC Rm, SPC  : load Rm into SPC  : Saved Program Counter; ignore privileged status
  {
 	SPC = R[m];
 	PC += 2;
  }
  
- void LDCDBR (unsigned long m)  //LDC Rm, DBR  : load Rm into DBR  : Debug Base Register; ignore privileged status
+ void LDCDBR (Cpu *cpu, uint32_t m, uint32_t y)  //LDC Rm, DBR  : load Rm into DBR  : Debug Base Register; ignore privileged status
  {
 	DBR = R[m];
 	PC += 2;
  }
  
- void LDC_BANK (unsigned long m, unsigned long n)  //LDC Rm, Rn_BANK  : load Rm into Rn_BANK; ignore privileged status
+ void LDC_BANK (Cpu *cpu, uint32_t m, uint32_t n)  //LDC Rm, Rn_BANK  : load Rm into Rn_BANK; ignore privileged status
  {
-	R_bank[n] = R[m];  //may need to separate into 8 functions for consistency with decoder
+	R_Bank[n] = R[m];  //may need to separate into 8 functions for consistency with decoder
 	PC += 2;
  }
  
- void LDCMGBR (unsigned long m)  //LDC.L @Rm+, GBR  : pop what is @Rm and into the GBR
+ void LDCMSR (Cpu *cpu, uint32_t m, uint32_t y)  //LDC.L @Rm+, SR  : pop what is @Rm and into the SR; ignore privileged status
  {
-	GBR = Read_Long(R[m]);
+	splitSR(cpu, Read_Long(cpu, R[m]));
 	R[m] += 4;
 	PC += 2;
  }
  
- void LDCMVBR (unsigned long m)  //LDC.L @Rm+, VBR  : pop what is @Rm and into the VBR; ignore privileged status
+ void LDCMGBR (Cpu *cpu, uint32_t m, uint32_t y)  //LDC.L @Rm+, GBR  : pop what is @Rm and into the GBR
  {
-	VBR = Read_Long(R[m]);
+	GBR = Read_Long(cpu, R[m]);
 	R[m] += 4;
 	PC += 2;
  }
  
- void LDCMSGR (unsigned long m)  //LDC.L @Rm+, SGR  : pop what is @Rm and into the SGR; ignore privileged status
+ void LDCMVBR (Cpu *cpu, uint32_t m, uint32_t y)  //LDC.L @Rm+, VBR  : pop what is @Rm and into the VBR; ignore privileged status
  {
-	SGR = Read_Long(R[m]);
+	VBR = Read_Long(cpu, R[m]);
 	R[m] += 4;
 	PC += 2;
  }
  
- void LDCMSSR (unsigned long m)  //LDC.L @Rm+, SSR  : pop what is @Rm and into the SSR; ignore privileged status
+ void LDCMSGR (Cpu *cpu, uint32_t m, uint32_t y)  //LDC.L @Rm+, SGR  : pop what is @Rm and into the SGR; ignore privileged status
  {
-	SSR = Read_Long(R[m]);
+	SGR = Read_Long(cpu, R[m]);
 	R[m] += 4;
 	PC += 2;
  }
  
- void LDCMSPC (unsigned long m)  //LDC.L @Rm+, SPC  : pop what is @Rm and into the SPC; ignore privileged status
+ void LDCMSSR (Cpu *cpu, uint32_t m, uint32_t y)  //LDC.L @Rm+, SSR  : pop what is @Rm and into the SSR; ignore privileged status
  {
-	SPC = Read_Long(R[m]);
+	SSR = Read_Long(cpu, R[m]);
 	R[m] += 4;
 	PC += 2;
  }
  
- void LDCMDBR (unsigned long m) //LDC.L @Rm+, DBR  : pop what is @Rm and into the DBR; ignore privileged status
+ void LDCMSPC (Cpu *cpu, uint32_t m, uint32_t y)  //LDC.L @Rm+, SPC  : pop what is @Rm and into the SPC; ignore privileged status
  {
-	DBR = Read_Long(R[m]);
+	SPC = Read_Long(cpu, R[m]);
 	R[m] += 4;
 	PC += 2;
  }
  
- void LDCM_BANK (unsigned long m, unsigned long n)  //LDC.L @Rm+, Rn_BANK  : pop what is @Rm and into Rn_BANK; ignore privileged status
+ void LDCMDBR (Cpu *cpu, uint32_t m, uint32_t y) //LDC.L @Rm+, DBR  : pop what is @Rm and into the DBR; ignore privileged status
  {
-	R_Bank[n] = Read_Long(R[m]);  //may need to separate into 8 functions for consistency with decoder
+	DBR = Read_Long(cpu, R[m]);
 	R[m] += 4;
 	PC += 2;
  }
  
- void LDSMACH (unsigned long m)  //LDS Rm, MACH  : load Rm into the MACH
+ void LDCM_BANK (Cpu *cpu, uint32_t m, uint32_t n)  //LDC.L @Rm+, Rn_BANK  : pop what is @Rm and into Rn_BANK; ignore privileged status
  {
-	*MACH = R[m];
+	R_Bank[n] = Read_Long(cpu, R[m]);  //may need to separate into 8 functions for consistency with decoder
+	R[m] += 4;
 	PC += 2;
  }
  
- void LDSMACL (unsigned long m)  //LDS Rm, MACL  : load Rm into the MACL
+ void LDSMACH (Cpu *cpu, uint32_t m, uint32_t y)  //LDS Rm, MACH  : load Rm into the MACH
  {
-	*MACL = R[m];
+	cpu->mach = R[m];
 	PC += 2;
  }
  
- void LDSPR (unsigned long m)  //LDS Rm, PR  : load Rm into the PR; Procedure Register
+ void LDSMACL (Cpu *cpu, uint32_t m, uint32_t y)  //LDS Rm, MACL  : load Rm into the MACL
+ {
+	cpu->macl = R[m];
+	PC += 2;
+ }
+ 
+ void LDSPR (Cpu *cpu, uint32_t m, uint32_t y)  //LDS Rm, PR  : load Rm into the PR; Procedure Register
  {
 	PR = R[m];
 	PC += 2;
  }
  
- void LDSMMACH (unsigned long m)  //LDS.L @Rm+, MACH  : pop what is @Rm and into the MACH
+ void LDSMMACH (Cpu *cpu, uint32_t m, uint32_t y)  //LDS.L @Rm+, MACH  : pop what is @Rm and into the MACH
  {
-	*MACH = Read_Long(R[m]);
+	cpu->mach = Read_Long(cpu, R[m]);
 	R[m] += 4;
 	PC += 2;
  }
  
- void LDSMMACL (unsigned long m)  //LDS.L @Rm+, MACL  : pop what is @Rm and into the MACL
+ void LDSMMACL (Cpu *cpu, uint32_t m, uint32_t y)  //LDS.L @Rm+, MACL  : pop what is @Rm and into the MACL
  {
-	*MACL = Read_Long(R[m]);
+	cpu->macl = Read_Long(cpu, R[m]);
 	R[m] += 4;
 	PC += 2;
  }
  
- void LDSMPR (unsigned long m)  //LDS.L @Rm+, PR  : pop what is @Rm and into the PR
+ void LDSMPR (Cpu *cpu, uint32_t m, uint32_t y)  //LDS.L @Rm+, PR  : pop what is @Rm and into the PR
  {
-	PR = Read_Long(R[m]);
+	PR = Read_Long(cpu, R[m]);
 	R[m] += 4;
 	PC += 2;
  }
  
- void LDTLB ()  //LDTLB  : why don't we just pretend that this instruction doesn't exist for the time being
+ void LDTLB (Cpu *cpu, uint32_t x, uint32_t y)  //LDTLB  : load PTEH/PTEL into the UTLB entry MMUCR.URC points at; ignore privileged status
+ {
+	Mmu_Load(cpu);
+	PC += 2;
+ }
+ 
+ /* one multiply-accumulate, shared by MAC.W/MAC.L and the fused dot product
+  * loops.  With S set MAC.W saturates MACL at 32 bits and sets bit 0 of
+  * MACH when it does; MAC.L treats MACH:MACL as a 48 bit signed value and
+  * saturates that */
+ #define MAC48_MAX 0x00007fffffffffffLL
+ #define MAC48_MIN (-MAC48_MAX - 1)
+ 
+ static inline void Mac_W(Cpu *cpu, int32_t product)
  {
-	PC += 2;  //at least it's pretty well optimized now :P
+	int64_t sum;
+	if (S == 0) {
+		MAC64 += (uint64_t)(int64_t)product;
+		return;
+	}
+	sum = (int64_t)(int32_t)cpu->macl + product;
+	if (sum > INT32_MAX) {
+		cpu->macl = 0x7fffffff;
+		cpu->mach |= 1;
+	} else if (sum < INT32_MIN) {
+		cpu->macl = 0x80000000;
+		cpu->mach |= 1;
+	} else
+		cpu->macl = (uint32_t)sum;
+ }
+ 
+ static inline void Mac_L(Cpu *cpu, int64_t product)
+ {
+	int64_t sum;
+	if (S == 0) {
+		MAC64 += (uint64_t)product;
+		return;
+	}
+	sum = ((int64_t)(MAC64 << 16) >> 16) + product;  //sign extend from bit 47; can't overflow 64 bits
+	if (sum > MAC48_MAX) sum = MAC48_MAX;
+	else if (sum < MAC48_MIN) sum = MAC48_MIN;
+	MAC64 = (uint64_t)sum;
  }
  
- void MACL (unsigned long m, unsigned long n)  //MAC.L @Rm+, @Rn+  : pop 32 bit * pop 32 bit = 64 bit if S == 0 else 48 bit; signed
+ void MACL (Cpu *cpu, uint32_t m, uint32_t n)  //MAC.L @Rm+, @Rn+  : MAC += pop 32 bit * pop 32 bit; 64 bit if S == 0 else saturated to 48 bit; signed
  {
-	MAC64 = (unsigned long long)((long long)Read_Long(R[m]) * (long long)Read_Long(R[n])); //complicated signed 64 bit multiplication thingy
+	int32_t b = (int32_t)Read_Long(cpu, R[n]);  //@Rn is read first, which matters when m == n
+	int32_t a = (int32_t)Read_Long(cpu, R[m] + (m == n) * 4);
+	R[n] += 4;  //both loads before either increment so a TLB miss on the second leaves the registers alone
 	R[m] += 4;
-	R[n] += 4;
-	if (S == 1)
-	{
-		if ((long)*MACH < 0) *MACH |= 0xffff8000;
-		else *MACH &= 0x00007fff;
-	}
+	Mac_L(cpu, (int64_t)a * b);
 	PC += 2;
  }
  
- void MACW (unsigned long m, unsigned long n)  //MAC.W @Rm+, @Rn+  : pop 16 bit * pop 16 bit = 64 bit if S == 0 else 32 bit; signed
+ void MACW (Cpu *cpu, uint32_t m, uint32_t n)  //MAC.W @Rm+, @Rn+  : MAC += pop 16 bit * pop 16 bit; 64 bit if S == 0 else saturated to 32 bit in MACL; signed
  {
-	MAC64 = (unsigned long long)((long long)Read_Word(R[m]) * (long long)Read_Word(R[n]));
-	if (S == 1 )
+	int32_t b = Read_Word(cpu, R[n]);
+	int32_t a = Read_Word(cpu, R[m] + (m == n) * 2);
+	R[n] += 2;
+	R[m] += 2;
+	Mac_W(cpu, a * b);
+	PC += 2;
+ }
+ 
+ /* dot product kernels for MACLOOP(); the arrays are already in host byte
+  * order.  Without S there's no saturation so the sum can be taken in any
+  * order, and with AVX2 it is done 16 words or 8 longs at a time.  With S
+  * every step may clamp, so those go one element at a time through the
+  * same Mac_W()/Mac_L() as the instructions */
+ static void Mac_W_Run(Cpu *cpu, const int16_t *x, const int16_t *y, uint32_t count)
+ {
+	uint32_t i = 0;
+	uint64_t sum = 0;
+	
+	if (S == 1) {
+		for (; i < count; ++i)
+			Mac_W(cpu, (int32_t)x[i] * y[i]);
+		return;
+	}
+ #if defined(__AVX2__)
 	{
-		if (*MACH != tmp0 && (R[m] < 0 ^^ R[n] < 0))
-		{
-			*MACH |= 0x00000001;
-			*MACL = 0x80000000;
+		/* vpmaddwd adds pairs of products into 32 bits, which only overflows
+		 * for -32768 * -32768 twice, giving 0x80000000; no real pair sum is
+		 * that low, so those lanes are counted and 2^32 added back for each */
+		const __m256i wrapped = _mm256_set1_epi32(INT32_MIN);
+		__m256i acc = _mm256_setzero_si256();
+		uint64_t lanes[4], wraps = 0;
+		for (; i + 16 <= count; i += 16) {
+			__m256i p = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *)(x + i)), _mm256_loadu_si256((const __m256i *)(y + i)));
+			wraps += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(p, wrapped))));
+			acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(p)));
+			acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(p, 1)));
 		}
-		else if (*MACH != tmp0)
-		{
-			*MACH |= 0x00000001;
-			*MACL = 0x7fffffff;
+		_mm256_storeu_si256((__m256i *)lanes, acc);
+		sum = lanes[0] + lanes[1] + lanes[2] + lanes[3] + (wraps << 32);
+	}
+ #endif
+	for (; i < count; ++i)
+		sum += (uint64_t)(int64_t)((int32_t)x[i] * y[i]);
+	MAC64 += sum;
+ }
+ 
+ static void Mac_L_Run(Cpu *cpu, const int32_t *x, const int32_t *y, uint32_t count)
+ {
+	uint32_t i = 0;
+	uint64_t sum = 0;
+	
+	if (S == 1) {
+		for (; i < count; ++i)
+			Mac_L(cpu, (int64_t)x[i] * y[i]);
+		return;
+	}
+ #if defined(__AVX2__)
+	{
+		__m256i acc = _mm256_setzero_si256();
+		uint64_t lanes[4];
+		for (; i + 8 <= count; i += 8) {  //vpmuldq multiplies the even longs; shift the odd ones down for a second go
+			__m256i a = _mm256_loadu_si256((const __m256i *)(x + i));
+			__m256i b = _mm256_loadu_si256((const __m256i *)(y + i));
+			acc = _mm256_add_epi64(acc, _mm256_mul_epi32(a, b));
+			acc = _mm256_add_epi64(acc, _mm256_mul_epi32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32)));
 		}
+		_mm256_storeu_si256((__m256i *)lanes, acc);
+		sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
 	}
-	R[m] += 2;
-	R[n] += 2;
-	PC += 2;
+ #endif
+	for (; i < count; ++i)
+		sum += (uint64_t)((int64_t)x[i] * y[i]);
+	MAC64 += sum;
+ }
+ 
+ /* MAC.W or MAC.L @Rm+, @Rn+ with DT Rc and BF back, as matched by
+  * Decode_Loop() (a = m | n << 4 | c << 8, plus 0x1000 for MAC.L; b = bytes
+  * of loop code | cycles per pass << 8), run until Rc reaches 0.  Both arrays are pulled into host
+  * buffers a chunk at a time with Memory_Read_Block().  If either touches a
+  * page that isn't plain memory one pass is done by the instruction itself
+  * and PC is left on the loop */
+ #define MAC_CHUNK 1024
+ 
+ void MACLOOP(Cpu *cpu, uint32_t a, uint32_t b)
+ {
+	uint32_t m = a & 0xf, n = (a >> 4) & 0xf, c = (a >> 8) & 0xf, size = (a & 0x1000) ? 4 : 2;
+	uint32_t count = R[c], chunk, pc = PC;
+	union { int16_t w[MAC_CHUNK]; int32_t l[MAC_CHUNK]; } x, y;
+	
+	if (count == 0 || count > 0x01000000 || ((R[m] | R[n]) & (size - 1))
+		|| !Memory_Plain(cpu, R[m], count * size) || !Memory_Plain(cpu, R[n], count * size)) {
+		if (size == 4)
+			MACL(cpu, m, n);
+		else
+			MACW(cpu, m, n);
+		PC = pc;
+		LAZY_T(cpu, T_ZERO, --R[c], 0);
+		if (R[c] == 0)
+			PC += b & 0xff;
+		return;
+	}
+	cpu->cycles += (uint64_t)(count - 1) * (b >> 8);  //the block counted the first pass
+	for (; count; count -= chunk) {
+		chunk = count < MAC_CHUNK ? count : MAC_CHUNK;
+		Memory_Read_Block(cpu, &x, R[m], chunk, size);
+		Memory_Read_Block(cpu, &y, R[n], chunk, size);
+		if (size == 4)
+			Mac_L_Run(cpu, x.l, y.l, chunk);
+		else
+			Mac_W_Run(cpu, x.w, y.w, chunk);
+		R[m] += chunk * size;
+		R[n] += chunk * size;
+	}
+	R[c] = 0;
+	LAZY_T(cpu, T_ZERO, R[c], 0);
+	PC += b & 0xff;
  }
  
- void MOV (unsigned long m, unsigned long n)  //MOV Rm, Rn  : quite simply Rm copied to Rn
+ void MOV (Cpu *cpu, uint32_t m, uint32_t n)  //MOV Rm, Rn  : quite simply Rm copied to Rn
  {
 	R[n] = R[m];
 	PC += 2;
  }
  
- void MOVBS (unsigned long m, unsigned long n)  //MOV.B Rm, @Rn  : copy Rm into byte @Rn
+ void MOVBS (Cpu *cpu, uint32_t m, uint32_t n)  //MOV.B Rm, @Rn  : copy Rm into byte @Rn
  {
-	Write_Byte(R[n], (unsigned char)R[m]);
+	Write_Byte(cpu, R[n], (uint8_t)R[m]);
 	PC += 2;
  }
  
- void MOVWS (unsigned long m, unsigned long n)  //MOV.W Rm, @Rn  : copy Rm into word @Rn
+ void MOVWS (Cpu *cpu, uint32_t m, uint32_t n)  //MOV.W Rm, @Rn  : copy Rm into word @Rn
  {
-	Write_Word(R[n], (unsigned short)R[m]);
+	Write_Word(cpu, R[n], (uint16_t)R[m]);
 	PC += 2;
  }
  
- void MOVLS (unsigned long m, unsigned long n)  //MOV.L Rm, @Rn  : copy Rm into longword @Rn
+ void MOVLS (Cpu *cpu, uint32_t m, uint32_t n)  //MOV.L Rm, @Rn  : copy Rm into longword @Rn
  {
-	Write_Long(R[n], R[m]);
+	Write_Long(cpu, R[n], R[m]);
 	PC += 2;
  }
  
- void MOVBL (unsigned long m, unsigned long n)  //MOV.B @Rm, Rn  : load byte @Rm into Rn; sign extension
+ void MOVBL (Cpu *cpu, uint32_t m, uint32_t n)  //MOV.B @Rm, Rn  : load byte @Rm into Rn; sign extension
  {
-	R[n] = (long)Read_Byte(R[m]);
+	R[n] = (int32_t)Read_Byte(cpu, R[m]);
 	PC += 2;
  }
  
- void MOVWL (unsigned long m, unsigned long n)  //MOV.W @Rm, Rn  : load word @Rm into Rn; sign extension
+ void MOVWL (Cpu *cpu, uint32_t m, uint32_t n)  //MOV.W @Rm, Rn  : load word @Rm into Rn; sign extension
  {
-	R[n] = (long)Read_Word(R[m]);
+	R[n] = (int32_t)Read_Word(cpu, R[m]);
 	PC += 2;
  }
  
- void MOVLL (unsigned long m, unsigned long n)  //MOV.L @Rm, Rn  : load long @Rm into Rn
+ void MOVLL (Cpu *cpu, uint32_t m, uint32_t n)  //MOV.L @Rm, Rn  : load long @Rm into Rn
  {
-	R[n] = Read_Long(R[m);
+	R[n] = Read_Long(cpu, R[m]);
 	PC += 2;
  }
  
- void MOVBM (unsigned long m, unsigned long n)  //MOV.B Rm, @-Rn  : push byte of Rm onto stack of Rn
+ void MOVBM (Cpu *cpu, uint32_t m, uint32_t n)  //MOV.B Rm, @-Rn  : push byte of Rm onto stack of Rn
  {
-	Write_Byte(--R[n], (unsigned char)R[m]);  // i <3 optimization
+	Write_Byte(cpu, R[n] - 1, (uint8_t)R[m]);  //store first so a TLB miss leaves Rn alone
+	--R[n];
 	PC += 2;
  }
  
- void MOVWM (unsigned long m, unsigned long n)  //MOV.W Rm, @-Rn  : push word of Rm onto stack of Rn
+ void MOVWM (Cpu *cpu, uint32_t m, uint32_t n)  //MOV.W Rm, @-Rn  : push word of Rm onto stack of Rn
  {
-	Write_Word(R[n] -= 2, (unsigned short)R[m]);
+	Write_Word(cpu, R[n] - 2, (uint16_t)R[m]);
+	R[n] -= 2;
 	PC += 2;
  }
  
- void MOVLM (unsigned long m, unsigned long n)  //MOV.L Rm, @-Rn  : push long of Rm onto stack of Rn
+ void MOVLM (Cpu *cpu, uint32_t m, uint32_t n)  //MOV.L Rm, @-Rn  : push long of Rm onto stack of Rn
  {
-	Write_Long(R[n] -= 4, R[m]);
+	Write_Long(cpu, R[n] - 4, R[m]);
+	R[n] -= 4;
 	PC += 2;
  }
  
- void MOVBP (unsigned long m, unsigned long n)  //MOV.B @Rm+, Rn  : pop byte @Rm and into Rn; sign extension
+ void MOVBP (Cpu *cpu, uint32_t m, uint32_t n)  //MOV.B @Rm+, Rn  : pop byte @Rm and into Rn; sign extension
  {
-	++R[m];  //don't judge me
-	R[n] = (long)Read_Byte(R[m] - 1);  //strange optimization but it removes any branch statements
+	int32_t v = Read_Byte(cpu, R[m]);  //load before the increment so a TLB miss leaves Rm alone
+	++R[m];
+	R[n] = v;  //after the increment so MOV.B @Rn+, Rn keeps the value
 	PC += 2;
  }
  
- void MOVWP (unsigned long m, unsigned long n)  //MOV.W @Rm+, Rn  : pop word @Rm and into Rn; sign extension
+ void MOVWP (Cpu *cpu, uint32_t m, uint32_t n)  //MOV.W @Rm+, Rn  : pop word @Rm and into Rn; sign extension
  {
+	int32_t v = Read_Word(cpu, R[m]);
 	R[m] += 2;
-	R[n] = (long)Read_Word(R[m] - 2);
+	R[n] = v;
 	PC += 2;
  }
  
- void MOVLP (unsigned long m, unsigned long n)  //MOV.L @Rm+, Rn  : pop long @Rm and into Rn
+ void MOVLP (Cpu *cpu, uint32_t m, uint32_t n)  //MOV.L @Rm+, Rn  : pop long @Rm and into Rn
  {
+	uint32_t v = Read_Long(cpu, R[m]);
 	R[m] += 4;
-	R[n] = Read_Long(R[m] - 4);
+	R[n] = v;
 	PC += 2;
  }
  
- void MOVBS0 (unsigned long m, unsigned long n)  //MOV.B Rm, @(R0, Rn)  : copy Rm into byte @(R0 + Rn)
+ void MOVBS0 (Cpu *cpu, uint32_t m, uint32_t n)  //MOV.B Rm, @(R0, Rn)  : copy Rm into byte @(R0 + Rn)
  {
-	Write_Byte(R[n] + *R, (unsigned char)R[m]);
+	Write_Byte(cpu, R[n] + *R, (uint8_t)R[m]);
 	/* yes it's ugly but *R means R[0], maybe I should change it back
 	 * but if I do I won't look like a super hacker anymore :( */
 	PC += 2;
  }
  
- void MOVWS0 (unsigned long m, unsigned long n)  //MOV.W Rm, @(R0, Rn)  : copy Rm into word @(R0 + Rn)
+ void MOVWS0 (Cpu *cpu, uint32_t m, uint32_t n)  //MOV.W Rm, @(R0, Rn)  : copy Rm into word @(R0 + Rn)
+ {
+	Write_Word(cpu, R[n] + *R, (uint16_t)R[m]);
+	PC += 2;
+ }
+ 
+ void MOVLS0 (Cpu *cpu, uint32_t m, uint32_t n)  //MOV.L Rm, @(R0, Rn)  : copy Rm into long @(R0 + Rn)
+ {
+	Write_Long(cpu, R[n] + *R, R[m]);
+	PC += 2;
+ }
+ 
+ void MOVBL0 (Cpu *cpu, uint32_t m, uint32_t n)  //MOV.B @(R0, Rm), Rn  : load byte @(R0 + Rn) into Rn
+ {
+	R[n] = (int32_t)Read_Byte(cpu, R[m] + *R);
+	PC += 2;
+ }
+ 
+ void MOVWL0 (Cpu *cpu, uint32_t m, uint32_t n)  //MOV.W @(R0, Rm), Rn  : load word @(R0 + Rn) into Rn
  {
-	Write_Word(R[n] + *R, (unsigned short)R[m]);
+	R[n] = (int32_t)Read_Word(cpu, R[m] + *R);
 	PC += 2;
  }
  
- void MOVLS0 (unsigned long m, unsigned long n)  //MOV.L Rm, @(R0, Rn)  : copy Rm into long @(R0 + Rn)
+ void MOVLL0 (Cpu *cpu, uint32_t m, uint32_t n)  //MOV.L @(R0, Rm), Rn  : load long @(R0 + Rn) into Rn
  {
-	Write_Long(R[n] + *R, R[m]);
+	R[n] = Read_Long(cpu, R[m] + *R);
 	PC += 2;
  }
  
- void MOVBL0 (unsigned long m, unsigned long n)  //MOV.B @(R0, Rm), Rn  : load byte @(R0 + Rn) into Rn
+ void MOVI (Cpu *cpu, uint32_t i, uint32_t n)  //MOV #imm, Rn  : load 8 bit immediate into Rn; sign extended
  {
-	R[n] = (long)Read_Byte(R[m] + *R);
+	R[n] = (int32_t)(int8_t)i;  //through signed char so bit 7 is actually extended
 	PC += 2;
  }
  
- void MOVWL0 (unsigned long m, unsigned long n)  //MOV.W @(R0, Rm), Rn  : load word @(R0 + Rn) into Rn
+ void MOVWI (Cpu *cpu, uint32_t d, uint32_t n)  //MOV.W @(disp, PC), Rn  : copy word @((8 bit imm disp) * 2 + PC) into Rn; sign extended
  {
-	R[n] = (long)Read_Word(R[m] + *R);
+	R[n] = (int32_t)Read_Word(cpu, PC + 4 + (d << 1));
 	PC += 2;
  }
  
- void MOVLL0 (unsigned long m, unsigned long n)  //MOV.L @(R0, Rm), Rn  : load long @(R0 + Rn) into Rn
+ void MOVLI (Cpu *cpu, uint32_t d, uint32_t n)  //MOV.L @(disp, PC), Rn  : copy long @((8 bit imm disp) * 4 + PC) into Rn
  {
-	R[n] = Read_Long(R[m] + *R);
+	R[n] = Read_Long(cpu, (PC & 0xfffffffc) + 4 + (d << 2));
 	PC += 2;
  }
  
- void MOVI (unsigned long i, unsigned long n)  //MOV #imm, Rn  : load 8 bit immediate into Rn; sign extended
+ void MOVBLG (Cpu *cpu, uint32_t d, uint32_t y)  //MOV.B @(disp, GBR), R0  : load byte @(disp + GBR) into R0; sign extended
  {
-	R[n] = (long)i;
+	*R = (int32_t)Read_Byte(cpu, GBR + d);  //smart ass *R optimization again
 	PC += 2;
  }
  
- void MOVWI (unsigned long d, unsigned long n)  //MOV.W @(disp, PC), Rn  : copy word @((8 bit imm disp) * 2 + PC) into Rn; sign extended
+ void MOVWLG (Cpu *cpu, uint32_t d, uint32_t y)  //MOV.W @(disp, GBR), R0  : load word @(disp + GBR) into R0; sign extended 
  {
-	R[n] = (long)Read_Word(PC + 4 + (d << 1));
+	*R = (int32_t)Read_Word(cpu, (GBR & 0xfffffffe) + (d << 1));
 	PC += 2;
  }
  
- void MOVLI (unsigned long d, unsigned long n)  //MOV.L @(disp, PC), Rn  : copy long @((8 bit imm disp) * 4 + PC) into Rn
+ void MOVLLG (Cpu *cpu, uint32_t d, uint32_t y)  //MOV.L @(disp, GBR), R0  : load long @(disp + GBR) into R0
  {
-	R[n] = Read_Long((PC & 0xfffffffc) + 4 + (d << 2));
+	*R = Read_Long(cpu, (GBR & 0xfffffffc) + (d << 2));
 	PC += 2;
  }
  
- void MOVBLG (unsigned long d)  //MOV.B @(disp, GBR), R0  : load byte @(disp + GBR) into R0; sign extended
+ void ROTCL(Cpu *cpu, uint32_t n, uint32_t y)  //ROTCL Rn  : rotate left through T
  {
-	*R = (long)Read_Byte(GBR + d);  //smart ass *R optimization again
+	uint32_t t = GET_T(cpu);
+	SET_T(cpu, R[n] >> 31);
+	R[n] = R[n] << 1 | t;
 	PC += 2;
  }
  
- void MOVWLG (unsigned long d)  //MOV.W @(disp, GBR), R0  : load word @(disp + GBR) into R0; sign extended 
+ uint32_t RTS_Target(Cpu *cpu, uint32_t x, uint32_t y)  //PR from before the slot, which is often an LDS.L @R15+, PR
+ {
+ #ifdef PROFILE
+	Profile_Return(cpu, PR);
+ #endif
+	return PR;
+ }
+ 
+ void RTS(Cpu *cpu, uint32_t x, uint32_t y)  //RTS  : return to PR with delay slot
+ {
+	Delay_Slot(cpu, RTS_Target(cpu, x, y));
+ }
+ 
+ uint32_t RTE_Target(Cpu *cpu, uint32_t x, uint32_t y)  //SR comes back before the slot, which runs in the restored mode and bank
+ {
+	uint32_t to = SPC;
+	splitSR(cpu, SSR);
+	return to;
+ }
+ 
+ void RTE(Cpu *cpu, uint32_t x, uint32_t y)  //RTE  : return from exception or interrupt, SR = SSR and PC = SPC, with delay slot
+ {
+	Delay_Slot(cpu, RTE_Target(cpu, x, y));
+ }
+ 
+ /* nothing runs until an interrupt is accepted, so there is nothing to do
+  * but let time pass: PC stays on the SLEEP, which ends its block, and each
+  * time round the run loop jumps cycles straight to the next event.
+  * Interrupt() steps PC past it */
+ void SLEEP (Cpu *cpu, uint32_t x, uint32_t y)  //SLEEP  : wait in low power mode for an interrupt
  {
-	*R = (long)Read_Word((GBR & 0xfffffffe) + (d << 1);
+	cpu->sleeping = 1;
+	if (cpu->cycles < cpu->next_event)
+		cpu->cycles = cpu->next_event;
+ }
+ 
+ void STCSR (Cpu *cpu, uint32_t n, uint32_t y)  //STC SR, Rn  : copy SR into Rn; this is where a lazy T bit finally gets worked out
+ {
+	updateSR(cpu);
+	R[n] = SR;
 	PC += 2;
  }
  
- void MOVLLG (unsigned long d)  //MOV.L @(disp, GBR), R0  : load long @(disp + GBR) into R0
+ void STCMSR (Cpu *cpu, uint32_t n, uint32_t y)  //STC.L SR, @-Rn  : push SR onto stack of Rn
  {
-	*R = Read_Long((GBR & 0xfffffffc) + (d << 2);
+	updateSR(cpu);
+	Write_Long(cpu, R[n] - 4, SR);
+	R[n] -= 4;
 	PC += 2;
  }
 
+ /* superinstructions: two neighbouring instructions that Decode_Pair() has
+  * put in one entry so they cost a single dispatch.  PC is on the first of
+  * the two.  T is stored outright rather than left lazy since the branch
+  * wants it straight away; the delayed ones are normally run through their
+  * Target by the block and the Handler is only there for completeness */
+ void DTBFS(Cpu *cpu, uint32_t a, uint32_t y)  //DT Rn; BF/S label  : a = d | n << 8
+ {
+	DT(cpu, a >> 8, 0);
+	BFS(cpu, a & 0xff, 0);
+ }
+ 
+ uint32_t DTBFS_Target(Cpu *cpu, uint32_t a, uint32_t y)
+ {
+	uint32_t n = a >> 8;
+	uint32_t disp = (uint32_t)(int32_t)(int8_t)a;
+	SET_T(cpu, --R[n] == 0);
+	if (R[n] != 0)
+		return PC + 2 + 4 + (disp << 1);
+	return PC + 2 + 4;
+ }
+ 
+ void CMPEQBT(Cpu *cpu, uint32_t a, uint32_t d)  //CMP/EQ Rm, Rn; BT label  : a = m | n << 4
+ {
+	uint32_t t = R[a & 0xf] == R[a >> 4];
+	SET_T(cpu, t);
+	if (t)
+		PC = PC + 2 + 4 + ((uint32_t)(int32_t)(int8_t)d << 1);
+	else
+		PC += 4;
+ }
+ 
+ void MOVLIJSR(Cpu *cpu, uint32_t a, uint32_t y)  //MOV.L @(disp, PC), Rn; JSR @Rn  : a = d | n << 8
+ {
+	MOVLI(cpu, a & 0xff, a >> 8);
+	JSR(cpu, a >> 8, 0);
+ }
+ 
+ uint32_t MOVLIJSR_Target(Cpu *cpu, uint32_t a, uint32_t y)
+ {
+	uint32_t n = a >> 8;
+	R[n] = Read_Long(cpu, (PC & 0xfffffffc) + 4 + ((a & 0xff) << 2));
+	PR = PC + 2 + 4;
+ #ifdef PROFILE
+	Profile_Call(cpu, R[n], PR);
+ #endif
+	return R[n];
+ }
+ 
+ void MOVADDI(Cpu *cpu, uint32_t a, uint32_t i)  //MOV Rm, Rn; ADD #imm, Rn  : a = m | n << 4
+ {
+	R[a >> 4] = R[a & 0xf] + (uint32_t)(int32_t)(int8_t)i;
+	PC += 4;
+ }
@@ -0,0 +1,160 @@
+/* =====================================================================
+ * instructions.h
+ * provides prototypes for SH4A cpu instruction routines
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #ifndef INSTRUCTIONS_H
+ #define INSTRUCTIONS_H
+ 
+ #include "registers.h"
+ 
+ /* every routine takes the Cpu to run on plus exactly two operands so that
+  * decode.c can call any of them through a single Handler pointer; the
+  * operands are passed in the order the instruction names them (m/i/d
+  * first, n second) and x/y mark unused ones */
+ typedef void (*Handler)(Cpu *cpu, uint32_t, uint32_t);
+ 
+ /* delayed branches are also split into a Target that only works out where
+  * the branch goes (from the registers as they are before the slot), so a
+  * block can run the branch, its slot and the jump as one pair */
+ typedef uint32_t (*Target)(Cpu *cpu, uint32_t, uint32_t);
+ 
+ //SH4A instruction prototypes
+ void ADD(Cpu *cpu, uint32_t m, uint32_t n);                 //ADD Rm, Rn
+ void ADDI(Cpu *cpu, uint32_t i, uint32_t n);                //ADD #imm, Rn
+ void ADDC(Cpu *cpu, uint32_t m, uint32_t n);                //ADDC Rm, Rn
+ void ADDV(Cpu *cpu, uint32_t m, uint32_t n);                //ADDV Rm, Rn
+ void AND(Cpu *cpu, uint32_t m, uint32_t n);                 //AND Rm, Rn
+ void ANDI(Cpu *cpu, uint32_t i, uint32_t y);                //AND #imm, R0
+ void ANDM(Cpu *cpu, uint32_t i, uint32_t y);                //AND.B #imm, @(R0, GBR)
+ void BF(Cpu *cpu, uint32_t d, uint32_t y);                  //BF Label
+ void BFS(Cpu *cpu, uint32_t d, uint32_t y);                 //BF/S Label
+ void BRA(Cpu *cpu, uint32_t d, uint32_t y);                 //BRA Label
+ void BRAF(Cpu *cpu, uint32_t n, uint32_t y);                //BRAF Rn
+ void BT(Cpu *cpu, uint32_t d, uint32_t y);                  //BT Label
+ void BTS(Cpu *cpu, uint32_t d, uint32_t y);                 //BTS Label
+ void CLRMAC(Cpu *cpu, uint32_t x, uint32_t y);              //CLRMAC
+ void CLRS(Cpu *cpu, uint32_t x, uint32_t y);                //CLRS
+ void CLRT(Cpu *cpu, uint32_t x, uint32_t y);                //CLRT
+ void CMPEQ(Cpu *cpu, uint32_t m, uint32_t n);               //CMP_EQ Rm, Rn
+ void CMPGE(Cpu *cpu, uint32_t m, uint32_t n);               //CMP_GE Rm, Rn
+ void CMPGT(Cpu *cpu, uint32_t m, uint32_t n);               //CMP_GT Rm, Rn
+ void CMPHI(Cpu *cpu, uint32_t m, uint32_t n);               //CMP_HI Rm, Rn
+ void CMPHS(Cpu *cpu, uint32_t m, uint32_t n);               //CMP_HS Rm, Rn
+ void CMPIM(Cpu *cpu, uint32_t i, uint32_t y);               //CMP_EQ #imm,R0
+ void CMPPL(Cpu *cpu, uint32_t n, uint32_t y);               //CMP_PL Rn
+ void CMPPZ(Cpu *cpu, uint32_t n, uint32_t y);               //CMP_PZ Rn
+ void CMPSTR(Cpu *cpu, uint32_t m, uint32_t n);              //CMP_STR Rm, Rn
+ void DIV0S(Cpu *cpu, uint32_t m, uint32_t n);               //DIV0S Rm, Rn
+ void DIV0U(Cpu *cpu, uint32_t x, uint32_t y);               //DIV0U
+ void DIV1(Cpu *cpu, uint32_t m, uint32_t n);                //DIV1 Rm, Rn
+ void DMULS(Cpu *cpu, uint32_t m, uint32_t n);               //DMULS.L Rm, Rn
+ void DMULU(Cpu *cpu, uint32_t m, uint32_t n);               //DMULU.L Rm, Rn
+ void DT(Cpu *cpu, uint32_t n, uint32_t y);                  //DT Rn
+ void EXTSB(Cpu *cpu, uint32_t m, uint32_t n);               //EXTS.B Rm, Rn
+ void EXTSW(Cpu *cpu, uint32_t m, uint32_t n);               //EXTS.W Rm, Rn
+ void EXTUB(Cpu *cpu, uint32_t m, uint32_t n);               //EXTU.B Rm, Rn
+ void EXTUW(Cpu *cpu, uint32_t m, uint32_t n);               //EXTU.W Rm, Rn
+ void ICBI(Cpu *cpu, uint32_t n, uint32_t y);                //ICBI @Rn
+ void JMP(Cpu *cpu, uint32_t n, uint32_t y);                 //JMP @Rn
+ void JSR(Cpu *cpu, uint32_t n, uint32_t y);                 //JSR @Rn
+ void LDCSR(Cpu *cpu, uint32_t m, uint32_t y);               //LDC Rm, SR
+ void LDCGBR(Cpu *cpu, uint32_t m, uint32_t y);              //LDC Rm, GBR
+ void LDCVBR(Cpu *cpu, uint32_t m, uint32_t y);              //LDC Rm, VBR
+ void LDCSGR(Cpu *cpu, uint32_t m, uint32_t y);              //LDC Rm, SGR
+ void LDCSSR(Cpu *cpu, uint32_t m, uint32_t y);              //LDC Rm, SSR
+ void LDCSPC(Cpu *cpu, uint32_t m, uint32_t y);              //LDC Rm, SPC
+ void LDCDBR(Cpu *cpu, uint32_t m, uint32_t y);              //LDC Rm, DBR
+ void LDC_BANK(Cpu *cpu, uint32_t m, uint32_t n);            //LDC Rm, Rn_BANK
+ void LDCMSR(Cpu *cpu, uint32_t m, uint32_t y);              //LDC.L @Rm+, SR
+ void LDCMGBR(Cpu *cpu, uint32_t m, uint32_t y);             //LDC.L @Rm+, GBR
+ void LDCMVBR(Cpu *cpu, uint32_t m, uint32_t y);             //LDC.L @Rm+, VBR
+ void LDCMSGR(Cpu *cpu, uint32_t m, uint32_t y);             //LDC.L @Rm+, SGR
+ void LDCMSSR(Cpu *cpu, uint32_t m, uint32_t y);             //LDC.L @Rm+, SSR
+ void LDCMSPC(Cpu *cpu, uint32_t m, uint32_t y);             //LDC.L @Rm+, SPC
+ void LDCMDBR(Cpu *cpu, uint32_t m, uint32_t y);             //LDC.L @Rm+, DBR
+ void LDCM_BANK(Cpu *cpu, uint32_t m, uint32_t n);           //LDC.L @Rm+, Rn_BANK
+ void LDSMACH(Cpu *cpu, uint32_t m, uint32_t y);             //LDS Rm, MACH
+ void LDSMACL(Cpu *cpu, uint32_t m, uint32_t y);             //LDS Rm, MACL
+ void LDSPR(Cpu *cpu, uint32_t m, uint32_t y);               //LDS Rm, PR
+ void LDSMMACH(Cpu *cpu, uint32_t m, uint32_t y);            //LDS.L @Rm+, MACH
+ void LDSMMACL(Cpu *cpu, uint32_t m, uint32_t y);            //LDS.L @Rm+, MACL
+ void LDSMPR(Cpu *cpu, uint32_t m, uint32_t y);              //LDS.L @Rm+, PR
+ void LDTLB(Cpu *cpu, uint32_t x, uint32_t y);               //LDTLB
+ void MACL(Cpu *cpu, uint32_t m, uint32_t n);                //MAC.L @Rm+, @Rn+
+ void MACW(Cpu *cpu, uint32_t m, uint32_t n);                //MAC.W @Rm+, @Rn+
+ void MOV(Cpu *cpu, uint32_t m, uint32_t n);                 //MOV Rm, Rn
+ void MOVBL(Cpu *cpu, uint32_t m, uint32_t n);               //MOV.B @Rm, Rn
+ void MOVWL(Cpu *cpu, uint32_t m, uint32_t n);               //MOV.W @Rm, Rn
+ void MOVLL(Cpu *cpu, uint32_t m, uint32_t n);               //MOV.L @Rm, Rn
+ void MOVBS(Cpu *cpu, uint32_t m, uint32_t n);               //MOV.B Rm, @Rn
+ void MOVWS(Cpu *cpu, uint32_t m, uint32_t n);               //MOV.W Rm, @Rn
+ void MOVLS(Cpu *cpu, uint32_t m, uint32_t n);               //MOV.L Rm, @Rn
+ void MOVBM(Cpu *cpu, uint32_t m, uint32_t n);               //MOV.B Rm, @-Rn
+ void MOVWM(Cpu *cpu, uint32_t m, uint32_t n);               //MOV.W Rm, @-Rn
+ void MOVLM(Cpu *cpu, uint32_t m, uint32_t n);               //MOV.L Rm, @-Rn
+ void MOVBP(Cpu *cpu, uint32_t m, uint32_t n);               //MOV.B @Rm+, Rn
+ void MOVWP(Cpu *cpu, uint32_t m, uint32_t n);               //MOV.W @Rm+, Rn
+ void MOVLP(Cpu *cpu, uint32_t m, uint32_t n);               //MOV.L @Rm+, Rn
+ void MOVBS0(Cpu *cpu, uint32_t m, uint32_t n);              //MOV.B Rm, @(R0, Rn)
+ void MOVWS0(Cpu *cpu, uint32_t m, uint32_t n);              //MOV.W Rm, @(R0, Rn)
+ void MOVLS0(Cpu *cpu, uint32_t m, uint32_t n);              //MOV.L Rm, @(R0, Rn)
+ void MOVBL0(Cpu *cpu, uint32_t m, uint32_t n);              //MOV.B @(R0, Rn), Rm
+ void MOVWL0(Cpu *cpu, uint32_t m, uint32_t n);              //MOV.W @(R0, Rn), Rm
+ void MOVLL0(Cpu *cpu, uint32_t m, uint32_t n);              //MOV.L @(R0, Rn), Rm
+ void MOVI(Cpu *cpu, uint32_t i, uint32_t n);                //MOV #imm, Rn
+ void MOVWI(Cpu *cpu, uint32_t d, uint32_t n);               //MOV.W @(disp, PC), Rn
+ void MOVLI(Cpu *cpu, uint32_t d, uint32_t n);               //MOV.L @(disp, PC), Rn
+ void MOVBLG(Cpu *cpu, uint32_t d, uint32_t y);              //MOV.B @(disp, GBR), R0
+ void MOVWLG(Cpu *cpu, uint32_t d, uint32_t y);              //MOV.W @(disp, GBR), R0
+ void MOVLLG(Cpu *cpu, uint32_t d, uint32_t y);              //MOV.L @(disp, GBR), R0
+ void ROTCL(Cpu *cpu, uint32_t n, uint32_t y);               //ROTCL Rn
+ void RTE(Cpu *cpu, uint32_t x, uint32_t y);                 //RTE
+ void RTS(Cpu *cpu, uint32_t x, uint32_t y);                 //RTS
+ void SLEEP(Cpu *cpu, uint32_t x, uint32_t y);               //SLEEP
+ void STCSR(Cpu *cpu, uint32_t n, uint32_t y);               //STC SR, Rn
+ void STCMSR(Cpu *cpu, uint32_t n, uint32_t y);              //STC.L SR, @-Rn
+ 
+ //fused sequences; Decode_Idiom() builds these from several instructions
+ void DIV1X32(Cpu *cpu, uint32_t a, uint32_t r);             //32 x (ROTCL Rq; DIV1 Rd, Rr), a = q | d << 4
+ void COPYL(Cpu *cpu, uint32_t a, uint32_t b);               //MOV.L @Rm+ to @Rn copy loop, a = m | x << 4 | n << 8 | c << 12, b = bytes | cycles << 8
+ void MACLOOP(Cpu *cpu, uint32_t a, uint32_t b);             //MAC.W/MAC.L dot product loop, a = m | n << 4 | c << 8 (| 0x1000 for MAC.L), b as COPYL
+ 
+ //superinstructions; Decode_Pair() builds these from two neighbouring instructions
+ void DTBFS(Cpu *cpu, uint32_t a, uint32_t y);               //DT Rn; BF/S label, a = d | n << 8
+ void CMPEQBT(Cpu *cpu, uint32_t a, uint32_t d);             //CMP/EQ Rm, Rn; BT label, a = m | n << 4
+ void MOVLIJSR(Cpu *cpu, uint32_t a, uint32_t y);            //MOV.L @(disp, PC), Rn; JSR @Rn, a = d | n << 8
+ void MOVADDI(Cpu *cpu, uint32_t a, uint32_t i);             //MOV Rm, Rn; ADD #imm, Rn, a = m | n << 4
+ 
+ //delayed branch targets, PC must still point at the branch (or the first half of a superinstruction)
+ uint32_t BFS_Target(Cpu *cpu, uint32_t d, uint32_t y);
+ uint32_t BRA_Target(Cpu *cpu, uint32_t d, uint32_t y);
+ uint32_t BRAF_Target(Cpu *cpu, uint32_t n, uint32_t y);
+ uint32_t BTS_Target(Cpu *cpu, uint32_t d, uint32_t y);
+ uint32_t JMP_Target(Cpu *cpu, uint32_t n, uint32_t y);
+ uint32_t JSR_Target(Cpu *cpu, uint32_t n, uint32_t y);
+ uint32_t RTE_Target(Cpu *cpu, uint32_t x, uint32_t y);
+ uint32_t RTS_Target(Cpu *cpu, uint32_t x, uint32_t y);
+ uint32_t DTBFS_Target(Cpu *cpu, uint32_t a, uint32_t y);
+ uint32_t MOVLIJSR_Target(Cpu *cpu, uint32_t a, uint32_t y);
+ 
+ #endif
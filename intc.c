@@ -0,0 +1,132 @@
+/* =====================================================================
+ * intc.c
+ * prioritises peripheral interrupts and hands them to the cpu
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #include <stdlib.h>
+ #include "registers.h"
+ #include "memory.h"
+ #include "intc.h"
+ 
+ 
+ /* INTEVT codes as on the SH7305; the priority fields follow the SH7724
+  * layout, which it is derived from */
+ static const struct
+ {
+	uint16_t intevt;
+	unsigned char ipr, shift;      //priority is (ipr[ipr] >> shift) & 0xf
+	unsigned char clear;           //taking it clears it
+ } Sources[INTC_SOURCES] = {
+	{ 0x400, 0, 12, 0 },           //TUNI0, IPRA
+	{ 0x420, 0, 8, 0 },            //TUNI1
+	{ 0x440, 0, 4, 0 },            //TUNI2
+	{ 0xa80, 10, 12, 0 },          //ATI, IPRK; the RTC shares one priority
+	{ 0xaa0, 10, 12, 0 },          //PRI
+	{ 0xac0, 10, 12, 0 },          //CUI
+	{ 0xbe0, 5, 12, 1 },           //KEYSC, IPRF
+ };
+ 
+ static uint32_t Intc_Read(void *opaque, uint32_t addr, int size)
+ {
+	Intc *c = ((Cpu *)opaque)->intc;
+	uint32_t reg = (addr - INTC_BASE) >> 2;
+	
+	if ((addr & 3) >= 2 || reg >= INTC_IPRS)
+		return 0;
+	if (size == 1)
+		return (addr & 1) ? c->ipr[reg] & 0xff : c->ipr[reg] >> 8;
+	return c->ipr[reg];
+ }
+ 
+ static void Intc_Write(void *opaque, uint32_t addr, uint32_t value, int size)
+ {
+	Cpu *cpu = opaque;
+	Intc *c = cpu->intc;
+	uint32_t reg = (addr - INTC_BASE) >> 2;
+	
+	if ((addr & 3) >= 2 || reg >= INTC_IPRS)
+		return;
+	if (size == 1)
+		c->ipr[reg] = (addr & 1) ? (c->ipr[reg] & 0xff00) | (value & 0xff) : (c->ipr[reg] & 0xff) | (value & 0xff) << 8;
+	else
+		c->ipr[reg] = (uint16_t)value;
+	if (c->pending)
+		cpu->next_event = 0;  //a pending source may just have been given a priority
+ }
+ 
+ int Intc_Init(Cpu *cpu)
+ {
+	cpu->intc = calloc(1, sizeof(Intc));
+	if (!cpu->intc)
+		return 0;
+	Memory_Map_IO(cpu, INTC_BASE, INTC_IPRS * 4, Intc_Read, Intc_Write, cpu, "INTC");
+	return 1;
+ }
+ 
+ void Intc_Free(Cpu *cpu)
+ {
+	free(cpu->intc);
+	cpu->intc = 0;
+ }
+ 
+ void Intc_Reset(Cpu *cpu)
+ {
+	Intc *c = cpu->intc;
+	unsigned int i;
+	for (i = 0; i < INTC_IPRS; ++i)
+		c->ipr[i] = 0;
+	c->pending = 0;
+ }
+ 
+ void Intc_Raise(Cpu *cpu, unsigned int source)
+ {
+	cpu->intc->pending |= 1u << source;
+	cpu->next_event = 0;  //looked at between the next two blocks
+ }
+ 
+ void Intc_Clear(Cpu *cpu, unsigned int source)
+ {
+	cpu->intc->pending &= ~(1u << source);
+ }
+ 
+ int Intc_Accept(Cpu *cpu)
+ {
+	Intc *c = cpu->intc;
+	unsigned int i, level, best = INTC_SOURCES, best_level = (cpu->sr & SR_IMASK) >> 4;
+	
+	if (!c || !c->pending || (cpu->sr & SR_BL))
+		return 0;
+	for (i = 0; i < INTC_SOURCES; ++i)
+		if (c->pending & (1u << i)) {
+			level = (c->ipr[Sources[i].ipr] >> Sources[i].shift) & 0xf;
+			if (level > best_level) {  //ties go to the lower source number
+				best = i;
+				best_level = level;
+			}
+		}
+	if (best == INTC_SOURCES)
+		return 0;
+	if (Sources[best].clear)
+		c->pending &= ~(1u << best);
+	Interrupt(cpu, Sources[best].intevt);
+	return 1;
+ }
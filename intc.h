@@ -0,0 +1,64 @@
+/* =====================================================================
+ * intc.h
+ * provides the interrupt controller
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #ifndef INTC_H
+ #define INTC_H
+ 
+ #include "registers.h"
+ 
+ #define INTC_BASE 0xa4080000      //IPRA-IPRL, a 16 bit register every 4 bytes
+ #define INTC_IPRS 12
+ 
+ //interrupt sources that are modelled so far
+ enum
+ {
+	INTC_TMU0,                     //TUNI0-2, TMU channel underflow
+	INTC_TMU1,
+	INTC_TMU2,
+	INTC_RTC_ATI,                  //RTC alarm
+	INTC_RTC_PRI,                  //RTC periodic
+	INTC_RTC_CUI,                  //RTC carry
+	INTC_KEYSC,                    //key matrix changed
+	INTC_SOURCES
+ };
+ 
+ /* a source stays pending until its device clears it, like the level
+  * signals on the real chip; KEYSC has no status register here so taking
+  * it clears it.  Nothing is accepted from here directly: Sched_Run() asks
+  * at the first block boundary after next_event, which Intc_Raise(), IPR
+  * writes and any SR.IMASK or SR.BL change pull in to 0 */
+ typedef struct Intc
+ {
+	uint16_t ipr[INTC_IPRS];       //4 bit priority fields; 0 masks a source
+	uint32_t pending;              //bit per INTC_* source
+ } Intc;
+ 
+ int Intc_Init(Cpu *cpu);          //map IPRA-IPRL; returns 0 if out of memory
+ void Intc_Free(Cpu *cpu);
+ void Intc_Reset(Cpu *cpu);        //every priority 0, nothing pending
+ void Intc_Raise(Cpu *cpu, unsigned int source);
+ void Intc_Clear(Cpu *cpu, unsigned int source);
+ int Intc_Accept(Cpu *cpu);        //enter the handler for the highest priority source SR lets through; 1 if one was taken
+ 
+ #endif
@@ -0,0 +1,400 @@
+/* =====================================================================
+ * jit.c
+ * translates hot SH4A basic blocks into native x86-64 code
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #include <stddef.h>
+ #include <stdlib.h>
+ #include <string.h>
+ #include <sys/mman.h>
+ #include "registers.h"
+ #include "instructions.h"
+ #include "decode.h"
+ #include "block.h"
+ #include "memory.h"
+ #include "jit.h"
+ #include "profile.h"
+ 
+ #ifdef JIT
+ 
+ /* generated code layout for one block:
+  *
+  *   entry:  push rbx; mov rbx, rdi; jmp body   (only used when entered from C)
+  *   check:  cmp cycles, next_event; jae leave  (chained jumps land here)
+  *   body:   add cycles, block cycles
+  *           translated instructions
+ *           delayed branch: call target; slot; PC = target
+  *           exits: cmp PC, successor; jne; jmp stub   (patched to jmp body of successor)
+  *           leave: xor eax, eax; pop rbx; ret
+  *
+  * rbx holds the Cpu for the whole run so the simple register to register
+  * instructions are done in place on cpu->r; everything else calls the
+  * normal routine from instructions.c, which keeps rare and privileged
+  * instructions (LDTLB, LDC ...) in one place and means nothing ever has to
+  * be spilled before a call.  PC is only written back before a call or at
+  * the end of the block. */
+ 
+ #define JIT_MAX_EXITS 16384
+ #define JIT_MAX_BLOCKS (JIT_MAX_EXITS / 2)
+ #define JIT_ENTRY_SIZE 6                                //push rbx + mov rbx, rdi + jmp short; chains jump past it
+ #ifdef PROFILE
+ #define JIT_MAX_BLOCK (80 + (BLOCK_MAX + 2) * 48 + 3 * 48)  //worst case bytes for one block, run counter included
+ #else
+ #define JIT_MAX_BLOCK (64 + (BLOCK_MAX + 2) * 48 + 3 * 48)  //worst case bytes for one block
+ #endif
+ 
+ typedef struct
+ {
+	unsigned char *jump;          //rel32 of the jmp to patch
+	unsigned char *stub;          //where it jumps until linked
+	unsigned char *linked;        //body of the block it has been patched to, or 0
+	uint32_t target;              //guest PC the jump leads to
+ } Jit_Exit;
+ 
+ /* every translation made since the last flush, so guest code changing
+  * under one can find it even after its Block has been evicted; chained
+  * exits into it are put back on their stubs */
+ typedef struct
+ {
+	uint32_t pc, end;             //guest code translated, delay slot included
+	unsigned char *body;          //0 once unlinked
+ #ifdef PROFILE
+	uint64_t runs;                //bumped by the code itself, see Jit_Count()
+	unsigned int count;
+	unsigned char kinds[BLOCK_MAX + 1];  //of the routines it stands for, slot included
+ #endif
+ } Jit_Block;
+ 
+ typedef struct Jit
+ {
+	unsigned char *code;          //start of the executable cache
+	unsigned char *emit;          //next free byte
+	Jit_Exit exits[JIT_MAX_EXITS];
+	unsigned int exit_count;
+	Jit_Block blocks[JIT_MAX_BLOCKS];
+	unsigned int block_count;
+	Jit_Exit *pending;            //exit taken by the last native run, waiting for its target to be compiled
+	unsigned int flushes;         //Jit_Flush() calls so far; one during a run makes its exit meaningless
+ } Jit;
+ 
+ static void Byte(Jit *j, unsigned int b) { *j->emit++ = (unsigned char)b; }
+ static void Long(Jit *j, uint32_t l) { memcpy(j->emit, &l, 4); j->emit += 4; }
+ static void Quad(Jit *j, uint64_t q) { memcpy(j->emit, &q, 8); j->emit += 8; }
+ static void Patch(unsigned char *rel, unsigned char *to) { int32_t v = (int32_t)(to - (rel + 4)); memcpy(rel, &v, 4); }
+ 
+ static void Cpu_Field(Jit *j, unsigned int reg, size_t offset)  //ModRM for [rbx + offset] with reg in the middle field
+ {
+	if (offset < 128) {
+		Byte(j, 0x43 | reg << 3);
+		Byte(j, offset);
+	} else {
+		Byte(j, 0x83 | reg << 3);
+		Long(j, offset);
+	}
+ }
+ 
+ #define REG(n) (offsetof(Cpu, r) + (n) * sizeof(uint32_t))
+ 
+ static void Flush_PC(Jit *j, unsigned int *pending)  //add dword [rbx + pc], pending
+ {
+	if (*pending == 0)
+		return;
+	if (*pending < 128) {  //imm8 is sign extended, so a run of fused pairs can outgrow it
+		Byte(j, 0x83); Cpu_Field(j, 0, offsetof(Cpu, pc)); Byte(j, *pending);
+	} else {
+		Byte(j, 0x81); Cpu_Field(j, 0, offsetof(Cpu, pc)); Long(j, *pending);
+	}
+	*pending = 0;
+ }
+ 
+ static void Call(Jit *j, uintptr_t fn, uint32_t a, uint32_t b)  //call an interpreter routine: rdi = cpu, esi = a, edx = b
+ {
+	Byte(j, 0x48); Byte(j, 0x89); Byte(j, 0xdf);
+	Byte(j, 0xbe); Long(j, a);
+	Byte(j, 0xba); Long(j, b);
+	Byte(j, 0x48); Byte(j, 0xb8); Quad(j, (uint64_t)fn);
+	Byte(j, 0xff); Byte(j, 0xd0);
+ }
+ 
+ static unsigned int Native(Jit *j, const Decoded *e)  //translate in place on cpu->r if this is one of the simple instructions; returns bytes of guest code covered or 0
+ {
+	size_t m = REG(e->a), n = REG(e->b);
+	
+	if (e->fn == MOV) {  //mov eax, [m]; mov [n], eax
+		Byte(j, 0x8b); Cpu_Field(j, 0, m);
+		Byte(j, 0x89); Cpu_Field(j, 0, n);
+	} else if (e->fn == ADD) {  //mov eax, [n]; add eax, [m]; mov [n], eax
+		Byte(j, 0x8b); Cpu_Field(j, 0, n);
+		Byte(j, 0x03); Cpu_Field(j, 0, m);
+		Byte(j, 0x89); Cpu_Field(j, 0, n);
+	} else if (e->fn == AND) {  //mov eax, [n]; and eax, [m]; mov [n], eax
+		Byte(j, 0x8b); Cpu_Field(j, 0, n);
+		Byte(j, 0x23); Cpu_Field(j, 0, m);
+		Byte(j, 0x89); Cpu_Field(j, 0, n);
+	} else if (e->fn == ADDI) {  //add dword [n], imm8; sign extended by the cpu just like the SH4A
+		Byte(j, 0x83); Cpu_Field(j, 0, n); Byte(j, e->a);
+	} else if (e->fn == MOVI) {  //mov dword [n], imm32; imm8 sign extended first
+		Byte(j, 0xc7); Cpu_Field(j, 0, n); Long(j, (uint32_t)(int32_t)(int8_t)e->a);
+	} else if (e->fn == EXTUB) {  //movzx eax, byte [m]; mov [n], eax
+		Byte(j, 0x0f); Byte(j, 0xb6); Cpu_Field(j, 0, m);
+		Byte(j, 0x89); Cpu_Field(j, 0, n);
+	} else if (e->fn == EXTUW) {  //movzx eax, word [m]; mov [n], eax
+		Byte(j, 0x0f); Byte(j, 0xb7); Cpu_Field(j, 0, m);
+		Byte(j, 0x89); Cpu_Field(j, 0, n);
+	} else if (e->fn == MOVADDI) {  //mov eax, [m]; add eax, imm8; mov [n], eax
+		Byte(j, 0x8b); Cpu_Field(j, 0, REG(e->a & 0xf));
+		Byte(j, 0x83); Byte(j, 0xc0); Byte(j, e->b);
+		Byte(j, 0x89); Cpu_Field(j, 0, REG(e->a >> 4));
+		return 4;
+	} else
+		return 0;
+	return 2;
+ }
+ 
+ static unsigned int Successors(const Block *b, uint32_t *to)  //statically known guest PCs the block can end at
+ {
+	const Decoded *e = &b->ops[b->count - 1];
+	uint32_t pc = b->end - 2;
+	uint32_t d8 = (uint32_t)(int32_t)(int8_t)e->a;
+	uint32_t d12 = (e->a & 0x800) ? e->a | 0xfffff000 : e->a;
+	
+	if (!(e->flags & DECODE_BRANCH)) {  //block was cut at BLOCK_MAX
+		to[0] = b->end;
+		return 1;
+	}
+	if (e->fn == BRA) {
+		to[0] = pc + 4 + d12 * 2;
+		return 1;
+	}
+	if (e->fn == CMPEQBT)
+		d8 = (uint32_t)(int32_t)(int8_t)e->b;
+	if (e->fn == BT || e->fn == BF || e->fn == BTS || e->fn == BFS || e->fn == DTBFS || e->fn == CMPEQBT) {
+		to[0] = pc + 4 + d8 * 2;
+		to[1] = pc + ((e->flags & DECODE_DELAY) ? 4 : 2);
+		return 2;
+	}
+	return 0;  //JMP, JSR, BRAF, RTS and RTE go wherever the register says; SLEEP leaves for the run loop
+ }
+ 
+ int Jit_Init(Cpu *cpu)
+ {
+	Jit *j = calloc(1, sizeof(Jit));
+	void *p = mmap(0, JIT_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (!j || p == MAP_FAILED) {
+		free(j);
+		if (p != MAP_FAILED)
+			munmap(p, JIT_CACHE_SIZE);
+		return 0;
+	}
+	j->code = j->emit = p;
+	cpu->jit = j;
+	return 1;
+ }
+ 
+ void Jit_Free(Cpu *cpu)
+ {
+	if (!cpu->jit)
+		return;
+	munmap(cpu->jit->code, JIT_CACHE_SIZE);
+	free(cpu->jit);
+	cpu->jit = 0;
+ }
+ 
+ void Jit_Flush(Cpu *cpu)
+ {
+	Jit *j = cpu->jit;
+	unsigned int i;
+	if (!j)
+		return;
+ #ifdef PROFILE
+	Jit_Count(cpu, cpu->profile->kinds);
+ #endif
+	for (i = 0; i < BLOCK_CACHE_SIZE; ++i)
+		cpu->blocks[i].native = 0;
+	j->emit = j->code;
+	j->exit_count = 0;
+	j->block_count = 0;
+	j->pending = 0;
+	++j->flushes;
+	cpu->next_event = 0;  //if native code called us, it leaves at the next block instead of chaining into stale code
+ }
+ 
+ void *Jit_Compile(Cpu *cpu, Block *b)
+ {
+	Jit *j = cpu->jit;
+	unsigned char *entry, *leave, *body;
+	unsigned char *stubs[2];
+	uint32_t to[2];
+	unsigned int i, exits, pending = 0;
+	
+	if (!j)
+		return 0;
+	if (j->emit + JIT_MAX_BLOCK > j->code + JIT_CACHE_SIZE || j->exit_count + 2 > JIT_MAX_EXITS
+		|| j->block_count == JIT_MAX_BLOCKS)
+		Jit_Flush(cpu);  //cache full; start over rather than track lifetimes
+	
+	entry = j->emit;
+	Byte(j, 0x53);                                   //push rbx
+	Byte(j, 0x48); Byte(j, 0x89); Byte(j, 0xfb);     //mov rbx, rdi
+	Byte(j, 0xeb); body = j->emit; Byte(j, 0);      //jmp short body; the first block of a run always runs
+	Byte(j, 0x48); Byte(j, 0x8b); Cpu_Field(j, 0, offsetof(Cpu, cycles));      //mov rax, [rbx + cycles]
+	Byte(j, 0x48); Byte(j, 0x3b); Cpu_Field(j, 0, offsetof(Cpu, next_event));  //cmp rax, [rbx + next_event]
+	Byte(j, 0x0f); Byte(j, 0x83); leave = j->emit; Long(j, 0);  //jae leave
+	*body = (unsigned char)(j->emit - (body + 1));
+	Byte(j, 0x48); Byte(j, 0x81); Cpu_Field(j, 0, offsetof(Cpu, cycles)); Long(j, b->cycles);  //add qword [rbx + cycles], block cycles
+ #ifdef PROFILE
+	{
+		Jit_Block *k = &j->blocks[j->block_count];
+		Byte(j, 0x48); Byte(j, 0xb8); Quad(j, (uint64_t)(uintptr_t)&k->runs);  //mov rax, &runs
+		Byte(j, 0x48); Byte(j, 0xff); Byte(j, 0x00);   //inc qword [rax]
+		k->runs = 0;
+		for (k->count = 0; k->count < b->count; ++k->count)
+			k->kinds[k->count] = b->ops[k->count].kind;
+		if (b->target)
+			k->kinds[k->count++] = b->slot.kind;
+	}
+ #endif
+	
+	for (i = 0; i < b->count - (b->target != 0); ++i) {
+		const Decoded *e = &b->ops[i];
+		unsigned int width = Native(j, e);
+		if (width) {
+			pending += width;
+			continue;
+		}
+		Flush_PC(j, &pending);  //the routine reads and advances PC itself
+		Call(j, (uintptr_t)e->fn, e->a, e->b);
+	}
+	Flush_PC(j, &pending);
+	if (b->target) {  //branch pair, as in Block_Run(); the target is kept on the stack over the slot
+		const Decoded *e = &b->ops[b->count - 1];
+		Call(j, (uintptr_t)b->target, e->a, e->b);
+		Byte(j, 0x50); Byte(j, 0x50);                //push rax twice, keeping rsp 16 byte aligned for calls
+		Byte(j, 0xc7); Cpu_Field(j, 0, offsetof(Cpu, pc)); Long(j, b->end);  //mov dword [rbx + pc], slot address
+		if (!Native(j, &b->slot)) {
+			Byte(j, 0xc7); Cpu_Field(j, 0, offsetof(Cpu, in_slot)); Long(j, 1);  //mov dword [rbx + in_slot], 1
+			Call(j, (uintptr_t)b->slot.fn, b->slot.a, b->slot.b);
+			Byte(j, 0xc7); Cpu_Field(j, 0, offsetof(Cpu, in_slot)); Long(j, 0);
+		}
+		Byte(j, 0x58); Byte(j, 0x58);                //pop rax twice
+		Byte(j, 0x89); Cpu_Field(j, 0, offsetof(Cpu, pc));  //mov [rbx + pc], eax
+	}
+	
+	exits = Successors(b, to);
+	for (i = 0; i < exits; ++i) {
+		Byte(j, 0x81); Cpu_Field(j, 7, offsetof(Cpu, pc)); Long(j, to[i]);  //cmp dword [rbx + pc], successor
+		Byte(j, 0x75); Byte(j, 0x05);                //jne next exit
+		Byte(j, 0xe9); stubs[i] = j->emit; Long(j, 0);  //jmp stub, later the successor's body
+	}
+	Patch(leave, j->emit);
+	Byte(j, 0x31); Byte(j, 0xc0);                    //xor eax, eax
+	Byte(j, 0x5b); Byte(j, 0xc3);                    //pop rbx; ret
+	for (i = 0; i < exits; ++i) {  //stubs hand the exit back to Jit_Run so it can be linked
+		Jit_Exit *x = &j->exits[j->exit_count++];
+		x->jump = stubs[i];
+		x->stub = j->emit;
+		x->linked = 0;
+		x->target = to[i];
+		Patch(stubs[i], j->emit);
+		Byte(j, 0x48); Byte(j, 0xb8); Quad(j, (uint64_t)(uintptr_t)x);  //mov rax, exit
+		Byte(j, 0x5b); Byte(j, 0xc3);                //pop rbx; ret
+	}
+	
+	j->blocks[j->block_count].pc = b->pc;
+	j->blocks[j->block_count].end = b->end + (b->target != 0) * 2;
+	j->blocks[j->block_count++].body = entry + JIT_ENTRY_SIZE;
+	b->native = entry;
+ #ifdef PROFILE
+	Profile_Map(entry, j->emit - entry, b->pc);
+ #endif
+	return entry;
+ }
+ 
+ #ifdef PROFILE
+ void Jit_Count(Cpu *cpu, uint64_t *kinds)
+ {
+	Jit *j = cpu->jit;
+	unsigned int i, k;
+	if (!j)
+		return;
+	for (i = 0; i < j->block_count; ++i) {
+		Jit_Block *b = &j->blocks[i];
+		for (k = 0; k < b->count; ++k)
+			kinds[b->kinds[k]] += b->runs;
+		b->runs = 0;
+	}
+ }
+ #endif
+ 
+ static void Unlink(Jit *j, Jit_Block *k)  //nothing chains into k any more; its code stays put until the next flush
+ {
+	unsigned int i;
+	for (i = 0; i < j->exit_count; ++i)
+		if (j->exits[i].linked == k->body) {
+			Patch(j->exits[i].jump, j->exits[i].stub);
+			j->exits[i].linked = 0;
+		}
+	k->body = 0;
+ }
+ 
+ void Jit_Invalidate(Cpu *cpu, uint32_t base, uint32_t size)
+ {
+	Jit *j = cpu->jit;
+	unsigned int i;
+	if (!j)
+		return;
+	for (i = 0; i < j->block_count; ++i) {
+		Jit_Block *k = &j->blocks[i];
+		if (k->body && k->pc < (uint64_t)base + size && k->end > base)
+			Unlink(j, k);
+	}
+ }
+ 
+ void Jit_Invalidate_Host(Cpu *cpu, const unsigned char *host, uint32_t bytes)
+ {
+	Jit *j = cpu->jit;
+	unsigned int i;
+	if (!j)
+		return;
+	for (i = 0; i < j->block_count; ++i) {
+		Jit_Block *k = &j->blocks[i];
+		if (k->body && Memory_Overlaps(cpu, k->pc, k->end, host, bytes))
+			Unlink(j, k);
+	}
+ }
+ 
+ void Jit_Run(Cpu *cpu, void *native)
+ {
+	Jit *j = cpu->jit;
+	unsigned int flushes = j->flushes;
+	Jit_Exit *x;
+	if (j->pending && j->pending->target == cpu->pc) {  //chain the previous exit straight into this block's body
+		j->pending->linked = (unsigned char *)native + JIT_ENTRY_SIZE;
+		Patch(j->pending->jump, j->pending->linked);
+	}
+	j->pending = 0;  //stays 0 if an MMU fault longjmps out
+	x = ((Jit_Exit *(*)(Cpu *))native)(cpu);
+	if (j->flushes == flushes)
+		j->pending = x;
+ }
+ 
+ #endif
@@ -0,0 +1,48 @@
+/* =====================================================================
+ * jit.h
+ * provides the x86-64 dynamic recompiler tier for hot basic blocks
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #ifndef JIT_H
+ #define JIT_H
+ 
+ #include "block.h"
+ 
+ #if defined(__x86_64__) && !defined(NO_JIT) && !defined(PROFILE_PAIRS)  //build with -DNO_JIT to stay purely interpreted
+ #define JIT
+ #endif
+ 
+ #define JIT_THRESHOLD 64              //interpreted runs of a block before it is compiled
+ #define JIT_CACHE_SIZE (16 << 20)     //bytes of executable memory for generated code
+ 
+ int Jit_Init(Cpu *cpu);               //map this instance's code cache; returns 0 on failure and the JIT stays off
+ void Jit_Free(Cpu *cpu);
+ void Jit_Flush(Cpu *cpu);             //drop every translation
+ void Jit_Invalidate(Cpu *cpu, uint32_t base, uint32_t size);  //unchain translations of guest code in [base, base + size)
+ void Jit_Invalidate_Host(Cpu *cpu, const unsigned char *host, uint32_t bytes);  //same for code in that host memory
+ void *Jit_Compile(Cpu *cpu, Block *b);  //translate b; returns its native entry or 0
+ void Jit_Run(Cpu *cpu, void *native);   //run native code from PC, following block chains
+ #ifdef PROFILE
+ void Jit_Count(Cpu *cpu, uint64_t *kinds);  //add what the native blocks ran since the last call into kinds
+ #endif
+ 
+ #endif
@@ -0,0 +1,100 @@
+/* =====================================================================
+ * keyboard.c
+ * emulates the key matrix and its periodic scan
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #include <stdlib.h>
+ #include "registers.h"
+ #include <string.h>
+ #include "memory.h"
+ #include "intc.h"
+ #include "sched.h"
+ #include "keyboard.h"
+ #include "companion.h"
+ 
+ 
+ static uint32_t Keyboard_Read(void *opaque, uint32_t addr, int size)
+ {
+	Keyboard *k = opaque;
+	unsigned int word = ((addr - KEYSC_BASE) >> 1) % 6;
+	
+	if (size == 4)
+		return (uint32_t)k->keysc[word] << 16 | k->keysc[(word + 1) % 6];
+	if (size == 1)
+		return (addr & 1) ? k->keysc[word] & 0xff : k->keysc[word] >> 8;
+	return k->keysc[word];
+ }
+ 
+ static void Scan(Cpu *cpu, void *opaque)
+ {
+	Keyboard *k = opaque;
+	if (cpu->companion)
+		Companion_Keys(cpu);
+	if (memcmp(k->keysc, k->matrix, sizeof(k->keysc))) {
+		memcpy(k->keysc, k->matrix, sizeof(k->keysc));
+		Intc_Raise(cpu, INTC_KEYSC);
+	}
+	Sched_Add(cpu, &k->scan, k->scan.when + CPU_HZ / KEYSC_HZ);
+ }
+ 
+ int Keyboard_Init(Cpu *cpu)
+ {
+	Keyboard *k = calloc(1, sizeof(Keyboard));
+	if (!k)
+		return 0;
+	k->scan.fn = Scan;
+	k->scan.opaque = k;
+	cpu->keyboard = k;
+	Memory_Map_IO(cpu, KEYSC_BASE, sizeof(k->keysc), Keyboard_Read, 0, k, "KEYSC");
+	Keyboard_Reset(cpu);
+	return 1;
+ }
+ 
+ void Keyboard_Free(Cpu *cpu)
+ {
+	if (cpu->keyboard && cpu->sched)
+		Sched_Cancel(cpu, &cpu->keyboard->scan);
+	free(cpu->keyboard);
+	cpu->keyboard = 0;
+ }
+ 
+ void Keyboard_Reset(Cpu *cpu)
+ {
+	Keyboard *k = cpu->keyboard;
+	if (k)
+		Sched_Add(cpu, &k->scan, cpu->cycles + CPU_HZ / KEYSC_HZ);
+ }
+ 
+ void Keyboard_Set(Cpu *cpu, int keycode, int down)
+ {
+	Keyboard *k = cpu->keyboard;
+	int row = keycode % 10;
+	int col = keycode / 10 - 1;
+	uint16_t bit = 1 << (col + 8 * (row & 1));  //same layout the SDK's keydown() reads
+	
+	if (row < 0 || col < 0 || col > 7 || (row >> 1) >= 6)
+		return;
+	if (down)
+		k->matrix[row >> 1] |= bit;
+	else
+		k->matrix[row >> 1] &= ~bit;
+ }
@@ -0,0 +1,50 @@
+/* =====================================================================
+ * keyboard.h
+ * provides the key matrix
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #ifndef KEYBOARD_H
+ #define KEYBOARD_H
+ 
+ #include "registers.h"
+ #include "sched.h"
+ 
+ #define KEYSC_BASE 0xa44b0000     //6 words of key matrix data, one bit per key
+ #define KEYSC_HZ 128              //matrix scans per second
+ 
+ /* keys are named by their basic keycode as used by add-ins: tens digit is
+  * the column (1-7), units digit the row (1-9), e.g. 31 is EXE.  Keys
+  * pressed or released only show in KEYSC at the next scan, which is also
+  * when KEYSC interrupts */
+ typedef struct Keyboard
+ {
+	uint16_t keysc[6];             //as of the last scan
+	uint16_t matrix[6];            //keys held right now
+	Event scan;
+ } Keyboard;
+ 
+ int Keyboard_Init(Cpu *cpu);                      //map the key registers; returns 0 if out of memory
+ void Keyboard_Free(Cpu *cpu);
+ void Keyboard_Reset(Cpu *cpu);    //start scanning again after Sched_Reset()
+ void Keyboard_Set(Cpu *cpu, int keycode, int down);
+ 
+ #endif
@@ -0,0 +1,293 @@
+/* =====================================================================
+ * lcd.c
+ * schedules the display refresh
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #include <stdlib.h>
+ #include <string.h>
+ #include "registers.h"
+ #include "memory.h"
+ #include "sched.h"
+ #include "lcd.h"
+ #include "companion.h"
+ #if defined(__SSSE3__)
+ #include <immintrin.h>
+ #endif
+ 
+ #define ALL_PAGES ((1ULL << VRAM_PAGES) - 1)
+ 
+ 
+ /* big endian RGB565 to 0xffRRGGBB, each field widened by repeating its top
+  * bits.  With the pixel zero extended to 32 bits every field is two
+  * shifts and masks, so the vector versions are the same sum 8 (AVX2) or 4
+  * (SSSE3) pixels at a time; the shuffle does the byte swap and the zero
+  * extension in one */
+ static void Convert(uint32_t *dst, const unsigned char *src, unsigned int count)
+ {
+	uint32_t p;
+	
+ #if defined(__AVX2__)
+	{
+		const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+		const __m256i alpha = _mm256_set1_epi32((int)0xff000000), r_hi = _mm256_set1_epi32(0xf80000), r_lo = _mm256_set1_epi32(0x070000);
+		const __m256i g_hi = _mm256_set1_epi32(0xfc00), g_lo = _mm256_set1_epi32(0x0300), b_hi = _mm256_set1_epi32(0xf8), b_lo = _mm256_set1_epi32(0x07);
+		for (; count >= 8; count -= 8, src += 16, dst += 8) {
+			__m256i v = _mm256_cvtepu16_epi32(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), swap)), out;
+			out = _mm256_or_si256(alpha, _mm256_and_si256(_mm256_slli_epi32(v, 8), r_hi));
+			out = _mm256_or_si256(out, _mm256_and_si256(_mm256_slli_epi32(v, 3), _mm256_or_si256(r_lo, b_hi)));
+			out = _mm256_or_si256(out, _mm256_and_si256(_mm256_slli_epi32(v, 5), g_hi));
+			out = _mm256_or_si256(out, _mm256_and_si256(_mm256_srli_epi32(v, 1), g_lo));
+			out = _mm256_or_si256(out, _mm256_and_si256(_mm256_srli_epi32(v, 2), b_lo));
+			_mm256_storeu_si256((__m256i *)dst, out);
+		}
+	}
+ #endif
+ #if defined(__SSSE3__)
+	{
+		const __m128i widen = _mm_setr_epi8(1, 0, -1, -1, 3, 2, -1, -1, 5, 4, -1, -1, 7, 6, -1, -1);
+		const __m128i alpha = _mm_set1_epi32((int)0xff000000), r_hi = _mm_set1_epi32(0xf80000), r_lo = _mm_set1_epi32(0x070000);
+		const __m128i g_hi = _mm_set1_epi32(0xfc00), g_lo = _mm_set1_epi32(0x0300), b_hi = _mm_set1_epi32(0xf8), b_lo = _mm_set1_epi32(0x07);
+		for (; count >= 4; count -= 4, src += 8, dst += 4) {
+			__m128i v = _mm_shuffle_epi8(_mm_loadl_epi64((const __m128i *)src), widen), out;
+			out = _mm_or_si128(alpha, _mm_and_si128(_mm_slli_epi32(v, 8), r_hi));
+			out = _mm_or_si128(out, _mm_and_si128(_mm_slli_epi32(v, 3), _mm_or_si128(r_lo, b_hi)));
+			out = _mm_or_si128(out, _mm_and_si128(_mm_slli_epi32(v, 5), g_hi));
+			out = _mm_or_si128(out, _mm_and_si128(_mm_srli_epi32(v, 1), g_lo));
+			out = _mm_or_si128(out, _mm_and_si128(_mm_srli_epi32(v, 2), b_lo));
+			_mm_storeu_si128((__m128i *)dst, out);
+		}
+	}
+ #endif
+	for (; count; --count, src += 2, ++dst) {
+		p = (uint32_t)src[0] << 8 | src[1];
+		*dst = 0xff000000 | (p << 8 & 0xf80000) | (p << 3 & 0x0700f8) | (p << 5 & 0xfc00) | (p >> 1 & 0x0300) | (p >> 2 & 0x07);
+	}
+ }
+ 
+ static uint64_t Row_Pages(unsigned int row)  //the VRAM pages row is in, as Memory_Shown() has them
+ {
+	uint32_t first = row * LCD_ROW >> PAGE_SHIFT, last = ((row + 1) * LCD_ROW - 1) >> PAGE_SHIFT;
+	return (2ULL << last) - (1ULL << first);
+ }
+ 
+ static void Pull(Cpu *cpu, Lcd_Host *h)
+ {
+	uint64_t pages = Memory_Shown(cpu);
+	h->stale |= pages;
+	h->stale_hash |= pages;
+ }
+ 
+ /* CPU thread: compare the rows in VRAM pages stored to since the last look
+  * with shown and copy the ones that differ over it, and to copy as well
+  * if there is one; 0 if none did */
+ static int Diff(Cpu *cpu, Lcd_Host *h, Lcd_Rows *r, unsigned char *copy)
+ {
+	const unsigned char *vram = cpu->mem->ram;  //VRAM is the start of RAM
+	unsigned int row;
+	size_t off;
+	
+	Pull(cpu, h);
+	memset(r->bits, 0, sizeof(r->bits));
+	r->top = LCD_HEIGHT;
+	r->bottom = 0;
+	for (row = 0; h->stale && row < LCD_HEIGHT; ++row) {
+		off = (size_t)row * LCD_ROW;
+		if (!(h->stale & Row_Pages(row)) || !memcmp(h->shown + off, vram + off, LCD_ROW))  //stores of what was already there count as nothing
+			continue;
+		memcpy(h->shown + off, vram + off, LCD_ROW);
+		if (copy)
+			memcpy(copy + off, vram + off, LCD_ROW);
+		r->bits[row >> 6] |= 1ULL << (row & 63);
+		if (row < r->top)
+			r->top = row;
+		r->bottom = row + 1;
+	}
+	h->stale = 0;
+	return r->bottom != 0;
+ }
+ 
+ static void Show(Lcd_Host *h, const Lcd_Rows *r, const unsigned char *vram)  //convert the rows in r into rgba
+ {
+	unsigned int row;
+	for (row = r->top; row < r->bottom; ++row)
+		if (r->bits[row >> 6] >> (row & 63) & 1)
+			Convert(h->rgba + row * LCD_WIDTH, vram + (size_t)row * LCD_ROW, LCD_WIDTH);
+	h->top = r->top;
+	h->bottom = r->bottom;
+ }
+ 
+ /* with a companion the CPU thread only copies the rows that changed into
+  * a spare frame; if the companion is still busy with all of them the
+  * rows stay stale and go with the next frame */
+ static void Post(Cpu *cpu, Lcd_Host *h)
+ {
+	Lcd_Frame *f = h->spare;
+	Spsc_Msg m;
+	
+	if (!f && Spsc_Pop(h->frames, &m))
+		f = m.data;
+	h->spare = f;
+	if (!f || !Companion_Room(cpu)) {
+		++h->dropped;
+		return;
+	}
+	if (!Diff(cpu, h, &f->rows, f->vram)) {
+		++h->skipped;
+		return;
+	}
+	h->spare = 0;
+	Companion_Post(cpu, COMPANION_FRAME, 0, f);
+ }
+ 
+ static void Show_Frame(Cpu *cpu, const Spsc_Msg *m, void *opaque)  //companion thread
+ {
+	Lcd_Host *h = opaque;
+	Lcd_Frame *f = m->data;
+	Show(h, &f->rows, f->vram);
+	h->refresh(cpu, h->opaque);
+	Spsc_Push(h->frames, 0, 0, f);  //there is room for all of them
+ }
+ 
+ static void Schedule(Cpu *cpu, Lcd *l)
+ {
+	Sched_Add(cpu, &l->frame, l->epoch + (l->frames + 1) * CPU_HZ / LCD_HZ);
+ }
+ 
+ static void Frame(Cpu *cpu, void *opaque)
+ {
+	Lcd *l = opaque;
+	Lcd_Rows r;
+	
+	++l->frames;
+	if (l->host.refresh && l->host.frames && cpu->companion)
+		Post(cpu, &l->host);
+	else if (l->host.refresh) {  //no companion, or not any more
+		if (Diff(cpu, &l->host, &r, 0)) {
+			Show(&l->host, &r, l->host.shown);
+			l->host.refresh(cpu, l->host.opaque);
+		} else
+			++l->host.skipped;
+	}
+	Schedule(cpu, l);
+ }
+ 
+ int Lcd_Init(Cpu *cpu)
+ {
+	Lcd *l = calloc(1, sizeof(Lcd));
+	if (!l)
+		return 0;
+	l->frame.fn = Frame;
+	l->frame.opaque = l;
+	l->host.stale = l->host.stale_hash = ALL_PAGES;
+	cpu->lcd = l;
+	return 1;
+ }
+ 
+ void Lcd_Free(Cpu *cpu)
+ {
+	Spsc_Msg m;
+	
+	if (cpu->lcd) {  //after Companion_Stop(), so every frame is back
+		if (cpu->lcd->host.frames) {
+			while (Spsc_Pop(cpu->lcd->host.frames, &m))
+				free(m.data);
+			Spsc_Free(cpu->lcd->host.frames);
+		}
+		free(cpu->lcd->host.spare);
+		free(cpu->lcd->host.rgba);
+		free(cpu->lcd->host.shown);
+		free(cpu->lcd->host.row_hash);
+	}
+	free(cpu->lcd);
+	cpu->lcd = 0;
+ }
+ 
+ void Lcd_Reset(Cpu *cpu)  //after Sched_Reset()
+ {
+	Lcd *l = cpu->lcd;
+	l->frames = 0;
+	l->epoch = cpu->cycles;
+	Schedule(cpu, l);
+ }
+ 
+ int Lcd_Attach(Cpu *cpu, Lcd_Refresh refresh, void *opaque)
+ {
+	Lcd_Host *h = &cpu->lcd->host;
+	unsigned int i;
+	
+	if (refresh && !h->rgba) {  //black, as converted from zeros; the first frame catches up with VRAM
+		if (!(h->shown = calloc(LCD_HEIGHT, LCD_ROW)) || !(h->rgba = malloc(LCD_WIDTH * LCD_HEIGHT * sizeof(uint32_t)))) {
+			free(h->shown);
+			h->shown = 0;
+			return 0;
+		}
+		for (i = 0; i < LCD_WIDTH * LCD_HEIGHT; ++i)
+			h->rgba[i] = 0xff000000;
+		h->stale = ALL_PAGES;
+	}
+	if (refresh && cpu->companion && !h->frames) {
+		if (!(h->frames = Spsc_New(LCD_FRAMES)))
+			return 0;
+		for (i = 0; i < LCD_FRAMES; ++i) {  //handed over before the companion sees the first one
+			Lcd_Frame *f = malloc(sizeof(Lcd_Frame));
+			if (!f || !Spsc_Push(h->frames, 0, 0, f)) {
+				free(f);
+				break;
+			}
+		}
+		Companion_Handle(cpu, COMPANION_FRAME, Show_Frame, h);
+	}
+	h->refresh = refresh;
+	h->opaque = opaque;
+	return 1;
+ }
+ 
+ static uint64_t Hash_Row(const unsigned char *p)  //FNV-1a
+ {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	unsigned int i;
+	for (i = 0; i < LCD_ROW; ++i) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+ }
+ 
+ /* FNV-1a over the row hashes, so rows nobody stored to keep theirs */
+ uint64_t Lcd_Hash(Cpu *cpu)
+ {
+	Lcd_Host *h = &cpu->lcd->host;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	unsigned int row;
+	
+	if (!h->row_hash && !(h->row_hash = malloc(LCD_HEIGHT * sizeof(uint64_t))))
+		return 0;
+	Pull(cpu, h);
+	for (row = 0; row < LCD_HEIGHT; ++row) {
+		if (h->stale_hash & Row_Pages(row))
+			h->row_hash[row] = Hash_Row(cpu->mem->ram + (size_t)row * LCD_ROW);
+		hash ^= h->row_hash[row];
+		hash *= 0x100000001b3ULL;
+	}
+	h->stale_hash = 0;
+	return hash;
+ }
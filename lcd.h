@@ -0,0 +1,95 @@
+/* =====================================================================
+ * lcd.h
+ * provides the display refresh
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #ifndef LCD_H
+ #define LCD_H
+ 
+ #include "registers.h"
+ #include "sched.h"
+ #include "spsc.h"
+ 
+ #define LCD_HZ 60
+ #define LCD_WIDTH 384
+ #define LCD_HEIGHT 216
+ #define LCD_ROW (LCD_WIDTH * 2)   //bytes of VRAM per row
+ 
+ #define LCD_FRAMES 4              //frames on their way to a companion at once; power of 2
+ 
+ typedef void (*Lcd_Refresh)(Cpu *cpu, void *opaque);
+ 
+ typedef struct
+ {
+	uint64_t bits[(LCD_HEIGHT + 63) / 64];
+	unsigned int top, bottom;      //[top, bottom) holds them all
+ } Lcd_Rows;
+ 
+ typedef struct
+ {
+	Lcd_Rows rows;
+	unsigned char vram[LCD_HEIGHT * LCD_ROW];  //only the rows in rows are current
+ } Lcd_Frame;
+ 
+ /* the screen as the host sees it, which is no part of the machine, so
+  * snapshots leave it alone.  rgba is kept up to date a row at a time:
+  * only rows in VRAM pages stored to since the last look (memory.h) are
+  * compared with the copy they were converted from, and only the ones
+  * that differ are converted again.  Row hashes are kept up the same way.
+  *
+  * If a companion (companion.h) is running when refresh is attached, only
+  * the compare and a copy of the changed rows stay on the CPU thread;
+  * converting them and refresh itself run on the companion, and refresh
+  * must only look at rgba, top and bottom.  Attach once, before running */
+ typedef struct
+ {
+	Lcd_Refresh refresh;           //0 when nothing is watching, e.g. batch runs
+	void *opaque;
+	uint32_t *rgba;                //0xffRRGGBB host words, LCD_WIDTH * LCD_HEIGHT
+	unsigned char *shown;          //VRAM as rgba was converted from
+	unsigned int top, bottom;      //rows [top, bottom) of rgba changed in the frame being passed on
+	uint64_t skipped;              //frames with nothing changed, not passed on
+	uint64_t *row_hash;            //0 until Lcd_Hash()
+	uint64_t stale, stale_hash;    //VRAM pages stored to since rgba / row_hash were brought up to date
+	Spsc *frames;                  //companion back to CPU thread: frames it is done with; 0 without one
+	Lcd_Frame *spare;              //one the CPU thread has out of frames
+	uint64_t dropped;              //frames the companion was too far behind for
+ } Lcd_Host;
+ 
+ /* the panel's own refresh.  Add-ins push VRAM to the controller
+  * themselves, so there is nothing here the guest can see; the frame event
+  * is where a front end picks VRAM up, at the rate the real screen does */
+ typedef struct Lcd
+ {
+	uint64_t frames;
+	uint64_t epoch;                //cycle of frame 0
+	Event frame;
+	Lcd_Host host;
+ } Lcd;
+ 
+ int Lcd_Init(Cpu *cpu);           //returns 0 if out of memory
+ void Lcd_Free(Cpu *cpu);
+ void Lcd_Reset(Cpu *cpu);
+ int Lcd_Attach(Cpu *cpu, Lcd_Refresh refresh, void *opaque);  //call refresh once per frame that changed from now on; 0 if out of memory
+ uint64_t Lcd_Hash(Cpu *cpu);      //of what VRAM holds now, rehashing only rows stored to since the last call
+ 
+ #endif
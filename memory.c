@@ -0,0 +1,688 @@
+/* =====================================================================
+ * memory.c
+ * provides the guest page table, RAM and the MMIO slow path
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #include <stdio.h>
+ #include <stdlib.h>
+ #include <fcntl.h>
+ #include <unistd.h>
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include "memory.h"
+ #include "mmu.h"
+ #include "block.h"
+ #if defined(__SSSE3__)
+ #include <immintrin.h>
+ #endif
+ 
+ 
+ static unsigned int Add_Region(Memory *mem, uint32_t base, uint32_t size, IO_Read_Handler rd, IO_Write_Handler wr, void *opaque, const char *name)
+ {
+	Region *r;
+	if (mem->region_count == MAX_REGIONS) {
+		fprintf(stderr, "memory: too many regions, %s not mapped\n", name);
+		return 0;
+	}
+	r = &mem->regions[mem->region_count];
+	memset(r, 0, sizeof(*r));
+	r->base = base;
+	r->size = size;
+	r->rd = rd;
+	r->wr = wr;
+	r->opaque = opaque;
+	r->name = name;
+	return mem->region_count++;
+ }
+ 
+ #define NO_PAGE 0xffffffff
+ 
+ static uint32_t Store_Page(Memory *mem, const unsigned char *host)  //number of the store page at host, NO_PAGE if it isn't one
+ {
+	unsigned int i;
+	for (i = 0; i < mem->store_count; ++i)
+		if ((uintptr_t)host - (uintptr_t)mem->stores[i].host < (uintptr_t)mem->stores[i].pages << PAGE_SHIFT)
+			return mem->stores[i].first + (uint32_t)(((uintptr_t)host - (uintptr_t)mem->stores[i].host) >> PAGE_SHIFT);
+	return NO_PAGE;
+ }
+ 
+ static int Clean(Memory *mem, const unsigned char *host)  //a store page not written since Memory_Clean()
+ {
+	uint32_t page = Store_Page(mem, host);
+	return page != NO_PAGE && !(mem->dirty_bits[page >> 6] >> (page & 63) & 1);
+ }
+ 
+ static int Shown(Memory *mem, const unsigned char *host)  //a VRAM page not stored to since Memory_Shown()
+ {
+	uintptr_t page = ((uintptr_t)host - (uintptr_t)mem->ram) >> PAGE_SHIFT;
+	return page < VRAM_PAGES && !(mem->drawn >> page & 1);
+ }
+ 
+ static int Add_Store(Cpu *cpu, unsigned char *host, uint32_t size, int image, const char *name);
+ 
+ void Memory_Map(Cpu *cpu, uint32_t base, uint32_t size, unsigned char *host, int writable, const char *name)
+ {
+	uint32_t off;
+	unsigned int region = Add_Region(cpu->mem, base, size, 0, 0, 0, name);
+	unsigned char flags;
+	
+	if (region)
+		cpu->mem->regions[region].host = host;
+	for (off = 0; off < size; off += PAGE_SIZE) {
+		flags = 0;  //a new alias of a watched page is watched too
+		if (writable && Clean(cpu->mem, host + off))
+			flags |= PAGE_CLEAN;
+		if (writable && Shown(cpu->mem, host + off))
+			flags |= PAGE_SHOWN;
+		cpu->page_read[PAGE_INDEX(base + off)] = host + off;
+		cpu->page_write[PAGE_INDEX(base + off)] = writable && !flags ? host + off : 0;
+		cpu->mem->page_flags[PAGE_INDEX(base + off)] = flags;
+ #ifdef MEMORY_STATS
+		cpu->mem->page_region[PAGE_INDEX(base + off)] = region;
+ #endif
+	}
+	(void)region;
+ }
+ 
+ void Memory_Map_IO(Cpu *cpu, uint32_t base, uint32_t size, IO_Read_Handler rd, IO_Write_Handler wr, void *opaque, const char *name)
+ {
+	uint32_t off;
+	unsigned int region = Add_Region(cpu->mem, base, size, rd, wr, opaque, name);
+	
+	for (off = 0; off < size; off += PAGE_SIZE) {  //make sure nothing fast-paths over the registers
+		cpu->page_read[PAGE_INDEX(base + off)] = 0;
+		cpu->page_write[PAGE_INDEX(base + off)] = 0;
+		cpu->mem->page_flags[PAGE_INDEX(base + off)] = 0;
+ #ifdef MEMORY_STATS
+		cpu->mem->page_region[PAGE_INDEX(base + off)] = region;
+ #endif
+	}
+	(void)region;
+ }
+ 
+ int Memory_Init(Cpu *cpu)
+ {
+	Memory *mem = calloc(1, sizeof(Memory));
+	
+	/* the page tables are 4MB each on a 32 bit host and 8MB on 64 bit, but
+	 * calloc'd memory is only backed once touched and only a few hundred
+	 * entries ever are */
+	cpu->page_read = calloc(PAGE_COUNT, sizeof(unsigned char *));
+	cpu->page_write = calloc(PAGE_COUNT, sizeof(unsigned char *));
+	cpu->mem = mem;
+	if (!mem || !cpu->page_read || !cpu->page_write || !(mem->ram = calloc(1, RAM_SIZE))
+		|| !(mem->page_flags = calloc(PAGE_COUNT, 1))) {
+		Memory_Free(cpu);
+		return 0;
+	}
+	mem->regions[0].name = "unmapped";
+	mem->region_count = 1;
+	mem->drawn = (1ULL << VRAM_PAGES) - 1;  //nothing has been shown yet
+	Memory_Map(cpu, RAM_BASE, RAM_SIZE, mem->ram, 1, "RAM");
+	Memory_Map(cpu, RAM_BASE + P2_ALIAS, RAM_SIZE, mem->ram, 1, "RAM (P2)");
+	if (!Add_Store(cpu, mem->ram, RAM_SIZE, 0, "RAM")) {
+		Memory_Free(cpu);
+		return 0;
+	}
+	return 1;
+ }
+ 
+ void Memory_Free(Cpu *cpu)
+ {
+	unsigned int i;
+	Memory *mem = cpu->mem;
+	
+	if (mem) {
+		for (i = 0; i < mem->region_count; ++i)
+			if (mem->regions[i].unmap)
+				munmap(mem->regions[i].unmap, mem->regions[i].unmap_size);
+		free(mem->ram);
+		free(mem->page_flags);
+		free(mem->dirty);
+		free(mem->dirty_bits);
+		free(mem);
+	}
+	free(cpu->page_read);
+	free(cpu->page_write);
+	cpu->mem = 0;
+	cpu->page_read = cpu->page_write = 0;
+ }
+ 
+ /* images are mmap'd rather than read so every instance running the same
+  * ROM shares one copy in the host page cache, and nothing is read from
+  * disk until the guest touches it; the flash is MAP_PRIVATE so pages the
+  * guest writes get copied for this instance only and the file is never
+  * modified */
+ static unsigned char *Map_File(const char *path, int writable, uint32_t max, uint32_t *size)
+ {
+	struct stat st;
+	void *p;
+	int fd = open(path, O_RDONLY);
+	
+	if (fd < 0) {
+		perror(path);
+		return 0;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		fprintf(stderr, "memory: can't size %s\n", path);
+		close(fd);
+		return 0;
+	}
+	*size = (unsigned long)st.st_size < max ? (uint32_t)st.st_size : max;
+	p = mmap(0, *size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);  //the mapping keeps its own reference
+	if (p == MAP_FAILED) {
+		perror(path);
+		return 0;
+	}
+	*size = (*size + PAGE_MASK) & ~(uint32_t)PAGE_MASK;  //a partial last page reads as zeros past the end
+	return p;
+ }
+ 
+ static int Load_Image(Cpu *cpu, const char *path, uint32_t base, int writable, const char *name, const char *p2_name)
+ {
+	uint32_t size;
+	unsigned char *p = Map_File(path, writable, ROM_BASE + ROM_SIZE - base, &size);
+	Region *r;
+	
+	if (!p)
+		return 0;
+	Memory_Map(cpu, base, size, p, writable, name);
+	r = &cpu->mem->regions[cpu->mem->region_count - 1];
+	r->unmap = p;
+	r->unmap_size = size;
+	Memory_Map(cpu, base + P2_ALIAS, size, p, writable, p2_name);
+	return !writable || Add_Store(cpu, p, size, 1, name);
+ }
+ 
+ int Memory_Load_ROM(Cpu *cpu, const char *path)
+ {
+	return Load_Image(cpu, path, ROM_BASE, 0, "ROM", "ROM (P2)");
+ }
+ 
+ int Memory_Load_Flash(Cpu *cpu, const char *path)
+ {
+	return Load_Image(cpu, path, FLASH_BASE, 1, "flash", "flash (P2)");
+ }
+ 
+ /* the two areas the OS would give an add-in through the TLB are put
+  * straight in the page table instead, standing in for the OS's TLB setup
+  * when an add-in is started without booting it; the data area borrows the
+  * top of physical RAM.  The MMU only ever fills page table entries that
+  * are empty, so these always win over whatever the UTLB holds */
+ int Memory_Load_Addin(Cpu *cpu, const char *path)
+ {
+	uint32_t size;
+	unsigned char *p = Map_File(path, 1, G3A_HEADER + ADDIN_MAX, &size);
+	Region *r;
+	
+	if (!p)
+		return 0;
+	if (size <= G3A_HEADER) {
+		fprintf(stderr, "memory: %s is too short for a g3a\n", path);
+		munmap(p, size);
+		return 0;
+	}
+	Memory_Map(cpu, ADDIN_BASE, size - G3A_HEADER, p + G3A_HEADER, 1, "add-in");
+	r = &cpu->mem->regions[cpu->mem->region_count - 1];
+	r->unmap = p;
+	r->unmap_size = size;
+	Memory_Map(cpu, ADDIN_RAM, ADDIN_RAM_SIZE, cpu->mem->ram + RAM_SIZE - ADDIN_RAM_SIZE, 1, "add-in RAM");
+	return Add_Store(cpu, p + G3A_HEADER, size - G3A_HEADER, 1, "add-in");
+ }
+ 
+ static Region *Find(Memory *mem, uint32_t addr)  //slow path only; there are only a handful of regions
+ {
+	unsigned int i;
+	for (i = mem->region_count - 1; i > 0; --i)  //latest mapping wins, same as the page table
+		if (addr - mem->regions[i].base < mem->regions[i].size)
+			return &mem->regions[i];
+	return &mem->regions[0];
+ }
+ 
+ static Code_Page *Code_Find(Memory *mem, const unsigned char *host, int add)  //host is a page base
+ {
+	unsigned int i = (unsigned int)((uintptr_t)host >> PAGE_SHIFT) * 2654435761u >> 20 & (CODE_PAGES - 1);
+	Code_Page *c;
+	for (;; i = (i + 1) & (CODE_PAGES - 1)) {
+		c = &mem->code[i];
+		if (c->host == host)
+			return c;
+		if (!c->host)
+			break;
+	}
+	if (!add || mem->code_count >= CODE_PAGES / 4 * 3)
+		return 0;
+	c->host = (unsigned char *)host;
+	++mem->code_count;
+	return c;
+ }
+ 
+ /* every guest page mapping host is one of the regions or a page the MMU
+  * filled in; set or clear flag on all the writable ones, taking
+  * page_write away while any PAGE_GUARDED flag is left */
+ static void Protect(Cpu *cpu, unsigned char *host, unsigned char flag, int protect)
+ {
+	Memory *mem = cpu->mem;
+	uint32_t pages[MAX_REGIONS + MMU_CACHE_SIZE], page;
+	unsigned char *flags;
+	unsigned int i, n = 0;
+	
+	for (i = 1; i < mem->region_count; ++i) {
+		Region *r = &mem->regions[i];
+		if (r->host && (uintptr_t)host - (uintptr_t)r->host < r->size)
+			pages[n++] = PAGE_INDEX(r->base + (uint32_t)((uintptr_t)host - (uintptr_t)r->host));
+	}
+	for (i = 0; cpu->mmu && i < MMU_CACHE_SIZE; ++i)
+		if (cpu->mmu->cached[i] != MMU_EMPTY)
+			pages[n++] = cpu->mmu->cached[i];
+	for (i = 0; i < n; ++i) {
+		page = pages[i];
+		flags = &mem->page_flags[page];
+		if (cpu->page_read[page] != host)
+			continue;
+		if (protect && (cpu->page_write[page] == host || (*flags & PAGE_GUARDED))) {
+			cpu->page_write[page] = 0;
+			*flags |= flag;
+		} else if (!protect && (*flags & flag)) {
+			*flags &= ~flag;
+			if (!(*flags & PAGE_GUARDED))
+				cpu->page_write[page] = host;
+		}
+	}
+ }
+ 
+ /* RAM and the writable images are stores from the moment they are mapped,
+  * so the first snapshot knows which of their pages are still as loaded */
+ static int Add_Store(Cpu *cpu, unsigned char *host, uint32_t size, int image, const char *name)
+ {
+	Memory *mem = cpu->mem;
+	uint32_t pages = size >> PAGE_SHIFT, total = mem->store_pages + pages, off;
+	uint32_t *dirty = 0;
+	uint64_t *bits = 0;
+	Store *s;
+	
+	if (mem->store_count == MAX_STORES || !(dirty = realloc(mem->dirty, total * sizeof(uint32_t)))
+		|| !(bits = realloc(mem->dirty_bits, (total + 63) / 64 * sizeof(uint64_t)))) {
+		if (dirty)
+			mem->dirty = dirty;
+		fprintf(stderr, "memory: can't keep track of %s for snapshots\n", name);
+		return 0;
+	}
+	memset(bits + (mem->store_pages + 63) / 64, 0, ((total + 63) / 64 - (mem->store_pages + 63) / 64) * sizeof(uint64_t));
+	mem->dirty = dirty;
+	mem->dirty_bits = bits;
+	s = &mem->stores[mem->store_count++];
+	s->host = host;
+	s->pages = pages;
+	s->first = mem->store_pages;
+	s->image = image;
+	mem->store_pages = total;
+	for (off = 0; off < size; off += PAGE_SIZE)
+		Protect(cpu, host + off, PAGE_CLEAN, 1);
+	return 1;
+ }
+ 
+ int Memory_Code(Cpu *cpu, uint32_t start, uint32_t end)
+ {
+	uint32_t addr, stop, page, line;
+	unsigned char *host;
+	Code_Page *c;
+	
+	for (addr = start; addr < end; addr = stop) {
+		page = PAGE_INDEX(addr);
+		host = cpu->page_read[page];
+		stop = (addr | PAGE_MASK) + 1;
+		if (stop == 0 || stop > end)
+			stop = end;
+		if (!host || !(cpu->page_write[page] || (cpu->mem->page_flags[page] & PAGE_GUARDED)))
+			continue;  //ROM, MMIO or nothing: there's no writing over it
+		if (!(c = Code_Find(cpu->mem, host, 1)))
+			return 0;
+		for (line = (addr & PAGE_MASK) / CODE_LINE; line <= ((stop - 1) & PAGE_MASK) / CODE_LINE; ++line)
+			c->lines[line >> 6] |= 1ULL << (line & 63);
+		if (!(cpu->mem->page_flags[page] & PAGE_CODE))  //first code on the page, at least through this mapping
+			Protect(cpu, host, PAGE_CODE, 1);
+	}
+	return 1;
+ }
+ 
+ void Memory_Uncode(Cpu *cpu)
+ {
+	Memory *mem = cpu->mem;
+	unsigned int i;
+	if (!mem->code_count)
+		return;
+	for (i = 0; i < CODE_PAGES; ++i)
+		if (mem->code[i].host)
+			Protect(cpu, mem->code[i].host, PAGE_CODE, 0);
+	memset(mem->code, 0, sizeof(mem->code));
+	mem->code_count = 0;
+ }
+ 
+ int Memory_Code_Line(Cpu *cpu, uint32_t addr)
+ {
+	unsigned char *host = cpu->page_read[PAGE_INDEX(addr)];
+	Code_Page *c = host ? Code_Find(cpu->mem, host, 0) : 0;
+	uint32_t line = (addr & PAGE_MASK) / CODE_LINE;
+	return c && (c->lines[line >> 6] >> (line & 63) & 1);
+ }
+ 
+ int Memory_Overlaps(Cpu *cpu, uint32_t start, uint32_t end, const unsigned char *host, uint32_t bytes)
+ {
+	uint32_t addr, stop;
+	uintptr_t from, to;
+	
+	for (addr = start; addr < end; addr = stop) {
+		const unsigned char *p = cpu->page_read[PAGE_INDEX(addr)];
+		stop = (addr | PAGE_MASK) + 1;
+		if (stop == 0 || stop > end)
+			stop = end;
+		if (!p)
+			return 1;  //page gone from the table since, e.g. an evicted translation; can't tell, so yes
+		from = (uintptr_t)p + (addr & PAGE_MASK);
+		to = (uintptr_t)p + ((stop - 1) & PAGE_MASK) + 1;
+		if (from < (uintptr_t)host + bytes && (uintptr_t)host < to)
+			return 1;
+	}
+	return 0;
+ }
+ 
+ static void Guarded_Write(Cpu *cpu, uint32_t addr, uint32_t value, int size)  //store into a page blocks were decoded from, or a watched one
+ {
+	unsigned char *p = cpu->page_read[PAGE_INDEX(addr)] + (addr & PAGE_MASK & ~(size - 1));
+	uint32_t l;
+	uint16_t w;
+	
+	if (size == 4) {
+		l = SWAP32(value);
+		memcpy(p, &l, 4);
+	} else if (size == 2) {
+		w = SWAP16((uint16_t)value);
+		memcpy(p, &w, 2);
+	} else
+		*p = (unsigned char)value;
+	if (Memory_Code_Line(cpu, addr))
+		Block_Invalidate_Host(cpu, p, size);
+ }
+ 
+ static void Dirty(Cpu *cpu, unsigned char *host)  //first store to a clean page
+ {
+	Memory *mem = cpu->mem;
+	uint32_t page = Store_Page(mem, host);
+	if (page != NO_PAGE && !(mem->dirty_bits[page >> 6] >> (page & 63) & 1)) {
+		mem->dirty_bits[page >> 6] |= 1ULL << (page & 63);
+		mem->dirty[mem->dirty_count++] = page;
+	}
+	Protect(cpu, host, PAGE_CLEAN, 0);
+ }
+ 
+ static void Drawn(Cpu *cpu, unsigned char *host)  //first store to a VRAM page since the LCD looked
+ {
+	cpu->mem->drawn |= 1ULL << (((uintptr_t)host - (uintptr_t)cpu->mem->ram) >> PAGE_SHIFT);
+	Protect(cpu, host, PAGE_SHOWN, 0);
+ }
+ 
+ uint64_t Memory_Shown(Cpu *cpu)
+ {
+	Memory *mem = cpu->mem;
+	uint64_t drawn = mem->drawn;
+	uint32_t page;
+	for (page = 0; page < VRAM_PAGES; ++page)
+		if (drawn >> page & 1)
+			Protect(cpu, mem->ram + ((uintptr_t)page << PAGE_SHIFT), PAGE_SHOWN, 1);
+	mem->drawn = 0;
+	return drawn;
+ }
+ 
+ void Memory_Clean(Cpu *cpu)
+ {
+	Memory *mem = cpu->mem;
+	uint32_t i, page;
+	for (i = 0; i < mem->dirty_count; ++i) {
+		page = mem->dirty[i];
+		mem->dirty_bits[page >> 6] &= ~(1ULL << (page & 63));
+		Protect(cpu, Memory_Page(cpu, page), PAGE_CLEAN, 1);
+	}
+	mem->dirty_count = 0;
+ }
+ 
+ void Memory_Dirty(Cpu *cpu, uint32_t page)
+ {
+	unsigned char *host = Memory_Page(cpu, page);
+	if (host && (cpu->mem->dirty_bits[page >> 6] >> (page & 63) & 1) == 0)
+		Dirty(cpu, host);
+ }
+ 
+ static Store *Store_Of(Memory *mem, uint32_t page)
+ {
+	unsigned int i;
+	for (i = 0; i < mem->store_count; ++i)
+		if (page - mem->stores[i].first < mem->stores[i].pages)
+			return &mem->stores[i];
+	return 0;
+ }
+ 
+ unsigned char *Memory_Page(Cpu *cpu, uint32_t page)
+ {
+	Store *s = Store_Of(cpu->mem, page);
+	return s ? s->host + ((uintptr_t)(page - s->first) << PAGE_SHIFT) : 0;
+ }
+ 
+ void Memory_Put_Page(Cpu *cpu, uint32_t page, const unsigned char *data)
+ {
+	Store *s = Store_Of(cpu->mem, page);
+	unsigned char *host;
+	
+	if (!s)
+		return;
+	host = s->host + ((uintptr_t)(page - s->first) << PAGE_SHIFT);
+	if (data)
+		memcpy(host, data, PAGE_SIZE);
+	else if (s->image)
+		madvise(host, PAGE_SIZE, MADV_DONTNEED);  //drops the private copy; the file shows through again
+	else
+		memset(host, 0, PAGE_SIZE);
+	if (Code_Find(cpu->mem, host, 0))
+		Block_Invalidate_Host(cpu, host, PAGE_SIZE);
+	if (Shown(cpu->mem, host))
+		Drawn(cpu, host);
+ }
+ 
+ uint32_t IO_Read(Cpu *cpu, uint32_t addr, int size)
+ {
+	Region *r = Find(cpu->mem, addr);
+	if (r->rd)
+		return r->rd(r->opaque, addr, size);
+	if (r == cpu->mem->regions && MMU_AREA(addr) && cpu->mmu)  //not in the page table yet, or never can be
+		return Mmu_Read(cpu, addr, size);
+	return 0;  //unmapped memory reads as zero
+ }
+ 
+ void IO_Write(Cpu *cpu, uint32_t addr, uint32_t value, int size)
+ {
+	Region *r;
+	unsigned char flags = cpu->mem->page_flags[PAGE_INDEX(addr)];
+	if (flags & PAGE_GUARDED) {
+		if (flags & PAGE_CLEAN)
+			Dirty(cpu, cpu->page_read[PAGE_INDEX(addr)]);
+		if (flags & PAGE_SHOWN)
+			Drawn(cpu, cpu->page_read[PAGE_INDEX(addr)]);
+		Guarded_Write(cpu, addr, value, size);
+		return;
+	}
+	r = Find(cpu->mem, addr);
+	if (r->wr)
+		r->wr(r->opaque, addr, value, size);
+	else if (r == cpu->mem->regions && MMU_AREA(addr) && cpu->mmu)
+		Mmu_Write(cpu, addr, value, size);
+	//writes to ROM and unmapped memory are dropped
+ }
+ 
+ /* copy bytes between guest and host byte order; the swap is its own
+  * inverse so this serves both directions.  With AVX2 a shuffle swaps 32
+  * bytes at once, with SSSE3 16 */
+ static void Swap_Copy(unsigned char *dst, const unsigned char *src, uint32_t bytes, int size)
+ {
+	uint32_t l;
+	uint16_t w;
+	
+	if (size == 1) {
+		memcpy(dst, src, bytes);
+		return;
+	}
+ #if defined(__AVX2__)
+	{
+		const __m256i mask = size == 4
+			? _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12)
+			: _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14, 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+		for (; bytes >= 32; bytes -= 32, src += 32, dst += 32)
+			_mm256_storeu_si256((__m256i *)dst, _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)src), mask));
+	}
+ #endif
+ #if defined(__SSSE3__)
+	{
+		const __m128i mask = size == 4
+			? _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12)
+			: _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+		for (; bytes >= 16; bytes -= 16, src += 16, dst += 16)
+			_mm_storeu_si128((__m128i *)dst, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), mask));
+	}
+ #endif
+	if (size == 4)
+		for (; bytes >= 4; bytes -= 4, src += 4, dst += 4) {
+			memcpy(&l, src, 4);
+			l = SWAP32(l);
+			memcpy(dst, &l, 4);
+		}
+	else
+		for (; bytes >= 2; bytes -= 2, src += 2, dst += 2) {
+			memcpy(&w, src, 2);
+			w = SWAP16(w);
+			memcpy(dst, &w, 2);
+		}
+ }
+ 
+ static uint32_t Chunk(uint32_t addr, uint32_t bytes)  //bytes left in the page addr is in, at most bytes
+ {
+	uint32_t left = PAGE_SIZE - (addr & PAGE_MASK);
+	return bytes < left ? bytes : left;
+ }
+ 
+ void Memory_Read_Block(Cpu *cpu, void *host, uint32_t addr, uint32_t count, int size)
+ {
+	unsigned char *to = host;
+	uint32_t bytes = count * size, n, i, v;
+	
+	for (; bytes; bytes -= n, addr += n, to += n) {
+		unsigned char *p = cpu->page_read[PAGE_INDEX(addr)];
+		n = Chunk(addr, bytes);
+		if (p) {
+			Swap_Copy(to, p + (addr & PAGE_MASK), n, size);
+ #ifdef MEMORY_STATS
+			cpu->mem->reads[cpu->mem->page_region[PAGE_INDEX(addr)]] += n / size;
+ #endif
+			continue;
+		}
+		for (i = 0; i < n; i += size) {
+			v = IO_Read(cpu, addr + i, size);
+			if (size == 4) memcpy(to + i, &v, 4);
+			else if (size == 2) { uint16_t w = (uint16_t)v; memcpy(to + i, &w, 2); }
+			else to[i] = (unsigned char)v;
+		}
+	}
+ }
+ 
+ void Memory_Write_Block(Cpu *cpu, uint32_t addr, const void *host, uint32_t count, int size)
+ {
+	const unsigned char *from = host;
+	uint32_t bytes = count * size, n, i, v;
+	
+	for (; bytes; bytes -= n, addr += n, from += n) {
+		unsigned char *p = cpu->page_write[PAGE_INDEX(addr)];
+		n = Chunk(addr, bytes);
+		if (p) {
+			Swap_Copy(p + (addr & PAGE_MASK), from, n, size);
+ #ifdef MEMORY_STATS
+			cpu->mem->writes[cpu->mem->page_region[PAGE_INDEX(addr)]] += n / size;
+ #endif
+			continue;
+		}
+		for (i = 0; i < n; i += size) {
+			if (size == 4) memcpy(&v, from + i, 4);
+			else if (size == 2) { uint16_t w; memcpy(&w, from + i, 2); v = w; }
+			else v = from[i];
+			IO_Write(cpu, addr + i, v, size);
+		}
+	}
+ }
+ 
+ /* both sides are guest byte order so this is a plain memmove a page at a
+  * time; stopping at MMIO lets the caller do those accesses one by one in
+  * the order the guest would have.  Overlap is only safe with dst <= src,
+  * which is what a forward copy loop does anyway */
+ uint32_t Memory_Copy(Cpu *cpu, uint32_t dst, uint32_t src, uint32_t bytes)
+ {
+	uint32_t done = 0, n;
+	
+	while (done < bytes) {
+		unsigned char *from = cpu->page_read[PAGE_INDEX(src + done)];
+		unsigned char *to = cpu->page_write[PAGE_INDEX(dst + done)];
+		if (!from || !to)
+			break;
+		n = Chunk(src + done, bytes - done);
+		n = Chunk(dst + done, n);
+		memmove(to + ((dst + done) & PAGE_MASK), from + ((src + done) & PAGE_MASK), n);
+ #ifdef MEMORY_STATS
+		cpu->mem->reads[cpu->mem->page_region[PAGE_INDEX(src + done)]] += n / 4;  //counted as long accesses
+		cpu->mem->writes[cpu->mem->page_region[PAGE_INDEX(dst + done)]] += n / 4;
+ #endif
+		done += n;
+	}
+	return done;
+ }
+ 
+ int Memory_Plain(Cpu *cpu, uint32_t addr, uint32_t bytes)
+ {
+	uint32_t page, last;
+	if (bytes == 0)
+		return 1;
+	last = PAGE_INDEX(addr + bytes - 1);
+	if (last < PAGE_INDEX(addr))  //wraps around the address space
+		return 0;
+	for (page = PAGE_INDEX(addr); page <= last; ++page)
+		if (!cpu->page_read[page])
+			return 0;
+	return 1;
+ }
+ 
+ #ifdef MEMORY_STATS
+ void Memory_Print_Stats(Cpu *cpu)
+ {
+	Memory *mem = cpu->mem;
+	unsigned int i;
+	for (i = 0; i < mem->region_count; ++i)
+		if (mem->reads[i] || mem->writes[i])
+			fprintf(stderr, "%-16s %08x  reads %llu  writes %llu\n", mem->regions[i].name, mem->regions[i].base,
+				mem->reads[i], mem->writes[i]);
+ }
+ #endif
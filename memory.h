@@ -0,0 +1,271 @@
+/* =====================================================================
+ * memory.h
+ * provides guest memory access for the SH4A core
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #ifndef MEMORY_H
+ #define MEMORY_H
+ 
+ #include <string.h>
+ #include "registers.h"
+ 
+ #define PAGE_SHIFT 12
+ #define PAGE_SIZE (1 << PAGE_SHIFT)
+ #define PAGE_MASK (PAGE_SIZE - 1)
+ #define PAGE_COUNT (1 << (32 - PAGE_SHIFT))   //4K pages covering the 32 bit address space
+ #define PAGE_INDEX(addr) ((uint32_t)(addr) >> PAGE_SHIFT)
+ 
+ /* guest memory is a flat table of host pointers, one per 4K page; RAM and
+  * ROM pages point straight at host memory so a load or store is a table
+  * lookup plus a byte swap, while MMIO and unmapped pages are 0 and go to
+  * the callbacks registered with Memory_Map_IO(); cpu->page_write is also 0
+  * for read only pages so stores to ROM end up on the slow path.  Pages of
+  * P0 and P3 are filled in by mmu.c the first time they are touched.  Each
+  * Cpu has its own tables */
+ 
+ typedef uint32_t (*IO_Read_Handler)(void *opaque, uint32_t addr, int size);
+ typedef void (*IO_Write_Handler)(void *opaque, uint32_t addr, uint32_t value, int size);
+ 
+ #define MAX_REGIONS 256
+ 
+ typedef struct
+ {
+	uint32_t base, size;
+	IO_Read_Handler rd;       //0 for RAM/ROM regions, they never reach the slow path for reads
+	IO_Write_Handler wr;
+	void *opaque;             //handed back to rd and wr, normally the peripheral's state
+	const char *name;
+	unsigned char *host;      //RAM/ROM regions: what base maps to, so code pages can find their aliases
+	void *unmap;              //mmap'd image to release with the instance, or 0
+	unsigned long unmap_size;
+ } Region;
+ 
+ /* self modifying code: once a block is decoded from a writable page, every
+  * guest page that maps the same host page loses its page_write pointer
+  * and gets PAGE_CODE, so stores there take the slow path.  Each such host
+  * page has a bitmap of the 32 byte lines blocks came from; a store to a
+  * marked line flushes just the blocks overlapping it, a store to the rest
+  * of the page only costs the trip through the slow path.  ROM never needs
+  * any of this, and pages with no code stay on the fast path */
+ #define PAGE_CODE 0x01
+ #define CODE_LINE 32
+ #define CODE_PAGES 4096          //host pages tracked at once; power of 2, the block cache is flushed when 3/4 full
+ 
+ typedef struct
+ {
+	unsigned char *host;      //page base, 0 if the slot is free
+	uint64_t lines[PAGE_SIZE / CODE_LINE / 64];
+ } Code_Page;
+ 
+ /* snapshots (snapshot.h) only copy the pages that changed.  All writable
+  * host memory, RAM and the copy-on-write images, is split into stores
+  * whose pages are numbered one after the other.  Memory_Clean() takes
+  * page_write away from every alias of them and sets PAGE_CLEAN; the first
+  * store to such a page goes through the slow path, which puts it on the
+  * dirty list and hands page_write back.  A page can be PAGE_CODE and
+  * PAGE_CLEAN at once and only gets page_write back when it is none of
+  * the PAGE_GUARDED ones */
+ #define PAGE_CLEAN 0x02
+ #define MAX_STORES 8
+ 
+ /* the LCD (lcd.h) only looks at VRAM pages stored to since it last
+  * looked.  Memory_Shown() hands over that set and sets PAGE_SHOWN on the
+  * pages in it, the same way as PAGE_CLEAN, so each page costs one slow
+  * store per frame at most and nothing until somebody asks */
+ #define PAGE_SHOWN 0x04
+ #define PAGE_GUARDED (PAGE_CODE | PAGE_CLEAN | PAGE_SHOWN)
+ 
+ typedef struct
+ {
+	unsigned char *host;
+	uint32_t pages;
+	uint32_t first;           //number of its first page
+	int image;                //mmap'd copy-on-write, so "as loaded" is the file; else RAM, which starts zeroed
+ } Store;
+ 
+ typedef struct Memory
+ {
+	Region regions[MAX_REGIONS];  //region 0 catches everything unmapped
+	unsigned int region_count;
+	unsigned char *ram;
+	unsigned char *page_flags;    //PAGE_* bits, one byte per guest page
+	Code_Page code[CODE_PAGES];   //open addressed on the host page
+	unsigned int code_count;
+	Store stores[MAX_STORES];
+	unsigned int store_count;
+	uint32_t store_pages;         //in all of them
+	uint32_t *dirty;              //pages written since Memory_Clean(), in order
+	uint32_t dirty_count;
+	uint64_t *dirty_bits;         //the same as a bitmap
+	uint64_t drawn;               //VRAM pages stored to since Memory_Shown(), bit per page of RAM from the start
+ #ifdef MEMORY_STATS
+	unsigned char page_region[PAGE_COUNT];
+	unsigned long long reads[MAX_REGIONS], writes[MAX_REGIONS];
+ #endif
+ } Memory;
+ 
+ //Prizm (fx-CG10/20) memory map; P1 is cached and P2 uncached, both see the same physical memory
+ #define ROM_BASE 0x80000000       //flash, 32MB
+ #define ROM_SIZE 0x02000000
+ #define FLASH_BASE 0x81000000     //storage memory half of the flash chip
+ #define RAM_BASE 0x88000000       //2MB
+ #define RAM_SIZE 0x00200000
+ #define P2_ALIAS 0x20000000       //P1 address + P2_ALIAS = the same memory uncached
+ #define VRAM_BASE 0xa8000000      //384x216 RGB565 frame buffer at the start of RAM
+ #define VRAM_SIZE (384 * 216 * 2)
+ #define VRAM_PAGES ((VRAM_SIZE + PAGE_MASK) >> PAGE_SHIFT)  //41, fits drawn
+ 
+ //add-ins see their code and data through fixed TLB entries set up by the OS
+ #define G3A_HEADER 0x7000         //bytes of header in a .g3a file before the code
+ #define ADDIN_BASE 0x00300000     //where the code after the header is mapped
+ #define ADDIN_MAX 0x00800000
+ #define ADDIN_RAM 0x08100000      //static data, heap and stack
+ #define ADDIN_RAM_SIZE 0x00080000
+ 
+ int Memory_Init(Cpu *cpu);        //allocate page tables and RAM and map it; returns 0 if out of memory
+ void Memory_Free(Cpu *cpu);
+ int Memory_Load_ROM(Cpu *cpu, const char *path);      //map an OS dump read only at ROM_BASE; returns 0 on failure
+ int Memory_Load_Flash(Cpu *cpu, const char *path);    //map a storage memory image copy-on-write at FLASH_BASE
+ int Memory_Load_Addin(Cpu *cpu, const char *path);    //map a .g3a copy-on-write at ADDIN_BASE plus its RAM
+ void Memory_Map(Cpu *cpu, uint32_t base, uint32_t size, unsigned char *host, int writable, const char *name);
+ void Memory_Map_IO(Cpu *cpu, uint32_t base, uint32_t size, IO_Read_Handler rd, IO_Write_Handler wr, void *opaque, const char *name);
+ 
+ /* bulk transfers; guest addresses must be aligned to size (1, 2 or 4) and
+  * host buffers hold values in host byte order.  RAM and ROM pages are done
+  * a page at a time with SIMD byte swapping when built for SSSE3 or AVX2
+  * (-march=native), MMIO one access at a time in address order */
+ void Memory_Read_Block(Cpu *cpu, void *host, uint32_t addr, uint32_t count, int size);         //guest to host
+ void Memory_Write_Block(Cpu *cpu, uint32_t addr, const void *host, uint32_t count, int size);  //host to guest
+ uint32_t Memory_Copy(Cpu *cpu, uint32_t dst, uint32_t src, uint32_t bytes);  //guest to guest, forward; bytes done before the first page that isn't plain memory
+ int Memory_Plain(Cpu *cpu, uint32_t addr, uint32_t bytes);  //1 if every page of the range reads straight from host memory
+ 
+ int Memory_Code(Cpu *cpu, uint32_t start, uint32_t end);  //a block was decoded from [start, end): write protect it; 0 if the table is full
+ void Memory_Uncode(Cpu *cpu);     //no blocks are left; hand every protected page its page_write back
+ int Memory_Code_Line(Cpu *cpu, uint32_t addr);  //1 if blocks were decoded from the line holding addr
+ int Memory_Overlaps(Cpu *cpu, uint32_t start, uint32_t end, const unsigned char *host, uint32_t bytes);  //guest range [start, end) may share bytes with the host range
+ 
+ void Memory_Clean(Cpu *cpu);      //empty the dirty list; the pages on it are watched for stores again
+ unsigned char *Memory_Page(Cpu *cpu, uint32_t page);  //host memory of store page number page
+ void Memory_Dirty(Cpu *cpu, uint32_t page);  //count it as written
+ uint64_t Memory_Shown(Cpu *cpu);  //VRAM pages stored to since the last call, which start being watched again
+ void Memory_Put_Page(Cpu *cpu, uint32_t page, const unsigned char *data);  //overwrite it, or put it back as loaded if data is 0; blocks decoded from it go
+ 
+ uint32_t IO_Read(Cpu *cpu, uint32_t addr, int size);                  //slow path
+ void IO_Write(Cpu *cpu, uint32_t addr, uint32_t value, int size);     //slow path
+ 
+ #ifdef MEMORY_STATS  //build with -DMEMORY_STATS for per region access counters
+ #define COUNT_READ(cpu, addr) (++(cpu)->mem->reads[(cpu)->mem->page_region[PAGE_INDEX(addr)]])
+ #define COUNT_WRITE(cpu, addr) (++(cpu)->mem->writes[(cpu)->mem->page_region[PAGE_INDEX(addr)]])
+ void Memory_Print_Stats(Cpu *cpu);
+ #else
+ #define COUNT_READ(cpu, addr) ((void)0)
+ #define COUNT_WRITE(cpu, addr) ((void)0)
+ #endif
+ 
+ #ifdef TRACE  //the address goes in the record of the instruction being traced, see trace.h
+ #define TRACE_ACCESS(cpu, addr) ((cpu)->trace_addr = (addr))
+ #else
+ #define TRACE_ACCESS(cpu, addr) ((void)0)
+ #endif
+ 
+ //the guest is big endian, every host we care about is little endian
+ #if defined(__GNUC__)
+ #define SWAP16(x) __builtin_bswap16(x)
+ #define SWAP32(x) __builtin_bswap32(x)
+ #else
+ #define SWAP16(x) ((uint16_t)(((x) >> 8) | ((x) << 8)))
+ #define SWAP32(x) ((((x) >> 24) & 0xff) | (((x) >> 8) & 0xff00) | (((x) & 0xff00) << 8) | ((x) << 24))
+ #endif
+ 
+ //fast paths are inline so a RAM access never leaves the calling routine
+ static inline int8_t Read_Byte(Cpu *cpu, uint32_t addr)
+ {
+	unsigned char *p = cpu->page_read[PAGE_INDEX(addr)];
+	COUNT_READ(cpu, addr);
+	TRACE_ACCESS(cpu, addr);
+	if (p)
+		return (int8_t)p[addr & PAGE_MASK];
+	return (int8_t)IO_Read(cpu, addr, 1);
+ }
+ 
+ static inline int16_t Read_Word(Cpu *cpu, uint32_t addr)
+ {
+	unsigned char *p = cpu->page_read[PAGE_INDEX(addr)];
+	uint16_t v;
+	COUNT_READ(cpu, addr);
+	TRACE_ACCESS(cpu, addr);
+	if (p) {
+		memcpy(&v, p + (addr & (PAGE_MASK & ~1)), 2);  //compiles to a single load
+		return (int16_t)SWAP16(v);
+	}
+	return (int16_t)IO_Read(cpu, addr, 2);
+ }
+ 
+ static inline uint32_t Read_Long(Cpu *cpu, uint32_t addr)
+ {
+	unsigned char *p = cpu->page_read[PAGE_INDEX(addr)];
+	uint32_t v;
+	COUNT_READ(cpu, addr);
+	TRACE_ACCESS(cpu, addr);
+	if (p) {
+		memcpy(&v, p + (addr & (PAGE_MASK & ~3)), 4);
+		return SWAP32(v);
+	}
+	return IO_Read(cpu, addr, 4);
+ }
+ 
+ static inline void Write_Byte(Cpu *cpu, uint32_t addr, uint8_t value)
+ {
+	unsigned char *p = cpu->page_write[PAGE_INDEX(addr)];
+	COUNT_WRITE(cpu, addr);
+	TRACE_ACCESS(cpu, addr);
+	if (p)
+		p[addr & PAGE_MASK] = value;
+	else
+		IO_Write(cpu, addr, value, 1);
+ }
+ 
+ static inline void Write_Word(Cpu *cpu, uint32_t addr, uint16_t value)
+ {
+	unsigned char *p = cpu->page_write[PAGE_INDEX(addr)];
+	COUNT_WRITE(cpu, addr);
+	TRACE_ACCESS(cpu, addr);
+	if (p) {
+		value = SWAP16(value);
+		memcpy(p + (addr & (PAGE_MASK & ~1)), &value, 2);
+	} else
+		IO_Write(cpu, addr, value, 2);
+ }
+ 
+ static inline void Write_Long(Cpu *cpu, uint32_t addr, uint32_t value)
+ {
+	unsigned char *p = cpu->page_write[PAGE_INDEX(addr)];
+	COUNT_WRITE(cpu, addr);
+	TRACE_ACCESS(cpu, addr);
+	if (p) {
+		value = SWAP32(value);
+		memcpy(p + (addr & (PAGE_MASK & ~3)), &value, 4);
+	} else
+		IO_Write(cpu, addr, value, 4);
+ }
+ 
+ #endif
@@ -0,0 +1,338 @@
+/* =====================================================================
+ * mmu.c
+ * provides the SH4A MMU: UTLB, ITLB and the translation cache
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #include <stdlib.h>
+ #include <setjmp.h>
+ #include "registers.h"
+ #include "memory.h"
+ #include "block.h"
+ #include "mmu.h"
+ 
+ #define P1_BASE 0x80000000        //physical memory as the page table already has it
+ #define P2_BASE 0xa0000000
+ 
+ static const uint32_t Tlb_Sizes[4] = { 0x400, 0x1000, 0x10000, 0x100000 };
+ #define TLB_SIZE(lo) Tlb_Sizes[((lo) >> 6 & 2) | ((lo) >> 4 & 1)]  //SZ1:SZ0 -> 1K, 4K, 64K, 1M
+ 
+ static void Uncache(Cpu *cpu, uint32_t page)  //take one translated page back out of the page table
+ {
+	uint32_t *slot = &cpu->mmu->cached[page & (MMU_CACHE_SIZE - 1)];
+	if (*slot != page)
+		return;
+	cpu->page_read[page] = 0;
+	cpu->page_write[page] = 0;
+	cpu->mem->page_flags[page] &= ~PAGE_GUARDED;
+	*slot = MMU_EMPTY;
+ }
+ 
+ static void Uncache_All(Cpu *cpu)
+ {
+	unsigned int i;
+	for (i = 0; i < MMU_CACHE_SIZE; ++i)
+		if (cpu->mmu->cached[i] != MMU_EMPTY)
+			Uncache(cpu, cpu->mmu->cached[i]);
+ }
+ 
+ static void Drop_Entry(Cpu *cpu, const Tlb_Entry *t)  //an entry is about to change; nothing filled from it may stay
+ {
+	uint32_t size = TLB_SIZE(t->lo), base = t->hi & ~(size - 1), page;
+	if (!(t->lo & TLB_V))
+		return;
+	for (page = PAGE_INDEX(base); page <= PAGE_INDEX(base + size - 1); ++page)
+		Uncache(cpu, page);
+	Block_Invalidate(cpu, base, size);
+ }
+ 
+ /* put a translated page in the page table.  Only pages of 4K and up fit
+  * it, and only when the physical page is RAM or ROM; 1K pages and MMIO
+  * go through Mmu_Read()/Mmu_Write() every time */
+ static void Fill(Cpu *cpu, uint32_t addr, uint32_t phys, int readable, int writable, uint32_t size)
+ {
+	uint32_t page = PAGE_INDEX(addr), *slot = &cpu->mmu->cached[page & (MMU_CACHE_SIZE - 1)];
+	unsigned char *host = cpu->page_read[PAGE_INDEX(P1_BASE | phys)];
+	
+	if (size < PAGE_SIZE || !host || !readable)
+		return;
+	if (*slot != MMU_EMPTY)
+		Uncache(cpu, *slot);
+	*slot = page;
+	cpu->page_read[page] = host;
+	cpu->page_write[page] = writable ? cpu->page_write[PAGE_INDEX(P1_BASE | phys)] : 0;
+	cpu->mem->page_flags[page] = writable ? cpu->mem->page_flags[PAGE_INDEX(P1_BASE | phys)] & PAGE_GUARDED : 0;  //watched the same way
+ #ifdef MEMORY_STATS
+	cpu->mem->page_region[page] = cpu->mem->page_region[PAGE_INDEX(P1_BASE | phys)];
+ #endif
+ }
+ 
+ /* with nowhere to longjmp to (cpu->fault_ready clear, which is also how
+  * the block builder looks ahead without faulting) the access just fails
+  * and reads as 0 */
+ static int Fault(Cpu *cpu, uint32_t addr, uint32_t code, uint32_t offset)
+ {
+	Mmu *u = cpu->mmu;
+	if (!cpu->fault_ready)
+		return 0;
+	u->tea = addr;
+	u->pteh = (addr & 0xfffffc00) | (u->pteh & 0xff);
+	if (cpu->in_slot) {  //the branch is run again once the handler returns
+		cpu->pc -= 2;
+		cpu->in_slot = 0;
+	}
+	Exception(cpu, code, offset);
+	longjmp(cpu->fault, 1);
+ }
+ 
+ static Tlb_Entry *Lookup(Cpu *cpu, uint32_t addr)
+ {
+	Mmu *u = cpu->mmu;
+	uint32_t asid = u->pteh & 0xff, urc = MMUCR_URC(u->mmucr) + 1, urb = MMUCR_URB(u->mmucr);
+	int any_asid = (cpu->sr & SR_MD) && (u->mmucr & MMUCR_SV);
+	unsigned int i;
+	
+	if (urc == UTLB_SIZE || urc == urb)  //URC moves on with every UTLB search so LDTLB doesn't keep hitting the same entry
+		urc = 0;
+	u->mmucr = (u->mmucr & ~0xfc00) | urc << 10;
+	for (i = 0; i < UTLB_SIZE; ++i) {
+		Tlb_Entry *t = &u->utlb[i];
+		if ((t->lo & TLB_V) && !((addr ^ t->hi) & ~(TLB_SIZE(t->lo) - 1))
+			&& ((t->lo & TLB_SH) || any_asid || (t->hi & 0xff) == asid))
+			return t;
+	}
+	return 0;
+ }
+ 
+ static int Translate(Cpu *cpu, uint32_t addr, int write, uint32_t *phys)
+ {
+	Tlb_Entry *t;
+	uint32_t pr, size;
+	int md = (cpu->sr & SR_MD) != 0, readable, writable;
+	
+	if (!(cpu->mmu->mmucr & MMUCR_AT)) {
+		*phys = addr & 0x1fffffff;
+		Fill(cpu, addr, *phys, 1, 1, PAGE_SIZE);
+		return 1;
+	}
+	if (!(t = Lookup(cpu, addr)))
+		return Fault(cpu, addr, write ? EXP_TLB_MISS_W : EXP_TLB_MISS_R, VECTOR_TLB_MISS);
+	pr = (t->lo & TLB_PR) >> 5;
+	readable = md || pr >= 2;
+	writable = (pr & 1) && (md || pr == 3);
+	if (write ? !writable : !readable)
+		return Fault(cpu, addr, write ? EXP_PROTECT_W : EXP_PROTECT_R, VECTOR_GENERAL);
+	if (write && !(t->lo & TLB_D))
+		return Fault(cpu, addr, EXP_INITIAL_W, VECTOR_GENERAL);
+	size = TLB_SIZE(t->lo);
+	*phys = (t->lo & TLB_PPN & ~(size - 1)) | (addr & (size - 1));
+	Fill(cpu, addr, *phys, readable, writable && (t->lo & TLB_D), size);
+	return 1;
+ }
+ 
+ uint32_t Mmu_Read(Cpu *cpu, uint32_t addr, int size)
+ {
+	unsigned char *p;
+	uint32_t phys, l;
+	uint16_t w;
+	
+	if (!Translate(cpu, addr, 0, &phys))
+		return 0;
+	if (!(p = cpu->page_read[PAGE_INDEX(addr)]))
+		return IO_Read(cpu, P2_BASE | phys, size);
+	p += addr & PAGE_MASK & ~(size - 1);  //filled; every later access to the page is a plain load
+	if (size == 4) {
+		memcpy(&l, p, 4);
+		return SWAP32(l);
+	}
+	if (size == 2) {
+		memcpy(&w, p, 2);
+		return SWAP16(w);
+	}
+	return *p;
+ }
+ 
+ void Mmu_Write(Cpu *cpu, uint32_t addr, uint32_t value, int size)
+ {
+	unsigned char *p;
+	uint32_t phys, l;
+	uint16_t w;
+	
+	if (!Translate(cpu, addr, 1, &phys))
+		return;
+	if (!(p = cpu->page_write[PAGE_INDEX(addr)])) {
+		IO_Write(cpu, P2_BASE | phys, value, size);
+		return;
+	}
+	p += addr & PAGE_MASK & ~(size - 1);
+	if (size == 4) {
+		l = SWAP32(value);
+		memcpy(p, &l, 4);
+	} else if (size == 2) {
+		w = SWAP16((uint16_t)value);
+		memcpy(p, &w, 2);
+	} else
+		*p = (unsigned char)value;
+ }
+ 
+ void Mmu_Load(Cpu *cpu)
+ {
+	Mmu *u = cpu->mmu;
+	Tlb_Entry *t = &u->utlb[MMUCR_URC(u->mmucr)];
+	Drop_Entry(cpu, t);
+	t->hi = u->pteh;
+	t->lo = u->ptel;
+ }
+ 
+ void Mmu_Flush(Cpu *cpu)
+ {
+	Uncache_All(cpu);
+	Block_Invalidate(cpu, 0x00000000, 0x80000000);  //P0/U0
+	Block_Invalidate(cpu, 0xc0000000, 0x20000000);  //P3
+ }
+ 
+ void Mmu_Rights(Cpu *cpu)
+ {
+	Uncache_All(cpu);  //the same entries give different rights now, but still the same code
+ }
+ 
+ void Mmu_Invalidate(Cpu *cpu, uint32_t addr)
+ {
+	if (MMU_AREA(addr))
+		Uncache(cpu, PAGE_INDEX(addr));
+ }
+ 
+ static uint32_t Reg_Read(void *opaque, uint32_t addr, int size)
+ {
+	Mmu *u = ((Cpu *)opaque)->mmu;
+	switch (addr & ~3) {
+	case MMU_PTEH: return u->pteh;
+	case MMU_PTEL: return u->ptel;
+	case MMU_TTB: return u->ttb;
+	case MMU_TEA: return u->tea;
+	case MMU_MMUCR: return u->mmucr;
+	}
+	return 0;
+ }
+ 
+ static void Reg_Write(void *opaque, uint32_t addr, uint32_t value, int size)
+ {
+	Cpu *cpu = opaque;
+	Mmu *u = cpu->mmu;
+	uint32_t old;
+	unsigned int i;
+	
+	switch (addr & ~3) {
+	case MMU_PTEH:
+		old = u->pteh;
+		u->pteh = value & 0xfffffcff;
+		if ((old ^ value) & 0xff)  //new ASID, so every non shared translation may be different
+			Mmu_Flush(cpu);
+		break;
+	case MMU_PTEL: u->ptel = value & 0x1ffffdff; break;
+	case MMU_TTB: u->ttb = value; break;
+	case MMU_TEA: u->tea = value; break;
+	case MMU_MMUCR:
+		old = u->mmucr;
+		u->mmucr = value & ~MMUCR_TI;  //TI always reads 0
+		if (value & MMUCR_TI) {
+			for (i = 0; i < UTLB_SIZE; ++i)
+				u->utlb[i].lo &= ~TLB_V;
+			for (i = 0; i < ITLB_SIZE; ++i)
+				u->itlb[i].lo &= ~TLB_V;
+		}
+		if ((value & MMUCR_TI) || ((old ^ value) & (MMUCR_AT | MMUCR_SV)))
+			Mmu_Flush(cpu);
+		break;
+	}
+ }
+ 
+ //the arrays: bit 24 picks address or data half, ITLB at 0xf2/0xf3 and UTLB at 0xf6/0xf7
+ static Tlb_Entry *Array_Entry(Mmu *u, uint32_t addr)
+ {
+	if ((addr >> 24) < 0xf6)
+		return &u->itlb[(addr >> 8) & (ITLB_SIZE - 1)];
+	return &u->utlb[(addr >> 8) & (UTLB_SIZE - 1)];
+ }
+ 
+ static uint32_t Array_Read(void *opaque, uint32_t addr, int size)
+ {
+	Tlb_Entry *t = Array_Entry(((Cpu *)opaque)->mmu, addr);
+	if (addr & 0x01000000)
+		return t->lo;
+	return (t->hi & 0xfffffcff) | (t->lo & TLB_D) << 7 | (t->lo & TLB_V);  //VPN, D, V, ASID
+ }
+ 
+ static void Array_Write(void *opaque, uint32_t addr, uint32_t value, int size)
+ {
+	Cpu *cpu = opaque;
+	Mmu *u = cpu->mmu;
+	Tlb_Entry *t = Array_Entry(u, addr);
+	unsigned int i;
+	
+	if (addr & 0x01000000) {
+		Drop_Entry(cpu, t);
+		t->lo = value & 0x1ffffdff;
+	} else if ((addr >> 24) == 0xf6 && (addr & 0x80)) {  //associative: update D and V of whichever entry maps the VPN
+		for (i = 0; i < UTLB_SIZE; ++i) {
+			t = &u->utlb[i];
+			if ((t->lo & TLB_V) && !((value ^ t->hi) & ~(TLB_SIZE(t->lo) - 1) & 0xfffffc00)
+				&& ((t->lo & TLB_SH) || (t->hi & 0xff) == (value & 0xff))) {
+				Drop_Entry(cpu, t);
+				t->lo = (t->lo & ~(TLB_D | TLB_V)) | (value >> 7 & TLB_D) | (value & TLB_V);
+			}
+		}
+	} else {
+		Drop_Entry(cpu, t);
+		t->hi = value & 0xfffffcff;
+		t->lo = (t->lo & ~(TLB_D | TLB_V)) | (value >> 7 & TLB_D) | (value & TLB_V);
+	}
+ }
+ 
+ int Mmu_Init(Cpu *cpu)
+ {
+	Mmu *u = calloc(1, sizeof(Mmu));
+	if (!u)
+		return 0;
+	memset(u->cached, 0xff, sizeof(u->cached));  //MMU_EMPTY
+	cpu->mmu = u;
+	Memory_Map_IO(cpu, MMU_PTEH, 0x20, Reg_Read, Reg_Write, cpu, "MMU");
+	Memory_Map_IO(cpu, ITLB_ADDR, ITLB_SIZE << 8, Array_Read, Array_Write, cpu, "ITLB address array");
+	Memory_Map_IO(cpu, ITLB_DATA, ITLB_SIZE << 8, Array_Read, Array_Write, cpu, "ITLB data array");
+	Memory_Map_IO(cpu, UTLB_ADDR, UTLB_SIZE << 8, Array_Read, Array_Write, cpu, "UTLB address array");
+	Memory_Map_IO(cpu, UTLB_DATA, UTLB_SIZE << 8, Array_Read, Array_Write, cpu, "UTLB data array");
+	return 1;
+ }
+ 
+ void Mmu_Free(Cpu *cpu)
+ {
+	free(cpu->mmu);
+	cpu->mmu = 0;
+ }
+ 
+ void Mmu_Reset(Cpu *cpu)
+ {
+	Mmu *u = cpu->mmu;
+	memset(u->utlb, 0, sizeof(u->utlb));
+	memset(u->itlb, 0, sizeof(u->itlb));
+	u->pteh = u->ptel = u->ttb = u->tea = u->mmucr = 0;
+	Mmu_Flush(cpu);
+ }
@@ -0,0 +1,109 @@
+/* =====================================================================
+ * mmu.h
+ * provides the SH4A MMU: UTLB, ITLB and the translation cache
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #ifndef MMU_H
+ #define MMU_H
+ 
+ #include "registers.h"
+ 
+ //control registers in P4 and the memory mapped TLB arrays
+ #define MMU_PTEH  0xff000000      //VPN and current ASID
+ #define MMU_PTEL  0xff000004      //PPN and flags for LDTLB
+ #define MMU_TTB   0xff000008      //free for the OS, normally the page table base
+ #define MMU_TEA   0xff00000c      //address of the last MMU fault
+ #define MMU_MMUCR 0xff000010
+ #define ITLB_ADDR 0xf2000000      //entry in bits 9-8
+ #define ITLB_DATA 0xf3000000
+ #define UTLB_ADDR 0xf6000000      //entry in bits 13-8
+ #define UTLB_DATA 0xf7000000
+ 
+ #define MMUCR_AT  0x00000001      //address translation on
+ #define MMUCR_TI  0x00000004      //write 1 to invalidate every TLB entry
+ #define MMUCR_SV  0x00000100      //privileged mode ignores ASIDs
+ #define MMUCR_URC(x) (((x) >> 10) & 0x3f)  //UTLB entry LDTLB loads
+ #define MMUCR_URB(x) (((x) >> 18) & 0x3f)  //URC wraps here; 0 means after 63
+ 
+ //PTEL layout, also used for the data half of every TLB entry
+ #define TLB_WT  0x001
+ #define TLB_SH  0x002              //shared, matches any ASID
+ #define TLB_D   0x004              //dirty; writes to a clean page fault so the OS can track them
+ #define TLB_C   0x008
+ #define TLB_SZ0 0x010
+ #define TLB_PR  0x060              //00 privileged read, 01 privileged read/write, 10 read, 11 read/write
+ #define TLB_SZ1 0x080
+ #define TLB_V   0x100
+ #define TLB_PPN 0x1ffffc00
+ 
+ //EXPEVT codes and vector offsets of the MMU exceptions
+ #define EXP_TLB_MISS_R  0x040
+ #define EXP_TLB_MISS_W  0x060
+ #define EXP_INITIAL_W   0x080
+ #define EXP_PROTECT_R   0x0a0
+ #define EXP_PROTECT_W   0x0c0
+ #define VECTOR_TLB_MISS 0x400
+ #define VECTOR_GENERAL  0x100
+ 
+ //P0/U0 and P3 are translated when AT is set; with it clear they see physical memory directly
+ #define MMU_AREA(addr) ((uint32_t)(addr) < 0x80000000 || ((uint32_t)(addr) >> 29) == 6)
+ 
+ #define UTLB_SIZE 64
+ #define ITLB_SIZE 4
+ #define MMU_CACHE_SIZE 1024        //translated pages kept in the page table at once; power of 2
+ #define MMU_EMPTY 0xffffffff
+ 
+ typedef struct
+ {
+	uint32_t hi;                   //VPN bits 31-10 and ASID bits 7-0, as in PTEH
+	uint32_t lo;                   //as in PTEL
+ } Tlb_Entry;
+ 
+ /* translations are never looked up on the fast path.  A page the guest
+  * reaches through the TLB is written into cpu->page_read/page_write like
+  * any RAM page, so from then on it costs exactly what an untranslated
+  * access does; cached[] remembers which page table entries came from the
+  * TLB (direct mapped on the virtual page) so they can be taken out again
+  * when LDTLB, an ASID change or ICBI makes them stale */
+ typedef struct Mmu
+ {
+	Tlb_Entry utlb[UTLB_SIZE];
+	Tlb_Entry itlb[ITLB_SIZE];     //only kept for its memory mapped array; fetches translate through the UTLB
+	uint32_t pteh, ptel, ttb, tea, mmucr;
+	uint32_t cached[MMU_CACHE_SIZE];
+ } Mmu;
+ 
+ int Mmu_Init(Cpu *cpu);           //map the registers and TLB arrays; returns 0 if out of memory
+ void Mmu_Free(Cpu *cpu);
+ void Mmu_Reset(Cpu *cpu);         //translation off, every entry invalid
+ void Mmu_Load(Cpu *cpu);          //LDTLB: PTEH/PTEL into UTLB[URC]
+ void Mmu_Flush(Cpu *cpu);         //forget every cached translation and the blocks decoded through them
+ void Mmu_Rights(Cpu *cpu);        //SR.MD changed; the cached pages were filled with the old mode's access rights
+ void Mmu_Invalidate(Cpu *cpu, uint32_t addr);  //same for the one page holding addr
+ 
+ /* slow path for translated addresses that aren't in the page table yet;
+  * a miss or protection fault raises the exception and longjmps to
+  * cpu->fault, see registers.h */
+ uint32_t Mmu_Read(Cpu *cpu, uint32_t addr, int size);
+ void Mmu_Write(Cpu *cpu, uint32_t addr, uint32_t value, int size);
+ 
+ #endif
@@ -0,0 +1,263 @@
+/* =====================================================================
+ * profile.c
+ * samples guest PCs and call chains and counts routines
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #include <stdio.h>
+ #include <stdlib.h>
+ #include <string.h>
+ #include <fcntl.h>
+ #include <unistd.h>
+ #include <pthread.h>
+ #include "registers.h"
+ #include "decode.h"
+ #include "jit.h"
+ #include "sched.h"
+ #include "profile.h"
+ 
+ #ifdef PROFILE
+ 
+ static void Sample(Cpu *cpu, void *opaque);
+ 
+ int Profile_Init(Cpu *cpu)
+ {
+	Profile *p = calloc(1, sizeof(Profile));
+	if (!p)
+		return 0;
+	p->sample.fn = Sample;
+	p->sample.opaque = p;
+	cpu->profile = p;
+	return 1;
+ }
+ 
+ void Profile_Free(Cpu *cpu)
+ {
+	Profile *p = cpu->profile;
+	if (!p)
+		return;
+	if (cpu->sched)
+		Sched_Cancel(cpu, &p->sample);
+	free(p->stacks);
+	free(p->frames);
+	free(p);
+	cpu->profile = 0;
+ }
+ 
+ static int Same(const Profile *p, const Profile_Stack *s, const uint32_t *frames, uint32_t depth)
+ {
+	return s->depth == depth && !memcmp(&p->frames[s->first], frames, depth * sizeof(uint32_t));
+ }
+ 
+ static int Grow(Profile *p)  //double the table at 3/4 full
+ {
+	uint32_t size = p->stack_size ? p->stack_size * 2 : 1024, i, k;
+	Profile_Stack *stacks = calloc(size, sizeof(Profile_Stack));
+	
+	if (!stacks)
+		return 0;
+	for (i = 0; i < p->stack_size; ++i)
+		if (p->stacks[i].count) {
+			for (k = (uint32_t)p->stacks[i].hash & (size - 1); stacks[k].count; k = (k + 1) & (size - 1))
+				;
+			stacks[k] = p->stacks[i];
+		}
+	free(p->stacks);
+	p->stacks = stacks;
+	p->stack_size = size;
+	return 1;
+ }
+ 
+ static void Record(Profile *p, const uint32_t *frames, uint32_t depth)
+ {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	uint32_t i, k, *grown;
+	Profile_Stack *s;
+	
+	for (i = 0; i < depth; ++i) {
+		hash ^= frames[i];
+		hash *= 0x100000001b3ULL;
+	}
+	if ((p->stack_count + 1) * 4 > p->stack_size * 3 && !Grow(p))
+		return;
+	for (k = (uint32_t)hash & (p->stack_size - 1); p->stacks[k].count; k = (k + 1) & (p->stack_size - 1))
+		if (p->stacks[k].hash == hash && Same(p, &p->stacks[k], frames, depth)) {
+			++p->stacks[k].count;
+			return;
+		}
+	if (p->frame_count + depth > p->frame_size) {
+		uint32_t size = p->frame_size ? p->frame_size * 2 : 4096;
+		while (size < p->frame_count + depth)
+			size *= 2;
+		if (!(grown = realloc(p->frames, size * sizeof(uint32_t))))
+			return;
+		p->frames = grown;
+		p->frame_size = size;
+	}
+	s = &p->stacks[k];
+	s->hash = hash;
+	s->count = 1;
+	s->first = p->frame_count;
+	s->depth = depth;
+	memcpy(&p->frames[p->frame_count], frames, depth * sizeof(uint32_t));
+	p->frame_count += depth;
+	++p->stack_count;
+ }
+ 
+ static void Sample(Cpu *cpu, void *opaque)  //between blocks, so PC is where the next one starts
+ {
+	Profile *p = opaque;
+	uint32_t frames[PROFILE_DEPTH + 1];
+	unsigned int i;
+	
+	for (i = 0; i < p->depth; ++i)
+		frames[i] = p->calls[i].entry;
+	frames[i] = cpu->pc;
+	Record(p, frames, i + 1);
+	++p->samples;
+	Sched_Add(cpu, &p->sample, p->sample.when + p->period);
+ }
+ 
+ void Profile_Start(Cpu *cpu, uint64_t period)
+ {
+	Profile *p = cpu->profile;
+	p->period = period ? period : PROFILE_PERIOD;
+	Sched_Add(cpu, &p->sample, cpu->cycles + p->period);
+ }
+ 
+ void Profile_Stop(Cpu *cpu)
+ {
+	Sched_Cancel(cpu, &cpu->profile->sample);
+	cpu->profile->period = 0;
+ }
+ 
+ const uint64_t *Profile_Kinds(Cpu *cpu)
+ {
+ #ifdef JIT
+	Jit_Count(cpu, cpu->profile->kinds);
+ #endif
+	return cpu->profile->kinds;
+ }
+ 
+ void Profile_Clear(Cpu *cpu)
+ {
+	Profile *p = cpu->profile;
+	Profile_Kinds(cpu);  //so native blocks don't carry runs over either
+	memset(p->kinds, 0, sizeof(p->kinds));
+	if (p->stacks)
+		memset(p->stacks, 0, p->stack_size * sizeof(Profile_Stack));
+	p->stack_count = p->frame_count = 0;
+	p->samples = 0;
+ }
+ 
+ void Profile_Write_Folded(Cpu *cpu, FILE *f)
+ {
+	Profile *p = cpu->profile;
+	uint32_t i, k;
+	
+	for (i = 0; i < p->stack_size; ++i) {
+		const Profile_Stack *s = &p->stacks[i];
+		if (!s->count)
+			continue;
+		for (k = 0; k + 1 < s->depth; ++k)
+			fprintf(f, "%08x;", p->frames[s->first + k]);
+		fprintf(f, "@%08x %llu\n", p->frames[s->first + k], (unsigned long long)s->count);
+	}
+ }
+ 
+ static int By_Count(const void *x, const void *y)  //count << 32 | what, largest first
+ {
+	uint64_t a = *(const uint64_t *)x, b = *(const uint64_t *)y;
+	return (a < b) - (a > b);
+ }
+ 
+ static int By_PC(const void *x, const void *y)
+ {
+	uint32_t a = (uint32_t)*(const uint64_t *)x, b = (uint32_t)*(const uint64_t *)y;
+	return (a > b) - (a < b);
+ }
+ 
+ void Profile_Print_Hot(Cpu *cpu, FILE *f, unsigned int top)
+ {
+	Profile *p = cpu->profile;
+	const uint64_t *kinds = Profile_Kinds(cpu);
+	uint64_t *sorted = malloc((p->stack_count + 256) * sizeof(uint64_t));
+	uint32_t i, n = 0, m;
+	
+	if (!sorted)
+		return;
+	for (i = 0; i < p->stack_size; ++i)  //count << 32 | PC, the same PC from every chain added up
+		if (p->stacks[i].count)
+			sorted[n++] = p->stacks[i].count << 32 | p->frames[p->stacks[i].first + p->stacks[i].depth - 1];
+	qsort(sorted, n, sizeof(uint64_t), By_PC);
+	for (i = 0, m = 0; i < n; ++i)
+		if (m && (uint32_t)sorted[m - 1] == (uint32_t)sorted[i])
+			sorted[m - 1] += sorted[i] & 0xffffffff00000000ULL;
+		else
+			sorted[m++] = sorted[i];
+	qsort(sorted, m, sizeof(uint64_t), By_Count);
+	fprintf(f, "#%llu samples every %llu cycles\n", (unsigned long long)p->samples, (unsigned long long)p->period);
+	for (i = 0; i < m && i < top; ++i)
+		fprintf(f, "%12llu  %08x  %5.1f%%\n", (unsigned long long)(sorted[i] >> 32), (uint32_t)sorted[i],
+			100.0 * (sorted[i] >> 32) / p->samples);
+	
+	for (i = 0, n = 0; i < 256; ++i)  //the counts can pass 2^32, so sort indices by them instead
+		if (kinds[i])
+			sorted[n++] = i;
+	for (i = 1; i < n; ++i)  //insertion sort, there are only a couple of hundred
+		for (m = i; m && kinds[sorted[m - 1]] < kinds[sorted[m]]; --m) {
+			uint64_t t = sorted[m];
+			sorted[m] = sorted[m - 1];
+			sorted[m - 1] = t;
+		}
+	fprintf(f, "#routine runs\n");
+	for (i = 0; i < n && i < top; ++i)
+		fprintf(f, "%12llu  %s\n", (unsigned long long)kinds[sorted[i]], Decode_Kind_Name[sorted[i]]);
+	free(sorted);
+ }
+ 
+ /* perf reads /tmp/perf-<pid>.map to name code that has no symbols; every
+  * Cpu in the process appends to the same file, a line at a time with one
+  * write so threads can't interleave.  A flushed code cache is reused and
+  * its old lines stay, perf takes whatever it finds first */
+ static int map_fd = -1;
+ static pthread_once_t map_once = PTHREAD_ONCE_INIT;
+ 
+ static void Open_Map(void)
+ {
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/perf-%ld.map", (long)getpid());
+	map_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+ }
+ 
+ void Profile_Map(const void *code, size_t bytes, uint32_t pc)
+ {
+	char line[64];
+	int n;
+	pthread_once(&map_once, Open_Map);
+	if (map_fd < 0)
+		return;
+	n = snprintf(line, sizeof(line), "%lx %lx sh4_%08x\n", (unsigned long)(uintptr_t)code, (unsigned long)bytes, pc);
+	if (write(map_fd, line, n) != n)
+		map_fd = -1;  //disk full or the like; stop trying
+ }
+ 
+ #endif
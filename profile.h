@@ -0,0 +1,107 @@
+/* =====================================================================
+ * profile.h
+ * provides the sampling profiler
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #ifndef PROFILE_H
+ #define PROFILE_H
+ 
+ #include "registers.h"
+ 
+ #ifdef PROFILE  //build with -DPROFILE to see where guest time goes, see profile.c
+ #include <stdio.h>
+ #include "sched.h"
+ 
+ #define PROFILE_DEPTH 64          //calls deep the chain is followed; deeper ones are charged to the last one kept
+ #define PROFILE_PERIOD 10000      //cycles between samples unless asked otherwise, about 5800 a second
+ 
+ typedef struct
+ {
+	uint32_t entry;                //where the call went
+	uint32_t ret;                  //PR it set, which the matching RTS goes back to
+ } Profile_Call_Frame;
+ 
+ typedef struct
+ {
+	uint64_t hash, count;          //count 0 if the slot is free
+	uint32_t first, depth;         //frames[first] on: the call entries outermost first, then PC
+ } Profile_Stack;
+ 
+ /* JSR and RTS keep a shadow of the call chain the way PR builds it, so a
+  * sample needs no stack walk and doesn't depend on how the guest saves
+  * PR.  Samples are a scheduler event every period cycles, so they only
+  * happen between blocks and cost nothing until Profile_Start(); each
+  * distinct chain is counted once in stacks.  kinds counts every routine
+  * run, by Decode_Kind_Name, exactly: blocks count their ops as they run
+  * and native blocks count their own runs (jit.c), added in by
+  * Profile_Kinds() */
+ typedef struct Profile
+ {
+	uint64_t kinds[256];
+	Profile_Call_Frame calls[PROFILE_DEPTH];
+	unsigned int depth;
+	uint64_t period;               //0 when not sampling
+	uint64_t samples;
+	Event sample;
+	Profile_Stack *stacks;         //open addressed on the hash
+	uint32_t stack_size, stack_count;
+	uint32_t *frames;
+	uint32_t frame_size, frame_count;
+ } Profile;
+ 
+ int Profile_Init(Cpu *cpu);       //returns 0 if out of memory
+ void Profile_Free(Cpu *cpu);
+ void Profile_Start(Cpu *cpu, uint64_t period);  //sample from now on; again after Cpu_Reset() or loading a snapshot file
+ void Profile_Stop(Cpu *cpu);
+ const uint64_t *Profile_Kinds(Cpu *cpu);  //routine runs so far, native blocks included
+ void Profile_Clear(Cpu *cpu);     //forget the counts and samples so far, the call chain is kept
+ void Profile_Write_Folded(Cpu *cpu, FILE *f);  //one "entry;entry;@pc count" line per chain, for flamegraph.pl
+ void Profile_Print_Hot(Cpu *cpu, FILE *f, unsigned int top);  //most sampled PCs and most run routines
+ void Profile_Map(const void *code, size_t bytes, uint32_t pc);  //add native code for the block at pc to /tmp/perf-<pid>.map
+ 
+ static inline void Profile_Call(Cpu *cpu, uint32_t entry, uint32_t ret)
+ {
+	Profile *p = cpu->profile;
+	if (p->depth < PROFILE_DEPTH) {
+		p->calls[p->depth].entry = entry;
+		p->calls[p->depth++].ret = ret;
+	}
+ }
+ 
+ static inline void Profile_Return(Cpu *cpu, uint32_t to)  //back to the newest call that set PR to to; a return with no call seen leaves the chain alone
+ {
+	Profile *p = cpu->profile;
+	unsigned int i = p->depth;
+	while (i && p->calls[i - 1].ret != to)
+		--i;
+	if (i)
+		p->depth = i - 1;
+ }
+ 
+ static inline void Profile_Count(Cpu *cpu, unsigned int kind)
+ {
+	++cpu->profile->kinds[kind];
+ }
+ 
+ #endif
+ 
+ #endif
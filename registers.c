@@ -0,0 +1,111 @@
+/* =====================================================================
+ * registers.c
+ * provides status register handling for the SH4A cpu context
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #include "registers.h"
+ #include "mmu.h"
+ #include "intc.h"
+ 
+ 
+ uint32_t Eval_T(Cpu *cpu)
+ {
+	uint32_t x;
+	
+	switch (cpu->t_op) {
+	case T_EQ: cpu->t = (cpu->t_a == cpu->t_b); break;
+	case T_GE: cpu->t = ((int32_t)cpu->t_a >= (int32_t)cpu->t_b); break;
+	case T_GT: cpu->t = ((int32_t)cpu->t_a > (int32_t)cpu->t_b); break;
+	case T_HI: cpu->t = (cpu->t_a > cpu->t_b); break;
+	case T_HS: cpu->t = (cpu->t_a >= cpu->t_b); break;
+	case T_PL: cpu->t = ((int32_t)cpu->t_a > 0); break;
+	case T_PZ: cpu->t = ((int32_t)cpu->t_a >= 0); break;
+	case T_STR:
+		x = cpu->t_a ^ cpu->t_b;
+		cpu->t = !(x & 0xff000000) || !(x & 0x00ff0000) || !(x & 0x0000ff00) || !(x & 0x000000ff);
+		break;
+	case T_ZERO: cpu->t = (cpu->t_a == 0); break;
+	case T_CARRY:
+		x = cpu->t_a + cpu->t_b;
+		cpu->t = (cpu->t_a > x) || (x > (uint32_t)(x + cpu->t_c));  //carry out of either of the two additions
+		break;
+	case T_OVERFLOW:
+		x = cpu->t_a + cpu->t_b;
+		cpu->t = ((int32_t)(~(cpu->t_a ^ cpu->t_b) & (cpu->t_a ^ x)) < 0);  //operands agree in sign but the result doesn't
+		break;
+	}
+	cpu->t_op = T_NONE;
+	return cpu->t;
+ }
+ 
+ void updateSR(Cpu *cpu)
+ {
+	cpu->sr = (cpu->sr & ~(SR_T | SR_S | SR_Q | SR_M)) | GET_T(cpu) | (cpu->s << 1) | (cpu->q << 8) | (cpu->m << 9);
+ }
+ 
+ void splitSR(Cpu *cpu, uint32_t sr)
+ {
+	uint32_t tmp;
+	int i;
+	
+	if ((sr ^ cpu->sr) & SR_RB)  //R0-R7 swap with the other bank
+		for (i = 0; i < 8; ++i) {
+			tmp = cpu->r[i];
+			cpu->r[i] = cpu->r_bank[i];
+			cpu->r_bank[i] = tmp;
+		}
+	if (((sr ^ cpu->sr) & SR_MD) && cpu->mmu)  //translated pages were filled with the old mode's rights
+		Mmu_Rights(cpu);
+	if (((sr ^ cpu->sr) & (SR_IMASK | SR_BL)) && cpu->intc && cpu->intc->pending)
+		cpu->next_event = 0;  //may have let something in; Sched_Run() decides after this block
+	cpu->sr = sr & 0x700083f3;  //only the implemented bits
+	SET_T(cpu, sr & SR_T);
+	cpu->s = (sr & SR_S) != 0;
+	cpu->q = (sr & SR_Q) != 0;
+	cpu->m = (sr & SR_M) != 0;
+ }
+ 
+ static void Enter(Cpu *cpu, uint32_t offset)  //what exceptions and interrupts both save before going to VBR + offset
+ {
+	updateSR(cpu);
+	cpu->ssr = cpu->sr;
+	cpu->spc = cpu->pc;
+	cpu->sgr = cpu->r[15];
+	splitSR(cpu, cpu->sr | SR_MD | SR_RB | SR_BL);
+	cpu->pc = cpu->vbr + offset;
+ }
+ 
+ void Exception(Cpu *cpu, uint32_t code, uint32_t offset)
+ {
+	cpu->expevt = code;
+	Enter(cpu, offset);
+ }
+ 
+ void Interrupt(Cpu *cpu, uint32_t code)  //only ever between blocks, so PC is never on a delay slot
+ {
+	if (cpu->sleeping) {  //SPC is the instruction after the SLEEP
+		cpu->sleeping = 0;
+		cpu->pc += 2;
+	}
+	cpu->intevt = code;
+	Enter(cpu, 0x600);
+ }
@@ -1,6 +1,6 @@
  /* =====================================================================
  * registers.h
- * provides declarations for SH4A register set
+ * provides the SH4A cpu context
  * 
  * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
  * 
@@ -22,15 +22,117 @@
  * MA 02110-1301, USA.
  * ===================================================================*/
  
- unsigned long R[16];
- unsigned long SR, GBR, VBR, SGR, SPC, SSR;
- unsigned long PR;
- unsigned long PC;
- unsigned long R_Bank[8];
- unsigned long T, M, S, Q;
- unsigned long long = MAC64;
- const unsigned long * MACH = ((char*)&MACH64 + 4);  //seems correct for a little endian system
- const unsigned long * MACL = &MACH64;
- 
-
-
+ #ifndef REGISTERS_H
+ #define REGISTERS_H
+ 
+ #include <stdint.h>
+ #include <setjmp.h>
+ 
+ struct Memory;
+ struct Block;
+ struct Jit;
+ struct Keyboard;
+ struct Mmu;
+ struct Sched;
+ struct Intc;
+ struct Tmu;
+ struct Rtc;
+ struct Lcd;
+ struct Companion;
+ struct Profile;
+ struct Trace;
+ 
+ /* everything one emulated SH4A owns lives in its Cpu, so any number of
+  * them can run side by side on separate threads; the struct is cache line
+  * aligned and allocated on its own so two instances never share a line.
+  * Registers are fixed 32 bit; the most used ones come first */
+ typedef struct Cpu
+ {
+	_Alignas(64) uint32_t r[16];
+	uint32_t pc;
+	uint32_t t, m, s, q;                 //split out of SR; sr itself is only current after updateSR()
+	uint32_t t_op, t_a, t_b, t_c;        //pending lazy T bit, see Eval_T()
+	uint32_t sr, gbr, vbr, sgr, spc, ssr, dbr;
+	uint32_t pr;
+	uint32_t r_bank[8];
+	union {
+		uint64_t mac;                    //MACH:MACL as one 64 bit value
+		struct { uint32_t macl, mach; }; //little endian host
+	};
+	uint32_t expevt, intevt;             //exception and interrupt event codes; snapshots copy everything up to here as is
+	
+	unsigned char **page_read;           //guest page tables, see memory.h
+	unsigned char **page_write;
+	struct Memory *mem;
+	struct Block *blocks;                //predecoded block cache, see block.h
+	struct Jit *jit;                     //code cache, see jit.h
+	uint64_t cycles;                     //SH4A issue cycles so far, as costed in decode.c
+	uint64_t next_event;                 //cycle the run loop next has to look at peripherals, see cpu.h
+	struct Keyboard *keyboard;           //key matrix, see keyboard.h; 0 if not attached
+	struct Mmu *mmu;                     //TLBs, see mmu.h
+	struct Sched *sched;                 //pending peripheral events, see sched.h
+	struct Intc *intc;                   //interrupt priorities and pending sources, see intc.h
+	struct Tmu *tmu;                     //on chip peripherals: tmu.h, rtc.h, lcd.h
+	struct Rtc *rtc;
+	struct Lcd *lcd;
+	struct Snapshot *snapshot;           //last one taken or restored, see snapshot.h
+	struct Companion *companion;         //host thread for output, see companion.h; 0 if not started
+	uint32_t in_slot;                    //a delay slot is running; an MMU fault there restarts from the branch
+	uint32_t sleeping;                   //SLEEP is waiting for an interrupt with PC still on it, see Interrupt()
+	uint32_t clock_read;                 //a read saw a count that moves with cycles, not at events; see Block_Run()
+	int fault_ready;                     //fault has been set up; while 0 MMU faults just read as 0
+	jmp_buf fault;                       //MMU faults longjmp here once Exception() has moved PC to the handler
+ #ifdef PROFILE_PAIRS
+	uint64_t *pair_counts;               //256 x 256 instruction kinds, see block.c
+ #endif
+ #ifdef PROFILE
+	struct Profile *profile;             //samples and routine counts, see profile.h
+ #endif
+ #ifdef TRACE
+	struct Trace *trace;                 //instruction trace being written, see trace.h; 0 if off
+	uint64_t trace_addr;                 //last guest address read or written, TRACE_NO_ADDR if none
+ #endif
+ } Cpu;
+ 
+ //SR bit positions
+ #define SR_T     0x00000001
+ #define SR_S     0x00000002
+ #define SR_IMASK 0x000000f0
+ #define SR_Q     0x00000100
+ #define SR_M     0x00000200
+ #define SR_FD    0x00008000
+ #define SR_BL    0x10000000
+ #define SR_RB    0x20000000
+ #define SR_MD    0x40000000
+ 
+ /* lazy T bit: compare and arithmetic instructions only record what they
+  * would have tested in t_op/t_a/t_b/t_c, and the T bit is worked out when
+  * somebody actually reads it (BT, BF, ADDC, STC SR, exceptions ...); most
+  * CMP results are overwritten before that ever happens */
+ enum
+ {
+	T_NONE = 0,   //t holds the real value
+	T_EQ,         //A == B
+	T_GE,         //(int32_t)A >= (int32_t)B
+	T_GT,         //(int32_t)A > (int32_t)B
+	T_HI,         //A > B
+	T_HS,         //A >= B
+	T_PL,         //(int32_t)A > 0
+	T_PZ,         //(int32_t)A >= 0
+	T_STR,        //some byte of A equals the same byte of B
+	T_ZERO,       //A == 0
+	T_CARRY,      //carry out of A + B + C
+	T_OVERFLOW    //signed overflow of A + B
+ };
+ 
+ #define LAZY_T(cpu, op, a, b) ((cpu)->t_op = (op), (cpu)->t_a = (a), (cpu)->t_b = (b))
+ #define GET_T(cpu) ((cpu)->t_op ? Eval_T(cpu) : (cpu)->t)
+ #define SET_T(cpu, v) ((cpu)->t_op = T_NONE, (cpu)->t = (v))
+ 
+ uint32_t Eval_T(Cpu *cpu);            //resolve a pending t_op into t
+ void updateSR(Cpu *cpu);              //compose sr from t, s, q and m
+ void splitSR(Cpu *cpu, uint32_t sr);  //load sr and split it back out, switching register banks if RB changes
+ void Exception(Cpu *cpu, uint32_t code, uint32_t offset);  //enter an exception handler at VBR + offset
+ void Interrupt(Cpu *cpu, uint32_t code);  //enter the interrupt handler at VBR + 0x600 with INTEVT = code
+ 
+ #endif
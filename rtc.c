@@ -0,0 +1,186 @@
+/* =====================================================================
+ * rtc.c
+ * emulates the RTC calendar and its interrupts
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #include <stdlib.h>
+ #include "registers.h"
+ #include "memory.h"
+ #include "intc.h"
+ #include "sched.h"
+ #include "rtc.h"
+ 
+ 
+ static const unsigned int Period[8] = { 0, 1, 4, 16, 64, 128, 256, 512 };  //RCR2.PES in ticks
+ 
+ static unsigned int From_BCD(unsigned int v)
+ {
+	return (v >> 12 & 0xf) * 1000 + (v >> 8 & 0xf) * 100 + (v >> 4 & 0xf) * 10 + (v & 0xf);
+ }
+ 
+ static unsigned int To_BCD(unsigned int v)
+ {
+	return (v / 1000 % 10) << 12 | (v / 100 % 10) << 8 | (v / 10 % 10) << 4 | v % 10;
+ }
+ 
+ static void Second(Rtc *r)  //carry one second through the calendar
+ {
+	static const unsigned char days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	unsigned int sec = From_BCD(r->sec) + 1, min = From_BCD(r->min), hour = From_BCD(r->hour);
+	unsigned int day = From_BCD(r->day), mon = From_BCD(r->mon), year = From_BCD(r->year);
+	unsigned int last = days[(mon + 11) % 12] + (mon == 2 && year % 4 == 0 && (year % 100 != 0 || year % 400 == 0));
+	
+	if (sec >= 60) {
+		sec = 0;
+		if (++min >= 60) {
+			min = 0;
+			if (++hour >= 24) {
+				hour = 0;
+				r->week = (r->week + 1) % 7;
+				if (++day > last) {
+					day = 1;
+					if (++mon > 12) {
+						mon = 1;
+						year = (year + 1) % 10000;
+					}
+				}
+			}
+		}
+	}
+	r->sec = To_BCD(sec);
+	r->min = To_BCD(min);
+	r->hour = To_BCD(hour);
+	r->day = To_BCD(day);
+	r->mon = To_BCD(mon);
+	r->year = To_BCD(year);
+ }
+ 
+ static void Schedule(Cpu *cpu, Rtc *r)
+ {
+	Sched_Add(cpu, &r->tick, r->epoch + (r->ticks + 1) * CPU_HZ / RTC_HZ);
+ }
+ 
+ static void Tick(Cpu *cpu, void *opaque)
+ {
+	Rtc *r = opaque;
+	unsigned int period = Period[(r->rcr2 & RCR2_PES) >> 4];
+	
+	++r->ticks;
+	if (!(r->ticks & 1) && (r->r64cnt = (r->r64cnt + 1) & 0x7f) == 0) {
+		Second(r);
+		r->rcr1 |= RCR1_CF;
+		if (r->rcr1 & RCR1_CIE)
+			Intc_Raise(cpu, INTC_RTC_CUI);
+	}
+	if (period && r->ticks % period == 0) {
+		r->rcr2 |= RCR2_PEF;
+		Intc_Raise(cpu, INTC_RTC_PRI);
+	}
+	Schedule(cpu, r);
+ }
+ 
+ static uint32_t Rtc_Read(void *opaque, uint32_t addr, int size)
+ {
+	Rtc *r = ((Cpu *)opaque)->rtc;
+	switch (addr - RTC_BASE) {
+	case RTC_R64CNT: return r->r64cnt;
+	case RTC_RSECCNT: return r->sec;
+	case RTC_RMINCNT: return r->min;
+	case RTC_RHRCNT: return r->hour;
+	case RTC_RWKCNT: return r->week;
+	case RTC_RDAYCNT: return r->day;
+	case RTC_RMONCNT: return r->mon;
+	case RTC_RYRCNT: return r->year;
+	case RTC_RCR1: return r->rcr1;
+	case RTC_RCR2: return r->rcr2;
+	}
+	return 0;  //alarm registers aren't kept
+ }
+ 
+ static void Rtc_Write(void *opaque, uint32_t addr, uint32_t value, int size)
+ {
+	Cpu *cpu = opaque;
+	Rtc *r = cpu->rtc;
+	
+	switch (addr - RTC_BASE) {
+	case RTC_RSECCNT: r->sec = value & 0x7f; break;
+	case RTC_RMINCNT: r->min = value & 0x7f; break;
+	case RTC_RHRCNT: r->hour = value & 0x3f; break;
+	case RTC_RWKCNT: r->week = value & 0x07; break;
+	case RTC_RDAYCNT: r->day = value & 0x3f; break;
+	case RTC_RMONCNT: r->mon = value & 0x1f; break;
+	case RTC_RYRCNT: r->year = (uint16_t)value; break;
+	case RTC_RCR1:
+		r->rcr1 = (value & RCR1_CIE) | (r->rcr1 & value & RCR1_CF);
+		if ((r->rcr1 & RCR1_CF) && (r->rcr1 & RCR1_CIE))
+			Intc_Raise(cpu, INTC_RTC_CUI);
+		else
+			Intc_Clear(cpu, INTC_RTC_CUI);
+		break;
+	case RTC_RCR2:
+		r->rcr2 = (value & (RCR2_PES | RCR2_START)) | (r->rcr2 & value & RCR2_PEF);
+		if (!(r->rcr2 & RCR2_PEF) || !(r->rcr2 & RCR2_PES))
+			Intc_Clear(cpu, INTC_RTC_PRI);
+		if (value & RCR2_RESET)
+			r->r64cnt = 0;
+		if (!(r->rcr2 & RCR2_START))
+			Sched_Cancel(cpu, &r->tick);
+		else if (!SCHED_PENDING(&r->tick) || (value & RCR2_RESET)) {  //the divider starts over
+			r->epoch = cpu->cycles;
+			r->ticks = 0;
+			Schedule(cpu, r);
+		}
+		break;
+	}
+ }
+ 
+ int Rtc_Init(Cpu *cpu)
+ {
+	Rtc *r = calloc(1, sizeof(Rtc));
+	if (!r)
+		return 0;
+	r->tick.fn = Tick;
+	r->tick.opaque = r;
+	cpu->rtc = r;
+	Memory_Map_IO(cpu, RTC_BASE, RTC_SIZE, Rtc_Read, Rtc_Write, cpu, "RTC");
+	return 1;
+ }
+ 
+ void Rtc_Free(Cpu *cpu)
+ {
+	free(cpu->rtc);
+	cpu->rtc = 0;
+ }
+ 
+ void Rtc_Reset(Cpu *cpu)  //after Sched_Reset()
+ {
+	Rtc *r = cpu->rtc;
+	r->r64cnt = r->sec = r->min = r->hour = 0;
+	r->week = 6;
+	r->day = r->mon = 0x01;
+	r->year = 0x2011;
+	r->rcr1 = 0;
+	r->rcr2 = RCR2_START;
+	r->epoch = cpu->cycles;
+	r->ticks = 0;
+	Schedule(cpu, r);
+ }
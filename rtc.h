@@ -0,0 +1,69 @@
+/* =====================================================================
+ * rtc.h
+ * provides the real time clock
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #ifndef RTC_H
+ #define RTC_H
+ 
+ #include "registers.h"
+ #include "sched.h"
+ 
+ #define RTC_BASE 0xa413fec0       //byte registers at even offsets, RYRCNT is a word
+ #define RTC_R64CNT  0x00          //128 Hz counter, 7 bits
+ #define RTC_RSECCNT 0x02          //the calendar counters are all BCD
+ #define RTC_RMINCNT 0x04
+ #define RTC_RHRCNT  0x06
+ #define RTC_RWKCNT  0x08          //0 is Sunday
+ #define RTC_RDAYCNT 0x0a
+ #define RTC_RMONCNT 0x0c
+ #define RTC_RYRCNT  0x0e
+ #define RTC_RCR1    0x1c
+ #define RTC_RCR2    0x1e
+ #define RTC_SIZE    0x20
+ 
+ #define RCR1_CF    0x80           //a second went by; cleared by writing 0
+ #define RCR1_CIE   0x10
+ #define RCR2_PEF   0x80           //periodic interrupt flag; cleared by writing 0
+ #define RCR2_PES   0x70           //period: none, 1/256, 1/64, 1/16, 1/4, 1/2, 1 or 2 seconds
+ #define RCR2_RESET 0x02           //write 1 to clear R64CNT
+ #define RCR2_START 0x01
+ 
+ #define RTC_HZ 256                //rate of the tick event; R64CNT moves every other one
+ 
+ /* the clock comes up at 2011-01-01 00:00:00 so batch runs see the same
+  * time every time; a front end can write the host time in */
+ typedef struct Rtc
+ {
+	uint8_t r64cnt, sec, min, hour, week, day, mon;
+	uint16_t year;
+	uint8_t rcr1, rcr2;
+	uint64_t epoch;                //cycle of tick 0
+	uint64_t ticks;                //since epoch; deadlines are worked out from it so the rate doesn't drift
+	Event tick;
+ } Rtc;
+ 
+ int Rtc_Init(Cpu *cpu);           //map the registers; returns 0 if out of memory
+ void Rtc_Free(Cpu *cpu);
+ void Rtc_Reset(Cpu *cpu);         //running, at the date above
+ 
+ #endif
@@ -0,0 +1,271 @@
+/* =====================================================================
+ * sched.c
+ * schedules peripheral events on a timing wheel keyed on guest cycles
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #include <errno.h>
+ #include <stdlib.h>
+ #include <time.h>
+ #include "registers.h"
+ #include "intc.h"
+ #include "sched.h"
+ 
+ 
+ static void Link(Sched *s, unsigned int slot, Event *e)
+ {
+	Event **head = slot == SCHED_LATER ? &s->later : &s->slots[slot / SCHED_SLOTS][slot % SCHED_SLOTS];
+	e->next = *head;
+	if (e->next)
+		e->next->prev = &e->next;
+	e->prev = head;
+	e->slot = slot;
+	*head = e;
+	if (slot != SCHED_LATER)
+		s->used[slot / SCHED_SLOTS][slot % SCHED_SLOTS / 64] |= 1ULL << (slot & 63);
+ }
+ 
+ static void Unlink(Sched *s, Event *e)
+ {
+	*e->prev = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	e->prev = 0;
+	if (e->slot != SCHED_LATER && !s->slots[e->slot / SCHED_SLOTS][e->slot % SCHED_SLOTS])
+		s->used[e->slot / SCHED_SLOTS][e->slot % SCHED_SLOTS / 64] &= ~(1ULL << (e->slot & 63));
+ }
+ 
+ /* the lowest level whose window around now holds the deadline; an event
+  * that is already due goes in now's own level 0 slot */
+ static void Insert(Sched *s, Event *e)
+ {
+	uint64_t differ = e->when ^ s->now;
+	unsigned int level;
+	
+	if (e->when <= s->now) {
+		Link(s, s->now & (SCHED_SLOTS - 1), e);
+		return;
+	}
+	for (level = 0; level < SCHED_LEVELS; ++level)
+		if ((differ >> (SCHED_BITS * (level + 1))) == 0) {
+			Link(s, level * SCHED_SLOTS + ((e->when >> (SCHED_BITS * level)) & (SCHED_SLOTS - 1)), e);
+			return;
+		}
+	Link(s, SCHED_LATER, e);
+ }
+ 
+ static unsigned int First(const Sched *s, unsigned int level, unsigned int from)  //first occupied slot from on, SCHED_SLOTS if none
+ {
+	uint64_t bits;
+	unsigned int w;
+	for (w = from >> 6; w < SCHED_SLOTS / 64; ++w) {
+		bits = s->used[level][w];
+		if (w == from >> 6)
+			bits &= ~0ULL << (from & 63);
+		if (bits)
+			return w * 64 + __builtin_ctzll(bits);
+	}
+	return SCHED_SLOTS;
+ }
+ 
+ /* earliest deadline in the wheel: exact for level 0, the start of the
+  * first occupied slot for the levels above.  The slot now is in on a
+  * level above 0 is always empty, it was spread out on the way in */
+ static uint64_t Next(Sched *s)
+ {
+	unsigned int level, i, shift;
+	uint64_t earliest = UINT64_MAX;
+	Event *e;
+	
+	for (level = 0; level < SCHED_LEVELS; ++level) {
+		shift = SCHED_BITS * level;
+		i = First(s, level, ((s->now >> shift) & (SCHED_SLOTS - 1)) + (level != 0));
+		if (i < SCHED_SLOTS)
+			return (s->now >> (shift + SCHED_BITS) << (shift + SCHED_BITS)) | (uint64_t)i << shift;
+	}
+	for (e = s->later; e; e = e->next)
+		if (e->when < earliest)
+			earliest = e->when;
+	return earliest;
+ }
+ 
+ static void Advance(Sched *s, uint64_t t)  //move now up to t and spread the slots it lands in over the levels below
+ {
+	Event *e, *far = s->later;
+	unsigned int level;
+	Event **slot;
+	
+	s->now = t;
+	s->later = 0;
+	while ((e = far)) {  //mostly empty; only something a minute or more away lives here
+		far = e->next;
+		e->prev = 0;
+		Insert(s, e);
+	}
+	for (level = SCHED_LEVELS - 1; level > 0; --level) {
+		slot = &s->slots[level][(t >> (SCHED_BITS * level)) & (SCHED_SLOTS - 1)];
+		while ((e = *slot)) {
+			Unlink(s, e);
+			Insert(s, e);
+		}
+	}
+ }
+ 
+ static uint64_t Host_Ns(void)
+ {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+ }
+ 
+ int Sched_Init(Cpu *cpu)
+ {
+	cpu->sched = calloc(1, sizeof(Sched));
+	return cpu->sched != 0;
+ }
+ 
+ void Sched_Free(Cpu *cpu)
+ {
+	free(cpu->sched);
+	cpu->sched = 0;
+ }
+ 
+ void Sched_Reset(Cpu *cpu)
+ {
+	Sched *s = cpu->sched;
+	unsigned int level, i;
+	
+	for (level = 0; level < SCHED_LEVELS; ++level)
+		for (i = 0; i < SCHED_SLOTS; ++i)
+			while (s->slots[level][i])
+				Unlink(s, s->slots[level][i]);
+	while (s->later)
+		Unlink(s, s->later);
+	s->now = cpu->cycles;
+	s->base_ns = Host_Ns();
+	s->base_cycles = cpu->cycles;
+	cpu->next_event = 0;
+ }
+ 
+ void Sched_Add(Cpu *cpu, Event *e, uint64_t when)
+ {
+	if (e->prev)
+		Unlink(cpu->sched, e);
+	e->when = when;
+	Insert(cpu->sched, e);
+	if (when < cpu->next_event)
+		cpu->next_event = when;
+ }
+ 
+ void Sched_Cancel(Cpu *cpu, Event *e)  //next_event is left alone; at worst Sched_Run() finds nothing to do
+ {
+	if (e->prev)
+		Unlink(cpu->sched, e);
+ }
+ 
+ static int Save_List(Sched_State *state, const Event *e)
+ {
+	for (; e; e = e->next) {
+		if (state->count == SCHED_SAVED)
+			return 0;
+		state->events[state->count] = (Event *)e;
+		state->when[state->count++] = e->when;
+	}
+	return 1;
+ }
+ 
+ int Sched_Save(Cpu *cpu, Sched_State *state)
+ {
+	Sched *s = cpu->sched;
+	unsigned int level, i;
+	
+	state->now = s->now;
+	state->count = 0;
+	for (level = 0; level < SCHED_LEVELS; ++level)
+		for (i = 0; i < SCHED_SLOTS; ++i)
+			if (!Save_List(state, s->slots[level][i]))
+				return 0;
+	return Save_List(state, s->later);
+ }
+ 
+ void Sched_Restore(Cpu *cpu, const Sched_State *state)
+ {
+	unsigned int i;
+	cpu->sched->now = state->now;
+	for (i = 0; i < state->count; ++i) {
+		Event *e = state->events[i];
+		e->prev = 0;  //the copy still has the links it had when it was saved
+		e->when = state->when[i];
+		Insert(cpu->sched, e);
+	}
+	cpu->next_event = 0;
+ }
+ 
+ void Sched_Realtime(Cpu *cpu, int on)
+ {
+	cpu->sched->realtime = on;
+	cpu->sched->base_ns = Host_Ns();
+	cpu->sched->base_cycles = cpu->cycles;
+ }
+ 
+ /* an idle loop or SLEEP jumps cycles to the next event at once; headless
+  * that's the whole point, but with somebody watching the guest must not
+  * get ahead of them.  Sleeping here until the host clock reaches cycles
+  * both keeps the pace and leaves the host idle while the guest is.  A
+  * guest that falls more than a frame or so behind isn't raced back, the
+  * clocks are just lined up again */
+ static void Pace(Cpu *cpu, Sched *s)
+ {
+	uint64_t run = cpu->cycles - s->base_cycles;
+	uint64_t due = s->base_ns + run / CPU_HZ * 1000000000 + run % CPU_HZ * 1000000000 / CPU_HZ;
+	uint64_t now = Host_Ns();
+	struct timespec ts;
+	
+	if (now > due + 20000000) {
+		s->base_ns = now;
+		s->base_cycles = cpu->cycles;
+	} else if (now < due) {
+		ts.tv_sec = due / 1000000000;
+		ts.tv_nsec = due % 1000000000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR)
+			;
+	}
+ }
+ 
+ void Sched_Run(Cpu *cpu)
+ {
+	Sched *s = cpu->sched;
+	Event **slot, *e;
+	uint64_t t;
+	
+	if (s->realtime)
+		Pace(cpu, s);
+	while ((t = Next(s)) <= cpu->cycles) {
+		Advance(s, t);
+		slot = &s->slots[0][t & (SCHED_SLOTS - 1)];
+		while ((e = *slot)) {  //one at a time: a handler may add or cancel any event, its own included
+			Unlink(s, e);
+			e->fn(cpu, e->opaque);
+		}
+	}
+	Intc_Accept(cpu);
+	cpu->next_event = t;
+ }
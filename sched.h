@@ -0,0 +1,97 @@
+/* =====================================================================
+ * sched.h
+ * provides the guest time event scheduler for the peripherals
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #ifndef SCHED_H
+ #define SCHED_H
+ 
+ #include "registers.h"
+ 
+ //guest clocks; cpu->cycles counts at CPU_HZ, the peripherals at the slower peripheral clock
+ #define CPU_HZ 58000000
+ #define PCLK_DIV 4                //CPU cycles per peripheral clock cycle
+ 
+ typedef void (*Event_Handler)(Cpu *cpu, void *opaque);
+ 
+ /* one pending deadline.  Events belong to whoever schedules them (usually
+  * embedded in the peripheral's own struct) and are only linked into the
+  * wheel while they are pending */
+ typedef struct Event
+ {
+	uint64_t when;                 //cycle it is due at
+	Event_Handler fn;
+	void *opaque;
+	struct Event *next;
+	struct Event **prev;           //link pointing at this one; 0 while not scheduled
+	unsigned int slot;             //level * SCHED_SLOTS + slot it is in, SCHED_LATER for later
+ } Event;
+ 
+ #define SCHED_LEVELS 4
+ #define SCHED_BITS 8
+ #define SCHED_SLOTS (1 << SCHED_BITS)
+ #define SCHED_LATER (SCHED_LEVELS * SCHED_SLOTS)
+ 
+ /* hierarchical timing wheel.  Level L slot i holds the events due in the
+  * i-th 2^(8L) cycle window of the current 2^(8L + 8) window, so level 0 is
+  * exact to the cycle and level 3 reaches about 74 seconds ahead; anything
+  * further waits in later.  Adding or cancelling is O(1).  Only the earliest
+  * deadline matters to the CPU and it goes in cpu->next_event; a higher
+  * level slot's deadline is its start, where its events are spread over
+  * the levels below */
+ typedef struct Sched
+ {
+	uint64_t now;                  //cycle the wheel has been advanced to, at most cpu->cycles
+	Event *slots[SCHED_LEVELS][SCHED_SLOTS];
+	uint64_t used[SCHED_LEVELS][SCHED_SLOTS / 64];  //bit per non-empty slot, so finding the next is a few word tests
+	Event *later;                  //unordered, beyond the top level
+	int realtime;                  //hold guest time back to the wall clock, see Sched_Realtime()
+	uint64_t base_ns, base_cycles; //a host time and the cycle count that lines up with it
+ } Sched;
+ 
+ /* what a snapshot keeps of the wheel.  The events themselves live in the
+  * peripherals' structs, which the snapshot copies back first; every event
+  * pending when it was taken is pending again after Sched_Restore(), a
+  * front end's own included */
+ #define SCHED_SAVED 32
+ 
+ typedef struct
+ {
+	uint64_t now;
+	unsigned int count;
+	Event *events[SCHED_SAVED];
+	uint64_t when[SCHED_SAVED];
+ } Sched_State;
+ 
+ int Sched_Init(Cpu *cpu);         //returns 0 if out of memory
+ void Sched_Free(Cpu *cpu);
+ void Sched_Reset(Cpu *cpu);       //drop every event; peripherals schedule theirs again in their own reset
+ void Sched_Add(Cpu *cpu, Event *e, uint64_t when);  //(re)schedule e; pulls cpu->next_event in if it is earlier
+ void Sched_Cancel(Cpu *cpu, Event *e);              //unschedule e if it is pending
+ void Sched_Run(Cpu *cpu);         //cycles has reached next_event: run what is due, take an interrupt, set the next deadline
+ int Sched_Save(Cpu *cpu, Sched_State *state);           //0 if more than SCHED_SAVED events are pending
+ void Sched_Restore(Cpu *cpu, const Sched_State *state);  //after Sched_Reset() and copying back the structs the events are in
+ void Sched_Realtime(Cpu *cpu, int on);  //for interactive use: Sched_Run() sleeps until the host clock catches up with cycles
+ 
+ #define SCHED_PENDING(e) ((e)->prev != 0)
+ 
+ #endif
@@ -0,0 +1,346 @@
+/* =====================================================================
+ * snapshot.c
+ * saves and restores a whole machine, copying only the memory pages that changed
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #include <stdio.h>
+ #include <stdlib.h>
+ #include <string.h>
+ #include <fcntl.h>
+ #include <unistd.h>
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include "registers.h"
+ #include "memory.h"
+ #include "snapshot.h"
+ 
+ 
+ static void Release(Snapshot_Page *p)
+ {
+	if (p && --p->refs == 0)
+		free(p);
+ }
+ 
+ void Snapshot_Free(Snapshot *s)
+ {
+	uint32_t i;
+	if (!s || --s->refs)
+		return;
+	for (i = 0; s->page && i < s->pages; ++i)
+		Release(s->page[i]);
+	free(s->page);
+	free(s);
+ }
+ 
+ static Event *Machine_Event(Cpu *cpu, unsigned int i)  //the peripherals' own events, in file order; 0 if that one isn't there
+ {
+	if (i < TMU_CHANNELS)
+		return &cpu->tmu->ch[i].underflow;
+	i -= TMU_CHANNELS;
+	if (i == 0)
+		return &cpu->rtc->tick;
+	if (i == 1)
+		return &cpu->lcd->frame;
+	return cpu->keyboard ? &cpu->keyboard->scan : 0;
+ }
+ 
+ static void Save_Machine(Cpu *cpu, Snapshot_Machine *m)
+ {
+	memcpy(m->context, cpu, SNAPSHOT_CONTEXT);
+	m->cycles = cpu->cycles;
+	m->sleeping = cpu->sleeping;
+	m->intc = *cpu->intc;
+	m->tmu = *cpu->tmu;
+	m->rtc = *cpu->rtc;
+	m->lcd = *cpu->lcd;
+	if (cpu->keyboard)
+		m->keyboard = *cpu->keyboard;
+	m->mmu = *cpu->mmu;
+ }
+ 
+ /* the peripherals are copied whole, but their events keep this process's
+  * handlers and the host side of the LCD stays as it is; memory put back
+  * is seen as stored to, so the screen catches up at the next frame */
+ static void Restore_Machine(Cpu *cpu, const Snapshot_Machine *m, const Sched_State *sched)
+ {
+	uint32_t md = cpu->sr & SR_MD;
+	Lcd_Host host = cpu->lcd->host;
+	Event live[SNAPSHOT_EVENTS], *e;
+	unsigned int i;
+	
+	if (memcmp(cpu->mmu, &m->mmu, offsetof(Mmu, cached))) {  //translations cached from the TLB as it is now are wrong
+		Mmu_Flush(cpu);
+		memcpy(cpu->mmu, &m->mmu, offsetof(Mmu, cached));
+	}
+	memcpy(cpu, m->context, SNAPSHOT_CONTEXT);
+	cpu->cycles = m->cycles;
+	cpu->sleeping = m->sleeping;
+	cpu->in_slot = 0;
+	if ((cpu->sr & SR_MD) != md)
+		Mmu_Rights(cpu);
+	
+	Sched_Reset(cpu);  //unlinks what is pending now while the links in the structs are still the live ones
+	for (i = 0; i < SNAPSHOT_EVENTS; ++i)
+		if ((e = Machine_Event(cpu, i)))
+			live[i] = *e;
+	*cpu->intc = m->intc;
+	*cpu->tmu = m->tmu;
+	*cpu->rtc = m->rtc;
+	*cpu->lcd = m->lcd;
+	cpu->lcd->host = host;
+	if (cpu->keyboard)
+		*cpu->keyboard = m->keyboard;
+	for (i = 0; i < SNAPSHOT_EVENTS; ++i)
+		if ((e = Machine_Event(cpu, i))) {
+			e->fn = live[i].fn;
+			e->opaque = live[i].opaque;
+		}
+	Sched_Restore(cpu, sched);
+ }
+ 
+ /* the new table starts as a copy of the last snapshot's, which memory
+  * only differs from in the dirty pages; those are the only ones copied,
+  * and Memory_Clean() starts watching them again */
+ Snapshot *Snapshot_Take(Cpu *cpu)
+ {
+	Memory *mem = cpu->mem;
+	Snapshot *base = cpu->snapshot, *s = calloc(1, sizeof(Snapshot));
+	Snapshot_Page *p;
+	uint32_t i, page;
+	
+	if (!s)
+		return 0;
+	s->refs = 1;
+	s->pages = mem->store_pages;
+	if (!(s->page = calloc(s->pages, sizeof(Snapshot_Page *))) || !Sched_Save(cpu, &s->sched)) {
+		Snapshot_Free(s);
+		return 0;
+	}
+	for (i = 0; base && i < base->pages; ++i)  //stores mapped since base are still as loaded
+		if ((s->page[i] = base->page[i]))
+			++s->page[i]->refs;
+	for (i = 0; i < mem->dirty_count; ++i) {
+		page = mem->dirty[i];
+		if (!(p = malloc(sizeof(Snapshot_Page)))) {
+			Snapshot_Free(s);
+			return 0;
+		}
+		p->refs = 1;
+		memcpy(p->data, Memory_Page(cpu, page), PAGE_SIZE);
+		Release(s->page[page]);
+		s->page[page] = p;
+	}
+	Memory_Clean(cpu);
+	Save_Machine(cpu, &s->machine);
+	s->cpu = cpu;
+	
+	++s->refs;  //one for cpu->snapshot
+	Snapshot_Free(base);
+	cpu->snapshot = s;
+	return s;
+ }
+ 
+ /* memory first: the dirty pages, and if s isn't the snapshot memory was
+  * last in step with, the pages where the two tables differ.  Nothing else
+  * is copied, and the blocks decoded from what is go with it */
+ int Snapshot_Restore(Cpu *cpu, Snapshot *s)
+ {
+	Memory *mem = cpu->mem;
+	const Snapshot *now = cpu->snapshot;
+	uint32_t i, page;
+	
+	if (s->cpu != cpu || s->pages != mem->store_pages)
+		return 0;
+	if (now != s)
+		for (i = 0; i < s->pages; ++i)
+			if ((now && i < now->pages ? now->page[i] : 0) != s->page[i])
+				Memory_Put_Page(cpu, i, s->page[i] ? s->page[i]->data : 0);
+	for (i = 0; i < mem->dirty_count; ++i) {
+		page = mem->dirty[i];
+		Memory_Put_Page(cpu, page, s->page[page] ? s->page[page]->data : 0);
+	}
+	Memory_Clean(cpu);
+	Restore_Machine(cpu, &s->machine, &s->sched);
+	
+	if (cpu->snapshot != s) {
+		++s->refs;
+		Snapshot_Free(cpu->snapshot);
+		cpu->snapshot = s;
+	}
+	return 1;
+ }
+ 
+ /* FNV-1a a word at a time, the tail a byte at a time, then the length so
+  * a missing file and an empty one differ.  A ROM is read once, by
+  * whoever makes the key, not per job */
+ uint64_t Snapshot_Key(uint64_t key, const char *path)
+ {
+	uint64_t buffer[512];
+	uint64_t length = 0;
+	size_t n, i;
+	FILE *f;
+	
+	if (strcmp(path, "-") && (f = fopen(path, "rb"))) {
+		while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+			for (i = 0; i < n / 8; ++i) {
+				key ^= buffer[i];
+				key *= 0x100000001b3ULL;
+			}
+			for (i = n & ~(size_t)7; i < n; ++i) {
+				key ^= ((const unsigned char *)buffer)[i];
+				key *= 0x100000001b3ULL;
+			}
+			length += n;
+		}
+		fclose(f);
+		++length;
+	}
+	key ^= length;
+	return key * 0x100000001b3ULL;
+ }
+ 
+ static int Changed(Cpu *cpu, uint32_t page)  //may differ from as loaded
+ {
+	const Snapshot *s = cpu->snapshot;
+	return (cpu->mem->dirty_bits[page >> 6] >> (page & 63) & 1) || (s && page < s->pages && s->page[page]);
+ }
+ 
+ static uint32_t Data_Offset(uint32_t count)
+ {
+	return (uint32_t)(sizeof(Snapshot_File) + count * sizeof(uint32_t) + PAGE_MASK) & ~(uint32_t)PAGE_MASK;
+ }
+ 
+ int Snapshot_Write(Cpu *cpu, const char *path, uint64_t key)
+ {
+	Memory *mem = cpu->mem;
+	Snapshot_File *h = calloc(1, sizeof(Snapshot_File));
+	uint32_t *index = malloc(mem->store_pages * sizeof(uint32_t)), i;
+	Sched_State sched;
+	char tmp[1024];
+	FILE *f = 0;
+	int ok = 0;
+	
+	if (!h || !index || !Sched_Save(cpu, &sched))
+		goto done;
+	memcpy(h->magic, SNAPSHOT_MAGIC, 8);
+	h->size = sizeof(Snapshot_File);
+	h->version = SNAPSHOT_VERSION;
+	h->key = key;
+	h->stores = mem->store_count;
+	for (i = 0; i < mem->store_count; ++i)
+		h->store_pages[i] = mem->stores[i].pages;
+	Save_Machine(cpu, &h->machine);
+	h->now = sched.now;
+	for (i = 0; i < SNAPSHOT_EVENTS; ++i) {
+		Event *e = Machine_Event(cpu, i);
+		h->when[i] = e && SCHED_PENDING(e) ? e->when : SNAPSHOT_IDLE;
+	}
+	for (i = 0; i < mem->store_pages; ++i)
+		if (Changed(cpu, i))
+			index[h->count++] = i;
+	
+	snprintf(tmp, sizeof(tmp), "%s.%ld.%lx", path, (long)getpid(), (unsigned long)(uintptr_t)cpu);  //batch threads may all be writing it
+	if (!(f = fopen(tmp, "wb")))
+		goto done;
+	ok = fwrite(h, sizeof(Snapshot_File), 1, f) == 1 && fwrite(index, sizeof(uint32_t), h->count, f) == h->count
+		&& fseek(f, Data_Offset(h->count), SEEK_SET) == 0;
+	for (i = 0; ok && i < h->count; ++i)
+		ok = fwrite(Memory_Page(cpu, index[i]), PAGE_SIZE, 1, f) == 1;
+	ok = fclose(f) == 0 && ok && rename(tmp, path) == 0;
+	if (!ok)
+		remove(tmp);
+ done:
+	free(h);
+	free(index);
+	return ok;
+ }
+ 
+ static int Fits(Cpu *cpu, const Snapshot_File *h, off_t size, uint64_t key)
+ {
+	const uint32_t *index = (const uint32_t *)(h + 1);
+	uint32_t i;
+	
+	if ((size_t)size < sizeof(Snapshot_File) || memcmp(h->magic, SNAPSHOT_MAGIC, 8) || h->size != sizeof(Snapshot_File)
+		|| h->version != SNAPSHOT_VERSION || h->key != key || h->stores != cpu->mem->store_count || h->count > cpu->mem->store_pages
+		|| (uint64_t)Data_Offset(h->count) + (uint64_t)h->count * PAGE_SIZE > (uint64_t)size)
+		return 0;
+	for (i = 0; i < h->stores; ++i)
+		if (h->store_pages[i] != cpu->mem->stores[i].pages)
+			return 0;
+	for (i = 0; i < h->count; ++i)
+		if (index[i] >= cpu->mem->store_pages)
+			return 0;
+	return 1;
+ }
+ 
+ /* the file is mapped and its pages copied in; every page that isn't in
+  * it goes back to as loaded if it might not be.  There is no snapshot in
+  * memory to be in step with afterwards, so the loaded pages count as
+  * dirty against as loaded */
+ int Snapshot_Load(Cpu *cpu, const char *path, uint64_t key)
+ {
+	const unsigned char **want = 0;
+	const Snapshot_File *h;
+	const uint32_t *index;
+	Sched_State sched;
+	struct stat st;
+	void *p = MAP_FAILED;
+	uint32_t i;
+	Event *e;
+	int ok = 0, fd = open(path, O_RDONLY);
+	
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return 0;
+	h = p;
+	index = (const uint32_t *)(h + 1);
+	if (!Fits(cpu, h, st.st_size, key) || !(want = calloc(cpu->mem->store_pages, sizeof(unsigned char *))))
+		goto done;
+	for (i = 0; i < h->count; ++i)
+		want[index[i]] = (const unsigned char *)p + Data_Offset(h->count) + (size_t)i * PAGE_SIZE;
+	for (i = 0; i < cpu->mem->store_pages; ++i)
+		if (want[i] || Changed(cpu, i))
+			Memory_Put_Page(cpu, i, want[i]);
+	Memory_Clean(cpu);
+	for (i = 0; i < h->count; ++i)
+		Memory_Dirty(cpu, index[i]);
+	Snapshot_Free(cpu->snapshot);
+	cpu->snapshot = 0;
+	
+	sched.now = h->now;
+	sched.count = 0;
+	for (i = 0; i < SNAPSHOT_EVENTS; ++i)
+		if (h->when[i] != SNAPSHOT_IDLE && (e = Machine_Event(cpu, i))) {
+			sched.events[sched.count] = e;
+			sched.when[sched.count++] = h->when[i];
+		}
+	Restore_Machine(cpu, &h->machine, &sched);
+	ok = 1;
+ done:
+	free(want);
+	munmap(p, st.st_size);
+	return ok;
+ }
@@ -0,0 +1,116 @@
+/* =====================================================================
+ * snapshot.h
+ * saves and restores a whole machine, copying only the memory pages that changed
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #ifndef SNAPSHOT_H
+ #define SNAPSHOT_H
+ 
+ #include <stddef.h>
+ #include "registers.h"
+ #include "memory.h"
+ #include "sched.h"
+ #include "intc.h"
+ #include "tmu.h"
+ #include "rtc.h"
+ #include "lcd.h"
+ #include "keyboard.h"
+ #include "mmu.h"
+ 
+ #define SNAPSHOT_CONTEXT offsetof(Cpu, page_read)  //r[] up to intevt, lazy T bit included
+ 
+ //everything but memory and the scheduler
+ typedef struct
+ {
+	unsigned char context[SNAPSHOT_CONTEXT];
+	uint64_t cycles;
+	uint32_t sleeping;
+	Intc intc;
+	Tmu tmu;
+	Rtc rtc;
+	Lcd lcd;
+	Keyboard keyboard;
+	Mmu mmu;
+ } Snapshot_Machine;
+ 
+ /* one copy of a store page (memory.h), shared by every snapshot it is
+  * still current in */
+ typedef struct
+ {
+	unsigned int refs;
+	unsigned char data[PAGE_SIZE];
+ } Snapshot_Page;
+ 
+ /* a snapshot has its own table of every store page, but a page only gets
+  * copied when it is on the dirty list as the snapshot is taken; the rest
+  * are shared with the snapshot before, and 0 means still as loaded.  The
+  * Cpu keeps the last snapshot it took or went back to in cpu->snapshot,
+  * and memory only differs from that one in the dirty pages, so going
+  * back to it touches nothing else.  Snapshots belong to the Cpu that took
+  * them; the events and peripherals in them are that Cpu's */
+ typedef struct Snapshot
+ {
+	unsigned int refs;                 //the owner's and cpu->snapshot
+	Cpu *cpu;
+	Snapshot_Machine machine;
+	Sched_State sched;
+	uint32_t pages;                    //store pages when it was taken
+	Snapshot_Page **page;
+ } Snapshot;
+ 
+ Snapshot *Snapshot_Take(Cpu *cpu);            //0 if out of memory or too many events are pending
+ int Snapshot_Restore(Cpu *cpu, Snapshot *s);  //go back to s; 0 if it is another Cpu's or memory was mapped since
+ void Snapshot_Free(Snapshot *s);
+ 
+ /* on disk, e.g. the machine as it is once the OS has booted.  A file has
+  * the machine, the deadlines of the peripherals' own events and every
+  * store page that isn't as loaded, page aligned after the header.  It
+  * only goes back into a Cpu with the same images loaded in the same
+  * order and the same build of the emulator; key is whatever the caller
+  * wants to tie it to, and a file made with another key doesn't load.
+  * size catches a changed layout, SNAPSHOT_VERSION the rest: bump it
+  * whenever what is saved or what the emulator does with it changes but
+  * the structs don't.  Front end events are not saved */
+ #define SNAPSHOT_MAGIC "PRIZMSS3"
+ #define SNAPSHOT_VERSION 1
+ #define SNAPSHOT_EVENTS (TMU_CHANNELS + 3)  //TMU underflows, RTC tick, LCD frame, key scan
+ #define SNAPSHOT_IDLE UINT64_MAX           //when of an event that wasn't pending
+ 
+ typedef struct
+ {
+	char magic[8];
+	uint32_t size;                     //of this header; it changes with the build
+	uint32_t version;                  //SNAPSHOT_VERSION
+	uint64_t key;
+	uint32_t count;                    //pages after it
+	uint32_t stores, store_pages[MAX_STORES];
+	Snapshot_Machine machine;          //pointers in it are ignored
+	uint64_t now;
+	uint64_t when[SNAPSHOT_EVENTS];
+	//then count page numbers, padding to PAGE_SIZE and count pages
+ } Snapshot_File;
+ 
+ uint64_t Snapshot_Key(uint64_t key, const char *path);  //mix in a file's contents and length; path "-" or one that can't be read is none
+ int Snapshot_Write(Cpu *cpu, const char *path, uint64_t key);  //0 on failure; written to a temporary name and renamed
+ int Snapshot_Load(Cpu *cpu, const char *path, uint64_t key);   //0 if there is no such file or it doesn't fit this Cpu
+ 
+ #endif
@@ -0,0 +1,115 @@
+/* =====================================================================
+ * spsc.h
+ * provides a bounded single producer, single consumer queue
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #ifndef SPSC_H
+ #define SPSC_H
+ 
+ #include <stdlib.h>
+ #include <stdatomic.h>
+ 
+ /* one thread pushes, one other thread pops, neither ever waits: a push
+  * into a full queue and a pop from an empty one just return 0.  head and
+  * tail each sit on their own cache line with the other side's copy of
+  * the one it doesn't own, so a side only reads the other's line when its
+  * copy says the queue is full or empty.  The queue itself is malloc'd
+  * with the same alignment, see Spsc_New() */
+ typedef struct
+ {
+	unsigned int kind, arg;        //what they mean is up to whoever posts them
+	void *data;
+ } Spsc_Msg;
+ 
+ typedef struct
+ {
+	_Alignas(64) atomic_uint head;  //next entry to fill; only the producer stores it
+	unsigned int tail_seen;        //producer's last look at tail
+	_Alignas(64) atomic_uint tail;  //next entry to empty; only the consumer stores it
+	unsigned int head_seen;        //consumer's last look at head
+	_Alignas(64) unsigned int mask;  //size - 1, size a power of 2
+	Spsc_Msg *msgs;
+ } Spsc;
+ 
+ static inline Spsc *Spsc_New(unsigned int size)  //0 if out of memory
+ {
+	Spsc *q = aligned_alloc(64, sizeof(Spsc));  //sizeof(Spsc) is a whole number of cache lines
+	if (!q)
+		return 0;
+	if (!(q->msgs = malloc(size * sizeof(Spsc_Msg)))) {
+		free(q);
+		return 0;
+	}
+	atomic_init(&q->head, 0);
+	atomic_init(&q->tail, 0);
+	q->tail_seen = q->head_seen = 0;
+	q->mask = size - 1;
+	return q;
+ }
+ 
+ static inline void Spsc_Free(Spsc *q)
+ {
+	if (q)
+		free(q->msgs);
+	free(q);
+ }
+ 
+ static inline unsigned int Spsc_Room(Spsc *q)  //producer only; room can only grow until its next push
+ {
+	unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	q->tail_seen = atomic_load_explicit(&q->tail, memory_order_acquire);
+	return q->mask + 1 - (head - q->tail_seen);
+ }
+ 
+ static inline int Spsc_Push(Spsc *q, unsigned int kind, unsigned int arg, void *data)  //producer only; 0 if full
+ {
+	unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	Spsc_Msg *m;
+	
+	if (head - q->tail_seen > q->mask) {
+		q->tail_seen = atomic_load_explicit(&q->tail, memory_order_acquire);
+		if (head - q->tail_seen > q->mask)
+			return 0;
+	}
+	m = &q->msgs[head & q->mask];
+	m->kind = kind;
+	m->arg = arg;
+	m->data = data;
+	atomic_store_explicit(&q->head, head + 1, memory_order_release);  //publishes *m and whatever data points at
+	return 1;
+ }
+ 
+ static inline int Spsc_Pop(Spsc *q, Spsc_Msg *m)  //consumer only; 0 if empty
+ {
+	unsigned int tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	
+	if (tail == q->head_seen) {
+		q->head_seen = atomic_load_explicit(&q->head, memory_order_acquire);
+		if (tail == q->head_seen)
+			return 0;
+	}
+	*m = q->msgs[tail & q->mask];
+	atomic_store_explicit(&q->tail, tail + 1, memory_order_release);  //the entry can be filled again
+	return 1;
+ }
+ 
+ #endif
@@ -0,0 +1,169 @@
+/* =====================================================================
+ * tmu.c
+ * emulates the TMU timers as scheduled underflows
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #include <stdlib.h>
+ #include "registers.h"
+ #include "memory.h"
+ #include "intc.h"
+ #include "sched.h"
+ #include "tmu.h"
+ 
+ 
+ static const unsigned int Prescale[8] = { 4, 16, 64, 256, 1024, 1024, 1024, 1024 };  //5-7 (RTC, external clock) aren't wired up
+ 
+ static uint64_t Scale(const Tmu_Channel *c)  //CPU cycles per count
+ {
+	return (uint64_t)Prescale[c->tcr & TCR_TPSC] * PCLK_DIV;
+ }
+ 
+ static uint32_t Count(Cpu *cpu, const Tmu_Channel *c)  //TCNT right now
+ {
+	uint64_t ticks;
+	if (!(cpu->tmu->tstr & (1 << c->index)))
+		return c->tcnt;
+	ticks = (cpu->cycles - c->start) / Scale(c);
+	return ticks > c->tcnt ? 0 : c->tcnt - (uint32_t)ticks;  //the underflow is due but hasn't been run yet
+ }
+ 
+ static void Schedule(Cpu *cpu, Tmu_Channel *c)  //the underflow tcnt counts from start lead to, if the channel runs
+ {
+	if (cpu->tmu->tstr & (1 << c->index))
+		Sched_Add(cpu, &c->underflow, c->start + ((uint64_t)c->tcnt + 1) * Scale(c));
+	else
+		Sched_Cancel(cpu, &c->underflow);
+ }
+ 
+ static void Underflow(Cpu *cpu, void *opaque)  //TCNT went past 0: reload from TCOR and go round again
+ {
+	Tmu_Channel *c = opaque;
+	c->start = c->underflow.when;  //when it happened, not when the block boundary got here
+	c->tcnt = c->tcor;
+	c->tcr |= TCR_UNF;
+	if (c->tcr & TCR_UNIE)
+		Intc_Raise(cpu, INTC_TMU0 + c->index);
+	Schedule(cpu, c);
+ }
+ 
+ static uint32_t Tmu_Read(void *opaque, uint32_t addr, int size)
+ {
+	Cpu *cpu = opaque;
+	Tmu *t = cpu->tmu;
+	uint32_t off = addr - TMU_CHANNEL(0);
+	Tmu_Channel *c;
+	
+	if (addr < TMU_CHANNEL(0))
+		return addr == TMU_TSTR ? t->tstr : 0;
+	if (off >= TMU_CHANNELS * 12)
+		return 0;
+	c = &t->ch[off / 12];
+	switch (off % 12) {
+	case 0: return c->tcor;
+	case 4:
+		cpu->clock_read = 1;  //changes between events, so polling it is not idle
+		return Count(cpu, c);
+	case 8: return c->tcr;
+	}
+	return 0;
+ }
+ 
+ static void Tmu_Write(void *opaque, uint32_t addr, uint32_t value, int size)
+ {
+	Cpu *cpu = opaque;
+	Tmu *t = cpu->tmu;
+	uint32_t off = addr - TMU_CHANNEL(0);
+	unsigned int i, changed;
+	Tmu_Channel *c;
+	
+	if (addr < TMU_CHANNEL(0)) {
+		if (addr != TMU_TSTR)
+			return;
+		changed = (t->tstr ^ value) & 7;
+		for (i = 0; i < TMU_CHANNELS; ++i)
+			if (changed & (1 << i)) {
+				c = &t->ch[i];
+				c->tcnt = Count(cpu, c);  //where it stopped, or where it starts from
+				c->start = cpu->cycles;
+				t->tstr ^= 1 << i;
+				Schedule(cpu, c);
+			}
+		return;
+	}
+	if (off >= TMU_CHANNELS * 12)
+		return;
+	c = &t->ch[off / 12];
+	switch (off % 12) {
+	case 0:
+		c->tcor = value;
+		break;
+	case 4:
+		c->tcnt = value;
+		c->start = cpu->cycles;
+		Schedule(cpu, c);
+		break;
+	case 8:
+		c->tcnt = Count(cpu, c);  //counted so far at the old prescaler
+		c->start = cpu->cycles;
+		c->tcr = (value & (TCR_UNIE | TCR_TPSC)) | (c->tcr & value & TCR_UNF);
+		if ((c->tcr & TCR_UNF) && (c->tcr & TCR_UNIE))
+			Intc_Raise(cpu, INTC_TMU0 + c->index);
+		else
+			Intc_Clear(cpu, INTC_TMU0 + c->index);
+		Schedule(cpu, c);
+		break;
+	}
+ }
+ 
+ int Tmu_Init(Cpu *cpu)
+ {
+	Tmu *t = calloc(1, sizeof(Tmu));
+	unsigned int i;
+	if (!t)
+		return 0;
+	for (i = 0; i < TMU_CHANNELS; ++i) {
+		t->ch[i].index = i;
+		t->ch[i].underflow.fn = Underflow;
+		t->ch[i].underflow.opaque = &t->ch[i];
+	}
+	cpu->tmu = t;
+	Memory_Map_IO(cpu, TMU_BASE, 8 + TMU_CHANNELS * 12, Tmu_Read, Tmu_Write, cpu, "TMU");
+	return 1;
+ }
+ 
+ void Tmu_Free(Cpu *cpu)
+ {
+	free(cpu->tmu);
+	cpu->tmu = 0;
+ }
+ 
+ void Tmu_Reset(Cpu *cpu)  //after Sched_Reset(), so no underflow is still pending
+ {
+	Tmu *t = cpu->tmu;
+	unsigned int i;
+	t->tstr = 0;
+	for (i = 0; i < TMU_CHANNELS; ++i) {
+		t->ch[i].tcor = t->ch[i].tcnt = 0xffffffff;
+		t->ch[i].tcr = 0;
+		t->ch[i].start = cpu->cycles;
+	}
+ }
@@ -0,0 +1,62 @@
+/* =====================================================================
+ * tmu.h
+ * provides the three channel timer unit
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #ifndef TMU_H
+ #define TMU_H
+ 
+ #include "registers.h"
+ #include "sched.h"
+ 
+ #define TMU_BASE 0xa4490000
+ #define TMU_TSTR 0xa4490004       //byte, bit n runs channel n
+ #define TMU_CHANNEL(n) (0xa4490008 + (n) * 12)  //TCOR, TCNT (32 bit), TCR (16 bit)
+ #define TMU_CHANNELS 3
+ 
+ #define TCR_UNF  0x0100           //underflowed; cleared by writing 0
+ #define TCR_UNIE 0x0020           //underflow raises TUNIn
+ #define TCR_TPSC 0x0007           //peripheral clock / 4, 16, 64, 256, 1024
+ 
+ /* TCNT isn't counted down: while a channel runs it is worked out from
+  * cpu->cycles when read, and the only thing scheduled is the underflow */
+ typedef struct
+ {
+	uint32_t tcor;
+	uint32_t tcnt;                 //value at start
+	uint16_t tcr;
+	unsigned int index;
+	uint64_t start;                //cycle of the last whole count tcnt is current at
+	Event underflow;
+ } Tmu_Channel;
+ 
+ typedef struct Tmu
+ {
+	uint8_t tstr;
+	Tmu_Channel ch[TMU_CHANNELS];
+ } Tmu;
+ 
+ int Tmu_Init(Cpu *cpu);           //map the registers; returns 0 if out of memory
+ void Tmu_Free(Cpu *cpu);
+ void Tmu_Reset(Cpu *cpu);         //every channel stopped, TCOR/TCNT all ones
+ 
+ #endif
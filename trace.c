@@ -0,0 +1,216 @@
+/* =====================================================================
+ * trace.c
+ * records every instruction the cpu runs into a trace file
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #include <stdlib.h>
+ #include <string.h>
+ #include <unistd.h>
+ #include "registers.h"
+ #include "memory.h"
+ #include "decode.h"
+ #include "block.h"
+ #include "companion.h"
+ #include "profile.h"
+ #include "trace.h"
+ 
+ #ifdef TRACE
+ 
+ static void Write_Chunk(Cpu *cpu, const Spsc_Msg *m, void *opaque)  //companion thread, or the CPU thread without one
+ {
+	Trace *t = opaque;
+	Trace_Chunk *c = m->data;
+	Trace_Write_Chunk(t->file, c->records, c->count, c->cycle);
+	Spsc_Push(t->done, 0, 0, c);  //there is room for all of them
+ }
+ 
+ static void Ship(Cpu *cpu, Trace *t)  //hand the chunk being filled over to be written
+ {
+	Spsc_Msg m;
+	
+	if (t->posting && cpu->companion == t->posting) {
+		while (!Companion_Room(cpu)) {
+			++t->waits;
+			usleep(100);
+		}
+		Companion_Post(cpu, COMPANION_TRACE, 0, t->chunk);
+	} else {
+		m.data = t->chunk;
+		Write_Chunk(cpu, &m, t);
+	}
+	t->chunk = 0;
+ }
+ 
+ static void Next_Chunk(Trace *t)
+ {
+	Spsc_Msg m;
+	
+	while (!Spsc_Pop(t->done, &m)) {
+		if (t->chunks < TRACE_CHUNKS && (m.data = malloc(sizeof(Trace_Chunk)))) {
+			++t->chunks;
+			break;
+		}
+		++t->waits;  //all of them are with the companion
+		usleep(100);
+	}
+	t->chunk = m.data;
+	t->chunk->count = 0;
+ }
+ 
+ static inline void Open(Cpu *cpu, Trace *t, uint16_t op, unsigned int flags)
+ {
+	Trace_Record *r = &t->chunk->records[t->chunk->count];
+	
+	if (!t->chunk->count)
+		t->chunk->cycle = cpu->cycles;
+	r->pc = cpu->pc;
+	r->op = op;
+	r->flags = (uint8_t)flags;
+	memcpy(t->before, cpu->r, sizeof(cpu->r));
+	t->before[TRACE_PR] = cpu->pr;
+	cpu->trace_addr = TRACE_NO_ADDR;
+	t->open = 1;
+ }
+ 
+ static inline void Close(Cpu *cpu, Trace *t, unsigned int flags)
+ {
+	Trace_Record *r = &t->chunk->records[t->chunk->count];
+	uint32_t changed = 0;
+	unsigned int i;
+	
+	for (i = 0; i < 16; ++i)  //no early out, so it compiles to a few vector compares
+		changed |= (uint32_t)(cpu->r[i] != t->before[i]) << i;
+	if (changed) {
+		i = (unsigned int)__builtin_ctz(changed);
+		r->reg = (uint8_t)i;
+		r->value = cpu->r[i];
+	} else if (cpu->pr != t->before[TRACE_PR]) {
+		r->reg = TRACE_PR;
+		r->value = cpu->pr;
+	} else {
+		r->reg = TRACE_NO_REG;
+		r->value = 0;
+	}
+	r->addr = 0;
+	if (cpu->trace_addr != TRACE_NO_ADDR) {
+		r->flags |= TRACE_ADDR;
+		r->addr = (uint32_t)cpu->trace_addr;
+	}
+	r->flags |= flags | (GET_T(cpu) ? TRACE_T : 0);
+	t->open = 0;
+	if (++t->chunk->count == TRACE_CHUNK) {
+		Ship(cpu, t);
+		Next_Chunk(t);
+	}
+ }
+ 
+ int Trace_Start(Cpu *cpu, const char *path)
+ {
+	Trace *t;
+	
+	if (cpu->trace)
+		Trace_Stop(cpu);
+	if (!(t = calloc(1, sizeof(Trace))))
+		return 0;
+	if (!(t->done = Spsc_New(TRACE_CHUNKS)) || !(t->chunk = malloc(sizeof(Trace_Chunk))) || !(t->file = Trace_Create(path))) {
+		free(t->chunk);
+		Spsc_Free(t->done);
+		free(t);
+		return 0;
+	}
+	t->chunks = 1;
+	t->chunk->count = 0;
+	if (cpu->companion) {
+		Companion_Handle(cpu, COMPANION_TRACE, Write_Chunk, t);
+		t->posting = cpu->companion;
+	}
+	cpu->trace = t;
+	return 1;
+ }
+ 
+ int Trace_Stop(Cpu *cpu)
+ {
+	Trace *t = cpu->trace;
+	Spsc_Msg m;
+	int ok;
+	
+	if (!t)
+		return 1;
+	if (t->open)
+		Close(cpu, t, TRACE_FAULT);
+	if (t->chunk->count)
+		Ship(cpu, t);
+	else {
+		free(t->chunk);
+		--t->chunks;
+	}
+	while (t->chunks) {  //every one back means every one written
+		if (Spsc_Pop(t->done, &m)) {
+			free(m.data);
+			--t->chunks;
+		} else
+			usleep(100);
+	}
+	ok = Trace_Close(t->file);
+	Spsc_Free(t->done);
+	free(t);
+	cpu->trace = 0;
+	return ok;
+ }
+ 
+ /* the block Block_Run() would have run, one instruction at a time as
+  * Step() does, so fused entries and native code never hide one.  An
+  * exception longjmps out with the record still open; it is closed as a
+  * fault when the next block starts */
+ void Trace_Run(Cpu *cpu)
+ {
+	Trace *t = cpu->trace;
+	const Decoded *e;
+	uint16_t op;
+	unsigned int i;
+	
+	if (t->open)
+		Close(cpu, t, TRACE_FAULT);
+	for (i = 0; i < BLOCK_MAX; ++i) {
+		op = (uint16_t)Read_Word(cpu, cpu->pc);
+		e = &Decode_Table[op];
+		Open(cpu, t, op, 0);
+		cpu->cycles += e->cycles;
+ #ifdef PROFILE
+		Profile_Count(cpu, e->kind);
+ #endif
+		e->fn(cpu, e->a, e->b);
+		Close(cpu, t, 0);
+		if (e->flags & DECODE_BRANCH)
+			break;
+	}
+ }
+ 
+ void Trace_Slot(Cpu *cpu, uint16_t op)
+ {
+	Trace *t = cpu->trace;
+	cpu->trace_addr = TRACE_NO_ADDR;  //that was the slot's fetch; delayed branches don't touch memory themselves
+	Close(cpu, t, 0);
+	Open(cpu, t, op, TRACE_SLOT);
+ }
+ 
+ #endif
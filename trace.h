@@ -0,0 +1,70 @@
+/* =====================================================================
+ * trace.h
+ * records every instruction the cpu runs into a trace file
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #ifndef TRACE_H
+ #define TRACE_H
+ 
+ #include "registers.h"
+ 
+ #ifdef TRACE  //build with -DTRACE to be able to trace, see trace.c
+ #include "spsc.h"
+ #include "tracefile.h"
+ 
+ #define TRACE_CHUNKS 4            //chunks filled or being written at once; power of 2
+ #define TRACE_NO_ADDR (~0ULL)     //cpu->trace_addr when nothing was read or written
+ 
+ typedef struct
+ {
+	uint64_t cycle;                //when records[0] started
+	uint32_t count;
+	Trace_Record records[TRACE_CHUNK];
+ } Trace_Chunk;
+ 
+ /* while a trace is on, Block_Run() hands every block to Trace_Run(),
+  * which runs it an instruction at a time from Decode_Table with no
+  * fusion, idle skipping or JIT, and appends a record per instruction to
+  * the chunk being filled.  Full chunks go to the companion (companion.h)
+  * to be coded and written, and come back through done; with no companion
+  * the CPU thread writes them itself.  The trace is complete: if every
+  * chunk is out the CPU thread waits for one rather than drop records */
+ typedef struct Trace
+ {
+	Trace_Chunk *chunk;            //being filled
+	Trace_File *file;              //only the companion touches it while one is running
+	struct Companion *posting;     //the companion the chunks go to, 0 to write them here
+	Spsc *done;                    //back to the CPU thread: chunks written
+	unsigned int chunks;           //allocated, up to TRACE_CHUNKS
+	int open;                      //chunk->records[chunk->count] is started, see Trace_Slot()
+	uint32_t before[TRACE_PR + 1]; //registers when it started
+	uint64_t waits;                //times the CPU thread caught up with the writer
+ } Trace;
+ 
+ int Trace_Start(Cpu *cpu, const char *path);  //start the companion first to have it write; 0 if path can't be created or out of memory
+ int Trace_Stop(Cpu *cpu);         //write what is left and the index; 0 if any write failed
+ void Trace_Run(Cpu *cpu);         //the block at PC, traced
+ void Trace_Slot(Cpu *cpu, uint16_t op);  //from Delay_Slot(): the branch is done, op in its slot starts
+ 
+ #endif
+ 
+ #endif
@@ -0,0 +1,173 @@
+/* =====================================================================
+ * tracedump.c
+ * prints and compares instruction traces written with -DTRACE
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ /* usage: tracedump [-n first] [-c count] trace
+  *        tracedump -d trace other
+  *
+  * builds on its own:  gcc -O2 tracedump.c tracefile.c -o tracedump
+  *
+  * The first form prints count records (all of them by default) from
+  * record number first on, one a line:
+  *
+  *    number  pc  opcode  [rN|pr=value]  [@address]  [T] [slot] [fault]
+  *
+  * decoding only the chunk first is in and those after it.  -d reads two
+  * traces side by side and prints the first record where they differ with
+  * a few before it for context, or nothing if they are the same.  Like
+  * cmp it exits 0 if they are the same, 1 if not and 2 on trouble */
+ 
+ #include <stdio.h>
+ #include <stdlib.h>
+ #include <string.h>
+ #include "tracefile.h"
+ 
+ #define CONTEXT 8                 //records shown before a difference
+ 
+ static void Print(uint64_t n, const Trace_Record *r, const char *mark)
+ {
+	printf("%s%12llu  %08x  %04x", mark, (unsigned long long)n, r->pc, r->op);
+	if (r->reg == TRACE_PR)
+		printf("  pr=%08x", r->value);
+	else if (r->reg != TRACE_NO_REG)
+		printf("  r%-2u=%08x", r->reg, r->value);
+	else
+		printf("             ");
+	if (r->flags & TRACE_ADDR)
+		printf("  @%08x", r->addr);
+	else
+		printf("           ");
+	printf("%s%s%s\n", r->flags & TRACE_T ? "  T" : "", r->flags & TRACE_SLOT ? "  slot" : "",
+		r->flags & TRACE_FAULT ? "  fault" : "");
+ }
+ 
+ static int Same(const Trace_Record *a, const Trace_Record *b)
+ {
+	return a->pc == b->pc && a->op == b->op && a->reg == b->reg && a->value == b->value && a->flags == b->flags
+		&& a->addr == b->addr;
+ }
+ 
+ static int Dump(Trace_File *t, uint64_t first, uint64_t count, Trace_Record *r)
+ {
+	uint64_t chunk = Trace_Find(t, first), n;
+	uint32_t got, i;
+	
+	printf("#%llu records in %llu chunks\n", (unsigned long long)t->records, (unsigned long long)t->chunks);
+	for (; chunk < t->chunks && count; ++chunk) {
+		if (!(got = Trace_Read_Chunk(t, chunk, r)))
+			return 0;
+		printf("#chunk %llu at cycle %llu\n", (unsigned long long)chunk, (unsigned long long)t->index[chunk].cycle);
+		for (i = 0, n = t->index[chunk].first; i < got && count; ++i, ++n)
+			if (n >= first) {
+				Print(n, &r[i], " ");
+				--count;
+			}
+	}
+	return 1;
+ }
+ 
+ /* chunks needn't line up, so each side is read a chunk at a time and
+  * compared as far as both have records; 1 if they are the same, 2 if
+  * not, 0 if one couldn't be read */
+ static int Diff(Trace_File *a, Trace_File *b, Trace_Record *ra, Trace_Record *rb)
+ {
+	uint64_t ca = 0, cb = 0, n = 0, k;
+	uint32_t ia = 0, ib = 0, na = 0, nb = 0;
+	
+	for (;;) {
+		if (ia == na) {
+			if (ca == a->chunks)
+				break;
+			if (!(na = Trace_Read_Chunk(a, ca++, ra)))
+				return 0;
+			ia = 0;
+		}
+		if (ib == nb) {
+			if (cb == b->chunks)
+				break;
+			if (!(nb = Trace_Read_Chunk(b, cb++, rb)))
+				return 0;
+			ib = 0;
+		}
+		if (!Same(&ra[ia], &rb[ib])) {
+			for (k = ia < ib ? ia : ib, k = k < CONTEXT ? k : CONTEXT; k; --k)  //what came before, from the chunks in hand
+				Print(n - k, &ra[ia - k], " ");
+			Print(n, &ra[ia], "<");
+			Print(n, &rb[ib], ">");
+			return 2;
+		}
+		++ia;
+		++ib;
+		++n;
+	}
+	if (a->records != b->records) {
+		printf("#same for %llu records, then %s ends\n", (unsigned long long)n, a->records < b->records ? "the first" : "the second");
+		return 2;
+	}
+	return 1;
+ }
+ 
+ int main(int argc, char **argv)
+ {
+	uint64_t first = 0, count = (uint64_t)-1;
+	Trace_File *a, *b = 0;
+	Trace_Record *ra, *rb = 0;
+	int diff = 0, ok;
+	
+	while (argc > 2 && argv[1][0] == '-' && argv[1][1] && !argv[1][2]) {
+		if (argv[1][1] == 'n')
+			first = strtoull(argv[2], 0, 0);
+		else if (argv[1][1] == 'c')
+			count = strtoull(argv[2], 0, 0);
+		else if (argv[1][1] == 'd') {
+			diff = 1;
+			argc -= 1;
+			argv += 1;
+			break;
+		} else
+			break;
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc != 2 + diff) {
+		fprintf(stderr, "usage: tracedump [-n first] [-c count] trace\n       tracedump -d trace other\n");
+		return 2;
+	}
+	if (!(a = Trace_Open(argv[1])) || (diff && !(b = Trace_Open(argv[2])))) {
+		fprintf(stderr, "tracedump: %s isn't a complete trace\n", a ? argv[2] : argv[1]);
+		return 2;
+	}
+	if (!(ra = malloc(TRACE_CHUNK * sizeof(Trace_Record))) || (diff && !(rb = malloc(TRACE_CHUNK * sizeof(Trace_Record))))) {
+		fprintf(stderr, "tracedump: out of memory\n");
+		return 2;
+	}
+	ok = diff ? Diff(a, b, ra, rb) : Dump(a, first, count, ra);
+	if (!ok)
+		fprintf(stderr, "tracedump: bad chunk\n");
+	Trace_Close(a);
+	if (b)
+		Trace_Close(b);
+	free(ra);
+	free(rb);
+	return ok ? ok - 1 : 2;
+ }
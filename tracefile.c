@@ -0,0 +1,304 @@
+/* =====================================================================
+ * tracefile.c
+ * codes instruction traces into chunks and reads them back
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #include <stdio.h>
+ #include <stdlib.h>
+ #include <string.h>
+ #include "tracefile.h"
+ 
+ /* a coded record is a byte of flags, then only what can't be guessed
+  * from the records before it in the chunk: the PC unless it is the last
+  * one + 2, the opcode unless it is what that PC held last time, the
+  * register's new value as a difference from its last value seen, and the
+  * address as a difference from the last address.  Differences are zigzag
+  * varints, so a straight run of register ops is 2 or 3 bytes a record
+  * against 16 raw.  The low 4 flag bits are the record's own TRACE_* */
+ #define JUMP   0x10               //PC follows
+ #define NEW_OP 0x20               //opcode follows
+ #define REG    0x40               //reg and value follow
+ 
+ #define OPS 1024                  //opcodes remembered by PC
+ 
+ typedef struct
+ {
+	uint32_t pc, addr;
+	uint32_t regs[TRACE_PR + 1];
+	uint32_t seen_pc[OPS];         //odd if the slot is empty
+	uint16_t seen_op[OPS];
+ } Coder;
+ 
+ static void Coder_Reset(Coder *c)
+ {
+	memset(c, 0, sizeof(Coder));
+	c->pc = (uint32_t)-2;  //so a first record at 0 needs no PC
+	memset(c->seen_pc, 0xff, sizeof(c->seen_pc));
+ }
+ 
+ static unsigned char *Put(unsigned char *out, uint32_t delta)
+ {
+	uint32_t v = delta << 1 ^ (uint32_t)((int32_t)delta >> 31);  //zigzag: small either way is small
+	while (v >= 0x80) {
+		*out++ = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	*out++ = (unsigned char)v;
+	return out;
+ }
+ 
+ static const unsigned char *Get(const unsigned char *in, const unsigned char *end, uint32_t *delta)
+ {
+	uint32_t v = 0;
+	unsigned int shift;
+	
+	for (shift = 0; shift < 35; shift += 7) {
+		if (in == end)
+			return 0;
+		v |= (uint32_t)(*in & 0x7f) << shift;
+		if (!(*in++ & 0x80)) {
+			*delta = v >> 1 ^ -(v & 1);
+			return in;
+		}
+	}
+	return 0;
+ }
+ 
+ size_t Trace_Encode(const Trace_Record *r, uint32_t count, unsigned char *out)
+ {
+	Coder *c = malloc(sizeof(Coder));
+	unsigned char *start = out, *flags;
+	uint32_t i, k;
+	
+	if (!c)
+		return 0;
+	Coder_Reset(c);
+	for (i = 0; i < count; ++i, ++r) {
+		flags = out++;
+		*flags = r->flags & 0x0f;
+		if (r->pc != c->pc + 2) {
+			*flags |= JUMP;
+			out = Put(out, r->pc - (c->pc + 2));
+		}
+		c->pc = r->pc;
+		k = (r->pc >> 1) & (OPS - 1);
+		if (c->seen_pc[k] != r->pc || c->seen_op[k] != r->op) {
+			*flags |= NEW_OP;
+			*out++ = (unsigned char)r->op;
+			*out++ = (unsigned char)(r->op >> 8);
+			c->seen_pc[k] = r->pc;
+			c->seen_op[k] = r->op;
+		}
+		if (r->reg <= TRACE_PR) {
+			*flags |= REG;
+			*out++ = r->reg;
+			out = Put(out, r->value - c->regs[r->reg]);
+			c->regs[r->reg] = r->value;
+		}
+		if (r->flags & TRACE_ADDR) {
+			out = Put(out, r->addr - c->addr);
+			c->addr = r->addr;
+		}
+	}
+	free(c);
+	return (size_t)(out - start);
+ }
+ 
+ int Trace_Decode(const unsigned char *in, size_t bytes, Trace_Record *r, uint32_t count)
+ {
+	const unsigned char *end = in + bytes;
+	Coder *c = malloc(sizeof(Coder));
+	uint32_t i, k, delta;
+	unsigned int flags;
+	
+	if (!c)
+		return 0;
+	Coder_Reset(c);
+	for (i = 0; i < count; ++i, ++r) {
+		if (in == end)
+			break;
+		flags = *in++;
+		r->flags = flags & 0x0f;
+		r->pc = c->pc + 2;
+		if (flags & JUMP) {
+			if (!(in = Get(in, end, &delta)))
+				break;
+			r->pc += delta;
+		}
+		c->pc = r->pc;
+		k = (r->pc >> 1) & (OPS - 1);
+		if (flags & NEW_OP) {
+			if (end - in < 2)
+				break;
+			c->seen_pc[k] = r->pc;
+			c->seen_op[k] = (uint16_t)(in[0] | in[1] << 8);
+			in += 2;
+		} else if (c->seen_pc[k] != r->pc)
+			break;
+		r->op = c->seen_op[k];
+		r->reg = TRACE_NO_REG;
+		r->value = 0;
+		if (flags & REG) {
+			if (in == end || *in > TRACE_PR)
+				break;
+			r->reg = *in++;
+			if (!(in = Get(in, end, &delta)))
+				break;
+			r->value = c->regs[r->reg] += delta;
+		}
+		r->addr = 0;
+		if (flags & TRACE_ADDR) {
+			if (!(in = Get(in, end, &delta)))
+				break;
+			r->addr = c->addr += delta;
+		}
+	}
+	free(c);
+	return i == count && in == end;
+ }
+ 
+ Trace_File *Trace_Create(const char *path)
+ {
+	Trace_File *t = calloc(1, sizeof(Trace_File));
+	
+	if (!t)
+		return 0;
+	if (!(t->buf = malloc(TRACE_ENCODED_MAX(TRACE_CHUNK))) || !(t->f = fopen(path, "wb"))) {
+		free(t->buf);
+		free(t);
+		return 0;
+	}
+	t->writing = 1;
+	if (fwrite(TRACE_MAGIC, 8, 1, t->f) != 1)
+		t->error = 1;
+	t->pos = 8;
+	return t;
+ }
+ 
+ void Trace_Write_Chunk(Trace_File *t, const Trace_Record *r, uint32_t count, uint64_t cycle)
+ {
+	Trace_Chunk_Header h;
+	Trace_Index_Entry *grown;
+	size_t bytes;
+	
+	if (t->error || !count)
+		return;
+	if (t->chunks == t->room) {
+		t->room = t->room ? t->room * 2 : 256;
+		if (!(grown = realloc(t->index, t->room * sizeof(Trace_Index_Entry)))) {
+			t->error = 1;
+			return;
+		}
+		t->index = grown;
+	}
+	if (!(bytes = Trace_Encode(r, count, t->buf))) {
+		t->error = 1;
+		return;
+	}
+	h.bytes = (uint32_t)bytes;
+	h.count = count;
+	h.cycle = cycle;
+	if (fwrite(&h, sizeof(h), 1, t->f) != 1 || fwrite(t->buf, bytes, 1, t->f) != 1) {
+		t->error = 1;
+		return;
+	}
+	t->index[t->chunks].offset = t->pos;
+	t->index[t->chunks].first = t->records;
+	t->index[t->chunks++].cycle = cycle;
+	t->pos += sizeof(h) + bytes;
+	t->records += count;
+ }
+ 
+ int Trace_Close(Trace_File *t)
+ {
+	Trace_Footer footer;
+	int ok = !t->error;
+	
+	if (t->writing && ok) {
+		memcpy(footer.magic, TRACE_INDEX_MAGIC, 8);
+		footer.index = t->pos;
+		footer.chunks = t->chunks;
+		footer.records = t->records;
+		ok = (!t->chunks || fwrite(t->index, t->chunks * sizeof(Trace_Index_Entry), 1, t->f) == 1)
+			&& fwrite(&footer, sizeof(footer), 1, t->f) == 1;
+	}
+	if (fclose(t->f))
+		ok = 0;
+	free(t->index);
+	free(t->buf);
+	free(t);
+	return ok;
+ }
+ 
+ Trace_File *Trace_Open(const char *path)
+ {
+	Trace_File *t = calloc(1, sizeof(Trace_File));
+	Trace_Footer footer;
+	char magic[8];
+	
+	if (!t)
+		return 0;
+	if (!(t->f = fopen(path, "rb"))) {
+		free(t);
+		return 0;
+	}
+	if (fread(magic, 8, 1, t->f) != 1 || memcmp(magic, TRACE_MAGIC, 8)
+		|| fseeko(t->f, -(off_t)sizeof(footer), SEEK_END) || fread(&footer, sizeof(footer), 1, t->f) != 1
+		|| memcmp(footer.magic, TRACE_INDEX_MAGIC, 8) || footer.chunks > footer.index / sizeof(Trace_Chunk_Header)
+		|| !(t->buf = malloc(TRACE_ENCODED_MAX(TRACE_CHUNK)))
+		|| !(t->index = malloc(footer.chunks * sizeof(Trace_Index_Entry) + 1))
+		|| fseeko(t->f, (off_t)footer.index, SEEK_SET)
+		|| (footer.chunks && fread(t->index, footer.chunks * sizeof(Trace_Index_Entry), 1, t->f) != 1)) {
+		Trace_Close(t);
+		return 0;
+	}
+	t->chunks = footer.chunks;
+	t->records = footer.records;
+	return t;
+ }
+ 
+ uint64_t Trace_Find(Trace_File *t, uint64_t n)
+ {
+	uint64_t lo = 0, hi = t->chunks, mid;
+	
+	if (n >= t->records)
+		return t->chunks;
+	while (hi - lo > 1) {  //last chunk whose first record is at or before n
+		mid = lo + (hi - lo) / 2;
+		if (t->index[mid].first <= n)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+ }
+ 
+ uint32_t Trace_Read_Chunk(Trace_File *t, uint64_t chunk, Trace_Record *r)
+ {
+	Trace_Chunk_Header h;
+	
+	if (chunk >= t->chunks || fseeko(t->f, (off_t)t->index[chunk].offset, SEEK_SET)
+		|| fread(&h, sizeof(h), 1, t->f) != 1 || h.count > TRACE_CHUNK || h.bytes > TRACE_ENCODED_MAX(h.count)
+		|| fread(t->buf, h.bytes, 1, t->f) != 1 || !Trace_Decode(t->buf, h.bytes, r, h.count))
+		return 0;
+	return h.count;
+ }
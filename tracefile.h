@@ -0,0 +1,105 @@
+/* =====================================================================
+ * tracefile.h
+ * instruction trace records and the compressed file they are kept in
+ * 
+ * Copyright 2011 Jack Moore (z80man) Omnimaga CoT Team
+ * 
+ * Spectrum Prizm emulator project
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *    
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *    
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * ===================================================================*/
+ 
+ #ifndef TRACEFILE_H
+ #define TRACEFILE_H
+ 
+ #include <stdio.h>
+ #include <stdint.h>
+ #include <stddef.h>
+ 
+ #define TRACE_MAGIC "PRIZMTR1"
+ #define TRACE_INDEX_MAGIC "PRIZMTIX"
+ #define TRACE_CHUNK 65536         //records coded together; a reader can start at any chunk
+ #define TRACE_ENCODED_MAX(n) ((size_t)(n) * 19)  //worst case bytes for n coded records
+ 
+ #define TRACE_PR 16               //reg for PR; 0 to 15 are R0 to R15
+ #define TRACE_NO_REG 0xff
+ 
+ #define TRACE_T     0x01          //T after the instruction
+ #define TRACE_SLOT  0x02          //ran in the delay slot of the record before
+ #define TRACE_ADDR  0x04          //addr is valid
+ #define TRACE_FAULT 0x08          //didn't finish; an exception was taken from it
+ 
+ /* one guest instruction as it ran: where, what, the first register it
+  * changed (lowest numbered, PR last) and the last address it read or
+  * wrote, so two runs can be compared record by record */
+ typedef struct
+ {
+	uint32_t pc;
+	uint16_t op;
+	uint8_t reg;                   //TRACE_NO_REG if none changed
+	uint8_t flags;                 //TRACE_* bits above
+	uint32_t value;                //what reg holds after it
+	uint32_t addr;
+ } Trace_Record;
+ 
+ /* file: TRACE_MAGIC, then chunks of a Trace_Chunk_Header and its coded
+  * records, then the index (one Trace_Index_Entry per chunk), then a
+  * Trace_Footer.  Each chunk is delta coded on its own, see tracefile.c,
+  * so seeking is reading the index and decoding one chunk */
+ typedef struct
+ {
+	uint32_t bytes, count;         //coded bytes that follow, records they hold
+	uint64_t cycle;                //guest cycles when the first one started
+ } Trace_Chunk_Header;
+ 
+ typedef struct
+ {
+	uint64_t offset;               //of the chunk header in the file
+	uint64_t first;                //number of the chunk's first record, counting from 0
+	uint64_t cycle;
+ } Trace_Index_Entry;
+ 
+ typedef struct
+ {
+	char magic[8];                 //TRACE_INDEX_MAGIC
+	uint64_t index;                //offset of the index
+	uint64_t chunks, records;
+ } Trace_Footer;
+ 
+ typedef struct
+ {
+	FILE *f;
+	int writing;
+	int error;                     //a write failed; the file is no good
+	Trace_Index_Entry *index;
+	uint64_t chunks, room;         //index entries used and allocated
+	uint64_t records;
+	uint64_t pos;                  //where the next chunk goes when writing
+	unsigned char *buf;            //TRACE_ENCODED_MAX(TRACE_CHUNK)
+ } Trace_File;
+ 
+ size_t Trace_Encode(const Trace_Record *r, uint32_t count, unsigned char *out);  //bytes written, at most TRACE_ENCODED_MAX(count)
+ int Trace_Decode(const unsigned char *in, size_t bytes, Trace_Record *r, uint32_t count);  //0 if in isn't count good records
+ 
+ Trace_File *Trace_Create(const char *path);  //0 if it can't be opened or out of memory
+ void Trace_Write_Chunk(Trace_File *t, const Trace_Record *r, uint32_t count, uint64_t cycle);
+ int Trace_Close(Trace_File *t);   //writes the index if it was created; 0 if anything failed
+ 
+ Trace_File *Trace_Open(const char *path);  //for reading; 0 if it isn't a complete trace file
+ uint64_t Trace_Find(Trace_File *t, uint64_t n);  //chunk holding record n, t->chunks if none does
+ uint32_t Trace_Read_Chunk(Trace_File *t, uint64_t chunk, Trace_Record *r);  //into TRACE_CHUNK records; how many, 0 on error
+ 
+ #endif